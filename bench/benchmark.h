@@ -0,0 +1,161 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "common.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/// Result of one benchmark case
+struct BenchResult {
+    std::string name;
+    u64 iterations;
+    double nsPerOp;         // median of the measured batches
+    double minNsPerOp;
+    double maxNsPerOp;
+    u64 bytesPerOp;
+};
+
+static volatile const void* gBenchSink = nullptr;
+
+/// Keeps a value alive, so the compiler cannot drop the code computing it
+template<typename T> inline void benchKeep(const T& value)
+{
+    // the address alone does not make the compiler compute a local value, the barrier makes it
+    // assume that the memory behind the published address is read
+    gBenchSink = &value;
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r"(&value) : "memory");
+#elif defined(_MSC_VER)
+    _ReadWriteBarrier();
+#endif
+}
+
+/// Minimal benchmark runner: every case is calibrated to run at least minTime per batch,
+/// the median of several batches is reported. Results are printed as a table (stderr) and JSON.
+class Bench
+{
+public:
+    Bench(double minTimeSec = 0.1, const std::string& filter = "", int batches = 5)
+        : mMinTimeNs(minTimeSec * 1e9)
+        , mFilter(filter)
+        , mBatches(std::max(batches, 1))
+    {
+    }
+
+    /// Runs func(iterations) which must execute the measured operation iterations times
+    template<typename F> void run(const std::string& name, u64 bytesPerOp, F&& func)
+    {
+        if (!mFilter.empty() && name.find(mFilter) == std::string::npos)
+            return;
+
+        // calibrate: double the iterations until one batch takes at least mMinTimeNs
+        u64 iterations = 1;
+        func(iterations);
+        while (true){
+            double ns = measure(func, iterations);
+            if (ns >= mMinTimeNs || iterations >= (1ull << 40))
+                break;
+            u64 factor = ns > 0 ? static_cast<u64>(std::min(mMinTimeNs * 1.2 / ns, 100.0)) : 100;
+            iterations *= std::max(factor, (u64)2);
+        }
+
+        std::vector<double> nsPerOp;
+        for (int i = 0; i < mBatches; i++)
+            nsPerOp.push_back(measure(func, iterations) / static_cast<double>(iterations));
+        std::sort(nsPerOp.begin(), nsPerOp.end());
+
+        BenchResult result;
+        result.name = name;
+        result.iterations = iterations;
+        result.nsPerOp = nsPerOp[nsPerOp.size() / 2];
+        result.minNsPerOp = nsPerOp.front();
+        result.maxNsPerOp = nsPerOp.back();
+        result.bytesPerOp = bytesPerOp;
+        mResults.push_back(result);
+
+        fprintf(stderr, "%-48s %12.1f ns/op", name.c_str(), result.nsPerOp);
+        if (bytesPerOp)
+            fprintf(stderr, " %10.1f MB/s", mbPerSec(result));
+        fprintf(stderr, "\n");
+    }
+
+    static double mbPerSec(const BenchResult& result)
+    {
+        return result.nsPerOp > 0 ? result.bytesPerOp * 1e3 / result.nsPerOp : 0;
+    }
+
+    bool writeJson(FILE* file) const
+    {
+        char timeStr[32] = {0};
+        std::time_t now = std::time(nullptr);
+        std::strftime(timeStr, sizeof(timeStr), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+        fprintf(file, "{\n  \"timestamp\": \"%s\",\n  \"compiler\": \"%s\",\n  \"min_time_s\": %.3f,\n  \"results\": [",
+                timeStr, compiler(), mMinTimeNs / 1e9);
+        for (size_t i = 0; i < mResults.size(); i++){
+            const BenchResult& r = mResults[i];
+            fprintf(file, "%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, \"min_ns_per_op\": %.3f, "
+                    "\"max_ns_per_op\": %.3f, \"bytes_per_op\": %llu, \"mb_per_s\": %.3f}",
+                    i ? "," : "", r.name.c_str(), (unsigned long long)r.iterations, r.nsPerOp, r.minNsPerOp,
+                    r.maxNsPerOp, (unsigned long long)r.bytesPerOp, mbPerSec(r));
+        }
+        fprintf(file, "\n  ]\n}\n");
+        return ferror(file) == 0;
+    }
+
+    const std::vector<BenchResult>& results() const { return mResults; }
+
+private:
+    template<typename F> static double measure(F& func, u64 iterations)
+    {
+        auto start = std::chrono::steady_clock::now();
+        func(iterations);
+        return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    static const char* compiler()
+    {
+#if defined(_MSC_VER)
+        return "msvc " _CRT_STRINGIZE(_MSC_VER);
+#elif defined(__VERSION__)
+        return __VERSION__;
+#else
+        return "unknown";
+#endif
+    }
+
+private:
+    double mMinTimeNs;
+    std::string mFilter;
+    int mBatches;
+    std::vector<BenchResult> mResults;
+};
+
+#endif /* !BENCHMARK_H */
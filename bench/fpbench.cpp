@@ -0,0 +1,406 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Microbenchmarks of the FPDev and binding hot paths, run against the simulated device.
+//
+//   fpbench [--json <file>] [--filter <text>] [--min-time <seconds>]
+//
+// The table is printed to stderr, the JSON results to stdout or to the --json file.
+#define NOMINMAX
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "benchmark.h"
+#include "binlog.h"
+#include "buffer.h"
+#include "bufferpool.h"
+#include "crc32c.h"
+#include "filelog.h"
+#include "fpdev.h"
+#include "strutils.h"
+
+// Writes go to a loopback device: the simulator copies the data to its FIFO as a device would
+// receive it, and the FIFO is emptied after every write (resetDevice only resets its pointers),
+// so that it never fills up. A pattern device discards written data, which measures nothing.
+// Reads use the pattern device, which generates the data without a previous write.
+static void benchPipes(Bench& bench, FPDev& dev, FPDev& loopback)
+{
+    const size_t blockSize = 1024;
+    // multiples of the block size and sizes that need the padding path
+    const size_t sizes[] = {1024, 16384, 262144, 4194304, 1000, 16000, 262000};
+    const size_t offsets[] = {0, 3};
+
+    Buffer<byte> buff(4194304 + 64);
+    for (size_t size : sizes){
+        for (size_t offset : offsets){
+            byte* data = buff.data() + offset;
+            std::string params = str::format("size=%zu/offset=%zu", size, offset);
+            bench.run("pipe_write/" + params, size, [&](u64 n){
+                for (u64 i = 0; i < n; i++){
+                    loopback.writePipe(0x80, data, size, blockSize);
+                    loopback.resetDevice();
+                }
+            });
+            bench.run("pipe_read/" + params, size, [&](u64 n){
+                for (u64 i = 0; i < n; i++)
+                    dev.readPipe(0xA0, data, size, blockSize);
+            });
+        }
+    }
+}
+
+static void benchPipeLog(Bench& bench, FPDev& loopback)
+{
+    const size_t size = 262144;
+    Buffer<byte> buff(size);
+    for (size_t i = 0; i < size; i++)
+        buff.data()[i] = static_cast<byte>(i * 7);
+    bench.run(str::format("crc32c/size=%zu", size), size, [&](u64 n){
+        u32 crc = 0;
+        for (u64 i = 0; i < n; i++)
+            crc = Crc32c::update(crc, buff.data(), size);
+        benchKeep(crc);
+    });
+
+    std::string fileName = (std::filesystem::temp_directory_path() / "fpbench_pipe.log").string();
+    {
+        FileLog log(fileName.c_str(), true, false, LOG_MSG);
+        log.setAsync(true);
+        loopback.setPipeLog(&log, 1000);
+        bench.run(str::format("pipe_write/logged/size=%zu", size), size, [&](u64 n){
+            for (u64 i = 0; i < n; i++){
+                loopback.writePipe(0x80, buff.data(), size, 1024);
+                loopback.resetDevice();
+            }
+        });
+        loopback.setPipeLog(nullptr);
+    }
+    std::error_code err;
+    std::filesystem::remove(fileName, err);
+}
+
+static void benchRegistersAndWires(Bench& bench, FPDev& dev)
+{
+    bench.run("register_write", 0, [&](u64 n){
+        for (u64 i = 0; i < n; i++)
+            dev.writeRegister(0x10, static_cast<u32>(i));
+    });
+    bench.run("register_read", 0, [&](u64 n){
+        for (u64 i = 0; i < n; i++)
+            benchKeep(dev.readRegister(0x10));
+    });
+
+    dev.setStatsEnabled(false);
+    bench.run("register_write/stats=off", 0, [&](u64 n){
+        for (u64 i = 0; i < n; i++)
+            dev.writeRegister(0x10, static_cast<u32>(i));
+    });
+    dev.setStatsEnabled(true);
+
+    bench.run("wire_in_set/send=1", 0, [&](u64 n){
+        for (u64 i = 0; i < n; i++)
+            dev.setWireIn(0x01, static_cast<u32>(i), true);
+    });
+    bench.run("wire_in_set/send=0", 0, [&](u64 n){
+        for (u64 i = 0; i < n; i++)
+            dev.setWireIn(0x01, static_cast<u32>(i), false);
+    });
+    bench.run("wire_in_set/unchanged", 0, [&](u64 n){
+        for (u64 i = 0; i < n; i++)
+            dev.setWireIn(0x02, 0x1234, true);
+    });
+    bench.run("wire_out_get/refresh=1", 0, [&](u64 n){
+        for (u64 i = 0; i < n; i++)
+            benchKeep(dev.getWireOut(0x20, true));
+    });
+    bench.run("wire_out_get/cached", 0, [&](u64 n){
+        for (u64 i = 0; i < n; i++)
+            benchKeep(dev.getWireOutCached(0x20, 1000000));
+    });
+}
+
+struct BenchFileLog : public FileLog
+{
+    using FileLog::FileLog;
+    using FileLog::formatTime;
+    using FileLog::formatBuffer;
+};
+
+static void benchFileLog(Bench& bench)
+{
+    std::string fileName = (std::filesystem::temp_directory_path() / "fpbench.log").string();
+    {
+        BenchFileLog log(fileName.c_str(), true, false, LOG_MSG);
+        bench.run("filelog_time", 0, [&](u64 n){
+            char time[FILELOG_TIME_SIZE];
+            for (u64 i = 0; i < n; i++)
+                benchKeep(log.formatTime(time));
+        });
+        std::vector<unsigned char> payload(4096);
+        for (size_t i = 0; i < payload.size(); i++)
+            payload[i] = static_cast<unsigned char>(i * 7);
+        bench.run("filelog_hexdump/size=4096", 0, [&](u64 n){
+            std::string out;
+            for (u64 i = 0; i < n; i++){
+                out.clear();
+                log.formatBuffer(out, payload.data(), payload.size(), 250, true);
+                benchKeep(out.size());
+            }
+        });
+        bench.run("filelog_log", 0, [&](u64 n){
+            for (u64 i = 0; i < n; i++)
+                FILELOG(log, LOG_MSG, "Pipe 0x%02X transferred %d bytes (%s)", 0xA0, static_cast<int>(i), "ok");
+        });
+        bench.run("filelog_log/filtered", 0, [&](u64 n){
+            for (u64 i = 0; i < n; i++)
+                FILELOG(log, LOG_DBG, "Pipe 0x%02X transferred %d bytes (%s)", 0xA0, static_cast<int>(i), "ok");
+        });
+    }
+    {
+        FileLog log(fileName.c_str(), true, false, LOG_MSG);
+        log.setAsync(true);
+        bench.run("filelog_log/async", 0, [&](u64 n){
+            for (u64 i = 0; i < n; i++)
+                FILELOG(log, LOG_MSG, "Pipe 0x%02X transferred %d bytes (%s)", 0xA0, static_cast<int>(i), "ok");
+            log.flush();
+        });
+    }
+    std::error_code err;
+    std::filesystem::remove(fileName, err);
+}
+
+static void benchBinLog(Bench& bench)
+{
+    std::string fileName = (std::filesystem::temp_directory_path() / "fpbench.fpbl").string();
+    {
+        BinLog log(BINLOG_QUEUE_SIZE, LOG_OVERFLOW_BLOCK, LOG_MSG);
+        log.open(fileName.c_str());
+        bench.run("binlog_log", 0, [&](u64 n){
+            for (u64 i = 0; i < n; i++)
+                BINLOG(log, LOG_MSG, "Pipe 0x%02X transferred %d bytes (%s)", 0xA0, static_cast<int>(i), "ok");
+            log.flush();
+        });
+        bench.run("binlog_log/filtered", 0, [&](u64 n){
+            for (u64 i = 0; i < n; i++)
+                BINLOG(log, LOG_DBG, "Pipe 0x%02X transferred %d bytes (%s)", 0xA0, static_cast<int>(i), "ok");
+        });
+    }
+    std::error_code err;
+    std::filesystem::remove(fileName, err);
+}
+
+static void benchBuffer(Bench& bench)
+{
+    const size_t sizes[] = {64, 4096, 1048576, 67108864};
+    for (size_t size : sizes){
+        bench.run(str::format("buffer_alloc/size=%zu", size), 0, [&](u64 n){
+            for (u64 i = 0; i < n; i++){
+                Buffer<byte> buff(size);
+                benchKeep(buff.data()[0]);
+            }
+        });
+        bench.run(str::format("buffer_alloc/uninitialized/size=%zu", size), 0, [&](u64 n){
+            for (u64 i = 0; i < n; i++){
+                Buffer<byte> buff(size, BUFFER_INIT_NONE, BUFFER_CACHE_LINE);
+                benchKeep(buff.data());
+            }
+        });
+        bench.run(str::format("buffer_lease/size=%zu", size), 0, [&](u64 n){
+            for (u64 i = 0; i < n; i++){
+                Buffer<byte> buff = BufferPool::global().lease<byte>(size);
+                benchKeep(buff.data());
+            }
+        });
+    }
+}
+
+// allocation and first pass over a capture buffer, the pool is empty every time
+static void benchLargePages(Bench& bench)
+{
+    const size_t size = 67108864;
+    const std::pair<const char*, int> modes[] = {{"regular", 0}, {"prefault", LARGEPAGE_PREFAULT},
+                                                 {"huge_prefault", LARGEPAGE_HUGE | LARGEPAGE_PREFAULT}};
+    for (auto& mode : modes){
+        bench.run(str::format("buffer_first_pass/%s/size=%zu", mode.first, size), size, [&](u64 n){
+            for (u64 i = 0; i < n; i++){
+                BufferPool pool;
+                pool.setLargePages(mode.second);
+                Buffer<byte> buff = pool.lease<byte>(size);
+                memset(buff.data(), static_cast<int>(i), size);
+                benchKeep(buff.data()[size - 1]);
+            }
+        });
+    }
+}
+
+// Stream and copy based conversions that strutils used before to_chars/from_chars, kept as a baseline
+namespace legacy
+{
+    template <typename T> std::string to_string(const T& value)
+    {
+        std::stringstream ss;
+        ss << value;
+        return ss.str();
+    }
+
+    template <typename T> T to_num(const std::string& str)
+    {
+        T value;
+        std::stringstream ss(str);
+        return (!(ss >> value)) ? T() : value;
+    }
+
+    template<typename... Args> std::string format(const char* fmt, Args... args)
+    {
+        size_t size = snprintf(nullptr, 0, fmt, args...);
+        std::string buff;
+        buff.resize(size);
+        snprintf(&buff[0], size + 1, fmt, args...);
+        return buff;
+    }
+}
+
+static void benchStrutils(Bench& bench)
+{
+    const char* options = "pipe=loopback,bw=300,latency=20,seed=1";
+    // volatile inputs, so that the compiler cannot fold the conversions of constants
+    const char* volatile ints[] = {"123456", "-42", "7", "2147483"};
+    const char* volatile doubles[] = {"300.25", "-1e-3", "20", "0.5"};
+    const char* volatile hexes[] = {"0xDEADBEEF", "1F", "0x80", "a0"};
+    bench.run("str_format/snprintf_twice", 0, [&](u64 n){
+        for (u64 i = 0; i < n; i++)
+            benchKeep(legacy::format("Firmware %d.%d %s %.3f", 1, static_cast<int>(i), "serial", 1.5));
+    });
+    bench.run("str_format", 0, [&](u64 n){
+        for (u64 i = 0; i < n; i++)
+            benchKeep(str::format("Firmware %d.%d %s %.3f", 1, static_cast<int>(i), "serial", 1.5));
+    });
+    bench.run("str_to_string/stream", 0, [&](u64 n){
+        for (u64 i = 0; i < n; i++)
+            benchKeep(legacy::to_string(i));
+    });
+    bench.run("str_to_string", 0, [&](u64 n){
+        for (u64 i = 0; i < n; i++)
+            benchKeep(str::to_string(i));
+    });
+    bench.run("str_to_chars", 0, [&](u64 n){
+        char buff[32];
+        size_t sum = 0;
+        for (u64 i = 0; i < n; i++)
+            sum += str::to_chars(buff, buff + sizeof(buff), i) - buff;
+        benchKeep(sum);
+    });
+    bench.run("str_to_int/stream", 0, [&](u64 n){
+        i64 sum = 0;
+        for (u64 i = 0; i < n; i++)
+            sum += legacy::to_num<int>(ints[i & 3]);
+        benchKeep(sum);
+    });
+    bench.run("str_to_int", 0, [&](u64 n){
+        i64 sum = 0;
+        for (u64 i = 0; i < n; i++)
+            sum += str::to_int(ints[i & 3]);
+        benchKeep(sum);
+    });
+    bench.run("str_to_double/stream", 0, [&](u64 n){
+        double sum = 0;
+        for (u64 i = 0; i < n; i++)
+            sum += legacy::to_num<double>(doubles[i & 3]);
+        benchKeep(sum);
+    });
+    bench.run("str_to_double", 0, [&](u64 n){
+        double sum = 0;
+        for (u64 i = 0; i < n; i++)
+            sum += str::to_double(doubles[i & 3]);
+        benchKeep(sum);
+    });
+    bench.run("str_hex_to_value", 0, [&](u64 n){
+        u32 sum = 0;
+        for (u64 i = 0; i < n; i++)
+            sum += str::hex_string_to_value<u32>(hexes[i & 3]);
+        benchKeep(sum);
+    });
+    bench.run("str_split", 0, [&](u64 n){
+        for (u64 i = 0; i < n; i++)
+            benchKeep(str::split(options, ","));
+    });
+    bench.run("str_split_view", 0, [&](u64 n){
+        str::small_vector<std::string_view, 8> items;
+        size_t sum = 0;
+        for (u64 i = 0; i < n; i++)
+            sum += str::split_view(options, ",", items);
+        benchKeep(sum);
+    });
+}
+
+int main(int argc, char* argv[])
+{
+    const char* jsonFile = nullptr;
+    std::string filter;
+    double minTime = 0.1;
+    for (int i = 1; i < argc; i++){
+        if (!strcmp(argv[i], "--json") && i + 1 < argc)
+            jsonFile = argv[++i];
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+            filter = argv[++i];
+        else if (!strcmp(argv[i], "--min-time") && i + 1 < argc)
+            minTime = str::to_double_def(argv[++i], minTime);
+        else {
+            fprintf(stderr, "usage: %s [--json <file>] [--filter <text>] [--min-time <seconds>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    FPDev dev;
+    FPDev loopback;
+    int rc = dev.open("SIM:pipe=pattern", "");
+    if (rc == 0)
+        rc = loopback.open("SIM:pipe=loopback", "");
+    if (rc){
+        fprintf(stderr, "Cannot open the simulated device: %d %s\n", rc, dev.lastError().c_str());
+        return 1;
+    }
+
+    Bench bench(minTime, filter);
+    benchPipes(bench, dev, loopback);
+    benchPipeLog(bench, loopback);
+    benchRegistersAndWires(bench, dev);
+    benchFileLog(bench);
+    benchBinLog(bench);
+    benchBuffer(bench);
+    benchLargePages(bench);
+    benchStrutils(bench);
+    dev.close();
+    loopback.close();
+
+    FILE* file = jsonFile ? fopen(jsonFile, "w") : stdout;
+    if (!file){
+        fprintf(stderr, "Cannot create %s\n", jsonFile);
+        return 1;
+    }
+    bool ok = bench.writeJson(file);
+    if (jsonFile)
+        fclose(file);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,23 @@
+"""Python interface to Opal Kelly FrontPanel devices"""
+import importlib
+
+# The extension needs the FrontPanel library, it is loaded on the first use of its names, so that
+# python -m py_fp.logdecode runs on machines without the SDK.
+
+
+def _load():
+    _py_fp = importlib.import_module(__name__ + "._py_fp")
+    names = {name: value for name, value in vars(_py_fp).items() if not name.startswith("_")}
+    globals().update(names)
+    return names
+
+
+def __getattr__(name):
+    if name == "__all__":
+        return sorted(_load())
+    if name.startswith("_"):
+        raise AttributeError(name)
+    names = _load()
+    if name not in names:
+        raise AttributeError("module {!r} has no attribute {!r}".format(__name__, name))
+    return names[name]
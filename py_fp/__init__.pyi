@@ -1,20 +1,77 @@
+import logging
+from typing import Callable, overload
 
 def list_devices() -> list[tuple[str,str]]: ...
+def buffer_pool_stats() -> dict[str, int]: ...
+def set_buffer_pool_limit(max_bytes: int) -> int: ...
+def set_large_pages(huge_pages: bool = False, prefault: bool = False, lock: bool = False) -> int: ...
+
+
+class Buffer:
+    alignment: int
+    def __init__(self, size: int, alignment: int = 4096) -> None: ...
+    def __len__(self) -> int: ...
+    @overload
+    def __getitem__(self, key: int) -> int: ...
+    @overload
+    def __getitem__(self, key: slice) -> Buffer: ...
+    @overload
+    def __setitem__(self, key: int, value: int) -> None: ...
+    @overload
+    def __setitem__(self, key: slice, value: bytes | bytearray | memoryview | Buffer) -> None: ...
 
 
 class FPDevice:
     def __init__(self) -> None: ...
     def list_devices(self) -> list[tuple[str,str]]: ...
-    def open(self, serial: str, firmware_file: str, log_file: str) -> int: ...
+    def open(self, serial: str, firmware_file: str, log_file: str, flash_index: int = -1) -> int: ...
     def close(self) -> int: ...
     def set_wire_in(self, address: int, value: int, send_now: bool) -> int: ...
-    def get_wire_out(self, address: int, refresh_wires: bool) -> int: ...
+    def set_wire_in_bits(self, address: int, mask: int, value: int, send_now: bool = True) -> int: ...
+    def update_wire_ins(self, force: bool = False) -> int: ...
+    def get_wire_in(self, address: int) -> int: ...
+    def get_wire_out(self, address: int, refresh_wires: bool = True, max_age_us: int = -1) -> int: ...
+    def start_wire_out_watcher(self, period_us: int = 1000, mask: int = 0xFFFFFFFF, callback: Callable[[list[tuple[int, int, int, int]]], None] | None = None, queue_size: int = 4096) -> int: ...
+    def stop_wire_out_watcher(self) -> int: ...
+    def wait_wire_out_events(self, timeout_ms: int = -1, max_events: int = 0) -> list[tuple[int, int, int, int]]: ...
+    def activate_trigger_in(self, address: int, bit: int) -> int: ...
+    def update_trigger_outs(self) -> int: ...
+    def is_triggered(self, address: int, mask: int = 0xFFFFFFFF) -> int: ...
     def write_register(self, address: int, value: int) -> int: ...
     def read_register(self, address: int) -> int: ...
-    def write_pipe(self, address: int, data: list[int], block_size: int) -> int: ...
-    def read_pipe(self, address: int, data: list[int], block_size: int) -> int: ...
+    def write_pipe(self, address: int, data: list[int] | bytes | bytearray | memoryview | Buffer, block_size: int = 0) -> int: ...
+    def read_pipe(self, address: int, data: list[int] | bytearray | memoryview | Buffer, block_size: int = 0) -> int: ...
+    def device_info(self) -> dict[str, str | int | bool]: ...
+    def set_transfer_defaults(self, block_size: int = 0, max_chunk_size: int = 0) -> int: ...
     def set_timeout(self, timeout: float) -> int: ...
+    def record_start(self, file_name: str, pipe_in_data: bool = False) -> int: ...
+    def record_stop(self) -> int: ...
     def set_device_id(self, deviceID: str) -> int: ...
     def get_device_id(self) -> str: ...
+    def set_auto_reconnect(self, enabled: bool, attempts: int = 5, delay_ms: int = 10, reconfigure: bool = False) -> int: ...
+    def record_register_writes(self, enable: bool) -> int: ...
+    def reconnect(self) -> int: ...
+    def get_reconnect_info(self) -> dict[str, int]: ...
+    def flash_erase_sector(self, address: int) -> int: ...
+    def flash_write(self, address: int, data: bytes) -> int: ...
+    def flash_read(self, address: int, size: int) -> bytes: ...
+    def flash_program(self, address: int, data: bytes, verify: bool = True, progress: Callable[[int, int], bool | None] | None = None) -> int: ...
+    def configure_from_flash(self, index: int) -> int: ...
+    def get_flash_layout(self) -> dict[str, int]: ...
+    def get_stats(self) -> dict[str, dict]: ...
+    def reset_stats(self) -> int: ...
+    def get_pipe_monitor(self, address: int) -> tuple[float, int, int, int, int, int, int]: ...
+    def get_pipe_monitors(self) -> dict[int, tuple[float, int, int, int, int, int, int]]: ...
+    def set_monitor_time_constant(self, seconds: float) -> int: ...
+    def set_stats_enabled(self, enabled: bool) -> int: ...
+    def trace_start(self, events_per_thread: int = 65536, max_threads: int = 16) -> int: ...
+    def trace_stop(self) -> int: ...
+    def trace_dump(self, file_name: str) -> int: ...
     def log(self, log_level: int, text: str, notime: bool) -> int: ...
+    def set_log_async(self, enabled: bool, queue_size: int = 8192, drop: bool = False) -> int: ...
+    def get_log_dropped(self) -> int: ...
+    def set_log_rotation(self, max_size: int = 0, interval: int = 0, keep: int = 5, compress: bool = True) -> int: ...
+    def set_log_handler(self, logger: logging.Logger | None, queue_size: int = 8192) -> int: ...
+    def drain_log(self) -> int: ...
+    def set_pipe_log(self, enabled: bool, dump_every: int = 0, dump_errors: bool = True, dump_size: int = 256) -> int: ...
 
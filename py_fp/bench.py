@@ -0,0 +1,196 @@
+"""Throughput and latency measurement of a FrontPanel device.
+
+    python -m py_fp.bench <serial> [options]
+
+Sweeps block sizes and transfer lengths of a pipe-in and a pipe-out endpoint and
+measures the register and wire round-trip latency. The results are printed as a
+table and optionally written as JSON. Pipes use py_fp.Buffer, the zero-copy path of
+the binding, so the numbers reflect the device and the link, not list conversions.
+"""
+import argparse
+import json
+import platform
+import sys
+import time
+
+from . import Buffer, FPDevice
+
+
+def parse_int_list(text):
+    return [int(item, 0) for item in text.split(",") if item.strip()]
+
+
+def percentiles(samples_ns):
+    """Returns latency statistics in us of a list of durations in ns"""
+    if not samples_ns:
+        return {}
+    values = sorted(samples_ns)
+
+    def pct(p):
+        return values[min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))] / 1000.0
+
+    return {
+        "count": len(values),
+        "min_us": values[0] / 1000.0,
+        "p50_us": pct(50),
+        "p90_us": pct(90),
+        "p99_us": pct(99),
+        "max_us": values[-1] / 1000.0,
+        "mean_us": sum(values) / len(values) / 1000.0,
+    }
+
+
+def bench_pipe(device, address, is_read, block_size, length, duration, max_transfers):
+    """Repeats one transfer for the given duration, returns throughput and latency"""
+    buff = Buffer(length)
+    transfer = device.read_pipe if is_read else device.write_pipe
+    samples = []
+    error = 0
+    clock = time.perf_counter_ns
+    end = clock() + int(duration * 1e9)
+    start = clock()
+    while len(samples) < max_transfers:
+        t0 = clock()
+        rc = transfer(address, buff, block_size)
+        t1 = clock()
+        if rc < 0:
+            error = rc
+            break
+        samples.append(t1 - t0)
+        if t1 >= end:
+            break
+    total_ns = clock() - start
+
+    result = {
+        "endpoint": "0x%02X" % address,
+        "direction": "out" if is_read else "in",
+        "block_size": block_size,
+        "length": length,
+        "transfers": len(samples),
+        "error": error,
+        "mb_per_s": length * len(samples) * 1e3 / total_ns if samples and total_ns else 0.0,
+    }
+    result.update(percentiles(samples))
+    return result
+
+
+def bench_latency(device, name, func, iterations):
+    samples = []
+    error = 0
+    clock = time.perf_counter_ns
+    for _ in range(iterations):
+        t0 = clock()
+        rc = func()
+        t1 = clock()
+        if rc < 0:
+            error = rc
+            break
+        samples.append(t1 - t0)
+    result = {"name": name, "error": error}
+    result.update(percentiles(samples))
+    return result
+
+
+def print_tables(report, out):
+    out.write("\nPipes\n")
+    out.write("%-5s %-4s %7s %10s %9s %10s %10s %10s %10s %6s\n" % (
+        "ep", "dir", "block", "length", "transfers", "MB/s", "p50 us", "p99 us", "max us", "error"))
+    for r in report["pipes"]:
+        out.write("%-5s %-4s %7d %10d %9d %10.1f %10.1f %10.1f %10.1f %6d\n" % (
+            r["endpoint"], r["direction"], r["block_size"], r["length"], r["transfers"], r["mb_per_s"],
+            r.get("p50_us", 0), r.get("p99_us", 0), r.get("max_us", 0), r["error"]))
+
+    out.write("\nLatency\n")
+    out.write("%-22s %8s %9s %9s %9s %9s %9s %6s\n" % (
+        "operation", "count", "min us", "p50 us", "p90 us", "p99 us", "max us", "error"))
+    for r in report["latency"]:
+        out.write("%-22s %8d %9.1f %9.1f %9.1f %9.1f %9.1f %6d\n" % (
+            r["name"], r.get("count", 0), r.get("min_us", 0), r.get("p50_us", 0), r.get("p90_us", 0),
+            r.get("p99_us", 0), r.get("max_us", 0), r["error"]))
+    out.write("\n")
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(prog="python -m py_fp.bench", description=__doc__.splitlines()[0])
+    parser.add_argument("serial", help="device serial, SIM:<options> for the simulator")
+    parser.add_argument("--firmware", default="", help="firmware file to configure the FPGA with")
+    parser.add_argument("--flash-index", type=int, default=-1, help="boot the FPGA from flash")
+    parser.add_argument("--log", default="py_fp_bench.log", help="log file of the device")
+    parser.add_argument("--pipe-in", type=lambda x: int(x, 0), default=0x80, help="pipe-in endpoint, -1 to skip")
+    parser.add_argument("--pipe-out", type=lambda x: int(x, 0), default=0xA0, help="pipe-out endpoint, -1 to skip")
+    parser.add_argument("--block-sizes", type=parse_int_list, default=[64, 256, 1024, 4096, 16384])
+    parser.add_argument("--lengths", type=parse_int_list, default=[4096, 65536, 1048576, 16777216])
+    parser.add_argument("--duration", type=float, default=0.5, help="seconds per pipe measurement")
+    parser.add_argument("--max-transfers", type=int, default=100000, help="transfers per pipe measurement")
+    parser.add_argument("--register", type=lambda x: int(x, 0), default=0x00, help="register address, -1 to skip")
+    parser.add_argument("--wire-in", type=lambda x: int(x, 0), default=0x00, help="wire-in address, -1 to skip")
+    parser.add_argument("--wire-out", type=lambda x: int(x, 0), default=0x20, help="wire-out address, -1 to skip")
+    parser.add_argument("--iterations", type=int, default=2000, help="calls per latency measurement")
+    parser.add_argument("--json", help="write the results as JSON to this file (- for stdout)")
+    args = parser.parse_args(argv)
+
+    device = FPDevice()
+    rc = device.open(args.serial, args.firmware, args.log, args.flash_index)
+    if rc:
+        sys.stderr.write("Cannot open device %s: %d\n" % (args.serial, rc))
+        return 1
+
+    report = {
+        "serial": args.serial,
+        "timestamp": time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime()),
+        "host": platform.node(),
+        "platform": platform.platform(),
+        "pipes": [],
+        "latency": [],
+    }
+
+    try:
+        endpoints = [(args.pipe_in, False), (args.pipe_out, True)]
+        for address, is_read in endpoints:
+            if address < 0:
+                continue
+            for block_size in args.block_sizes:
+                for length in args.lengths:
+                    if length < block_size:
+                        continue
+                    report["pipes"].append(bench_pipe(device, address, is_read, block_size, length,
+                                                      args.duration, args.max_transfers))
+
+        if args.register >= 0:
+            reg = args.register
+            report["latency"].append(bench_latency(device, "write_register", lambda: device.write_register(reg, 0x12345678), args.iterations))
+            report["latency"].append(bench_latency(device, "read_register", lambda: device.read_register(reg), args.iterations))
+        counter = [0]  # wire-ins are changed on every call, unchanged values are not sent to the device
+        if args.wire_in >= 0:
+            wire_in = args.wire_in
+
+            def set_wire_in():
+                counter[0] += 1
+                return device.set_wire_in(wire_in, counter[0] & 0xFFFFFFFF, True)
+            report["latency"].append(bench_latency(device, "set_wire_in", set_wire_in, args.iterations))
+        if args.wire_out >= 0:
+            wire_out = args.wire_out
+            report["latency"].append(bench_latency(device, "get_wire_out", lambda: device.get_wire_out(wire_out, True), args.iterations))
+        if args.wire_in >= 0 and args.wire_out >= 0:
+            wire_in, wire_out = args.wire_in, args.wire_out
+
+            def round_trip():
+                counter[0] += 1
+                rc = device.set_wire_in(wire_in, counter[0] & 0xFFFFFFFF, True)
+                return rc if rc < 0 else device.get_wire_out(wire_out, True)
+            report["latency"].append(bench_latency(device, "wire_round_trip", round_trip, args.iterations))
+    finally:
+        device.close()
+
+    print_tables(report, sys.stdout if args.json != "-" else sys.stderr)
+    if args.json == "-":
+        json.dump(report, sys.stdout, indent=2)
+        sys.stdout.write("\n")
+    elif args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
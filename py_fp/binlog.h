@@ -0,0 +1,825 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef BINLOG_H
+#define BINLOG_H
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "filelog.h"
+
+// Binary log file: the magic followed by records [u8 kind][u32 size][payload], in the byte order
+// of the writing host; logs are decoded on hosts of the same byte order.
+//   BINLOG_FORMAT  u32 id, u8 level, u16 types length, types, u32 format length, format
+//   BINLOG_MESSAGE u32 id, i64 time (ns since the epoch), arguments in the order of the types:
+//                  i int32, I int64, u uint32, U uint64, d double, p uint64, s u16 length + bytes
+#define BINLOG_MAGIC "FPBLOG01"
+#define BINLOG_MAGIC_SIZE 8
+#define BINLOG_FORMAT 1
+#define BINLOG_MESSAGE 2
+#define BINLOG_QUEUE_SIZE 4096
+#define BINLOG_RECORD_SIZE 240
+#define BINLOG_WRITE_INTERVAL_MS 10
+
+/// Logs a printf-style message into a BinLog. Only the id of the format string, the time and
+/// the raw argument values are queued, the text is formatted by the decoder. Every call site
+/// registers its format string once per level, levels above FILELOG_MIN_LEVEL are compiled out.
+#define BINLOG(log, level, format, ...)                                                                        \
+    do {                                                                                                       \
+        if ((level) <= FILELOG_MIN_LEVEL && (log).enabled(level))                                              \
+            [&](const auto&... binlogArgs) {                                                                   \
+                static BinLogSite binlogSite(format, BinLog::argTypes<decltype(binlogArgs)...>());             \
+                (log).write(binlogSite.id(level), binlogArgs...);                                              \
+            }(__VA_ARGS__);                                                                                    \
+    } while (0)
+
+/// Type code of a logged argument, see the file layout above
+template <typename T, typename Enable = void>
+struct BinLogArg;
+
+template <typename T>
+struct BinLogArg<T, std::enable_if_t<std::is_integral<T>::value && std::is_signed<T>::value>> {
+    static constexpr char type = sizeof(T) <= 4 ? 'i' : 'I';
+};
+
+template <typename T>
+struct BinLogArg<T, std::enable_if_t<std::is_integral<T>::value && !std::is_signed<T>::value>> {
+    static constexpr char type = sizeof(T) <= 4 ? 'u' : 'U';
+};
+
+template <typename T>
+struct BinLogArg<T, std::enable_if_t<std::is_enum<T>::value>> {
+    static constexpr char type = 'i';
+};
+
+template <typename T>
+struct BinLogArg<T, std::enable_if_t<std::is_floating_point<T>::value>> {
+    static constexpr char type = 'd';
+};
+
+template <typename T>
+struct BinLogArg<T*, std::enable_if_t<!std::is_same<std::remove_cv_t<T>, char>::value>> {
+    static constexpr char type = 'p';
+};
+
+template <typename T>
+struct BinLogArg<T*, std::enable_if_t<std::is_same<std::remove_cv_t<T>, char>::value>> {
+    static constexpr char type = 's';
+};
+
+template <>
+struct BinLogArg<std::string> {
+    static constexpr char type = 's';
+};
+
+/// Bounded lock-free queue of binary log records, any number of producers and a single consumer.
+/// Records are serialized directly into fixed-size slots, a producer claims a slot, fills it and
+/// publishes it, so a log call does not allocate or copy the record twice.
+class BinLogQueue {
+  public:
+    explicit BinLogQueue(size_t capacity)
+        : mEnqueuePos(0)
+        , mDequeuePos(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mMask = size - 1;
+        mSlots.reset(new Slot[size]);
+        for (size_t i = 0; i < size; i++)
+            mSlots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    /// Claims a free slot of BINLOG_RECORD_SIZE bytes, returns NULL if the queue is full
+    char* claim(size_t& pos)
+    {
+        pos = mEnqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            Slot* slot = &mSlots[pos & mMask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    return slot->data;
+            }
+            else if (diff < 0)
+                return NULL;
+            else
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    /// Hands a claimed slot with size bytes of record to the consumer
+    void publish(size_t pos, size_t size)
+    {
+        Slot* slot = &mSlots[pos & mMask];
+        slot->size = static_cast<uint32_t>(size);
+        slot->seq.store(pos + 1, std::memory_order_release);
+    }
+
+    /// Oldest record or NULL, consumer thread only
+    const char* front(size_t& size)
+    {
+        Slot* slot = &mSlots[mDequeuePos & mMask];
+        if (slot->seq.load(std::memory_order_acquire) != mDequeuePos + 1)
+            return NULL;
+        size = slot->size;
+        return slot->data;
+    }
+
+    /// Releases the record returned by front()
+    void pop()
+    {
+        mSlots[mDequeuePos & mMask].seq.store(mDequeuePos + mMask + 1, std::memory_order_release);
+        mDequeuePos++;
+    }
+
+    size_t capacity() const { return mMask + 1; }
+
+    bool empty() const
+    {
+        return mSlots[mDequeuePos & mMask].seq.load(std::memory_order_acquire) != mDequeuePos + 1;
+    }
+
+  private:
+    struct alignas(64) Slot {
+        std::atomic<size_t> seq;
+        uint32_t size;
+        char data[BINLOG_RECORD_SIZE];
+    };
+
+    alignas(64) std::atomic<size_t> mEnqueuePos;
+    alignas(64) size_t mDequeuePos;
+    size_t mMask;
+    std::unique_ptr<Slot[]> mSlots;
+};
+
+/// Format string of a BINLOG call site. The level is part of the registered format, so a call
+/// site logging with a level chosen at run time gets one id per level.
+class BinLogSite {
+  public:
+    BinLogSite(const char* format, const char* types)
+        : mFormat(format)
+        , mTypes(types)
+    {
+        for (auto& id : mIds)
+            id.store(UINT32_MAX, std::memory_order_relaxed);
+    }
+
+    inline uint32_t id(int logLevel);
+
+  private:
+    const char* mFormat;
+    const char* mTypes;
+    std::atomic<uint32_t> mIds[LOG_DBG + 1];
+};
+
+/// Log with deferred formatting for high-rate tracing. Producers only copy the raw arguments
+/// into a lock-free queue, a writer thread appends them to a binary file that is turned into
+/// the FileLog text format by BinLogReader, fplogdecode or python -m py_fp.logdecode.
+class BinLog {
+  public:
+    BinLog(size_t queueSize = BINLOG_QUEUE_SIZE, LogOverflow overflow = LOG_OVERFLOW_BLOCK, LogLevel logLevel = LOG_DBG)
+        : mFile(NULL)
+        , mQueueSize(queueSize)
+        , mOverflow(overflow)
+        , mLogLevel(logLevel)
+        , mOpen(false)
+        , mQueueRefs(0)
+        , mStopWriter(false)
+        , mWakePending(false)
+        , mWriterSleeping(false)
+        , mEnqueued(0)
+        , mWritten(0)
+        , mDropped(0)
+    {
+    }
+
+    virtual ~BinLog()
+    {
+        close();
+    }
+
+    /// Creates the file and starts the writer, returns false if the file cannot be created
+    bool open(const char* fileName)
+    {
+        close();
+        std::lock_guard<std::mutex> lock(mOpenMutex);
+#ifdef _MSC_VER
+        if (fopen_s(&mFile, fileName, "wb"))
+            mFile = NULL;
+#else
+        mFile = fopen(fileName, "wb");
+#endif
+        if (!mFile)
+            return false;
+        fwrite(BINLOG_MAGIC, 1, BINLOG_MAGIC_SIZE, mFile);
+        mQueue.reset(new BinLogQueue(mQueueSize));
+        mFormatsWritten.clear();
+        mStopWriter = false;
+        mEnqueued = 0;
+        mWritten = 0;
+        mWriter = std::thread(&BinLog::writerLoop, this);
+        mOpen = true;
+        return true;
+    }
+
+    /// Writes all queued messages and closes the file. Producers still inside write() finish
+    /// their message first, a producer waiting for room in a full queue drops it.
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mOpenMutex);
+        if (!mOpen)
+            return;
+        mOpen = false;
+        while (mQueueRefs.load())
+            std::this_thread::yield();
+        {
+            std::lock_guard<std::mutex> wakeLock(mWakeMutex);
+            mStopWriter = true;
+        }
+        mWakeCond.notify_all();
+        mWriter.join();
+        fclose(mFile);
+        mFile = NULL;
+    }
+
+    /// Waits until all messages queued so far are written
+    void flush()
+    {
+        if (!mOpen)
+            return;
+        unsigned long long target = mEnqueued.load();
+        std::unique_lock<std::mutex> lock(mWakeMutex);
+        while (mWritten.load() < target && !mStopWriter) {
+            mWakePending = true;
+            mWakeCond.notify_all();
+            mFlushCond.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+
+    bool enabled(int logLevel) const
+    {
+        return mOpen.load(std::memory_order_relaxed) && logLevel <= mLogLevel.load(std::memory_order_relaxed);
+    }
+
+    /// Queues a message, strings are shortened to fit BINLOG_RECORD_SIZE bytes of record
+    template <typename... Args>
+    void write(uint32_t formatId, const Args&... args)
+    {
+        int64_t timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::system_clock::now().time_since_epoch()).count();
+        constexpr size_t fixedSize = sizeof(formatId) + sizeof(timeNs) + (argSize<std::decay_t<Args>>() + ... + 0);
+        static_assert(fixedSize <= BINLOG_RECORD_SIZE, "Too many arguments of a binary log message");
+
+        QueueRef queue(this);
+        if (!queue)
+            return;
+        size_t pos;
+        char* data = mQueue->claim(pos);
+        if (!data) {
+            if (mOverflow == LOG_OVERFLOW_DROP) {
+                mDropped++;
+                return;
+            }
+            do {
+                if (!mOpen) {
+                    mDropped++;
+                    return;
+                }
+                wakeWriter();
+                std::this_thread::yield();
+            } while (!(data = mQueue->claim(pos)));
+        }
+
+        char* p = data;
+        size_t stringSpace = BINLOG_RECORD_SIZE - fixedSize;
+        put(p, formatId);
+        put(p, timeNs);
+        (putArg(p, stringSpace, args), ...);
+        (void)stringSpace;
+        mQueue->publish(pos, p - data);
+
+        // the writer wakes up every BINLOG_WRITE_INTERVAL_MS by itself, producers only wake it
+        // when another half of the queue was filled, so that a log call does not switch threads
+        mEnqueued.fetch_add(1, std::memory_order_relaxed);
+        if ((pos & (mQueue->capacity() / 2 - 1)) == 0 && mWriterSleeping.load(std::memory_order_relaxed))
+            wakeWriter();
+    }
+
+    /// Registers a format string, returns its id. Ids are shared by all logs of the process.
+    static uint32_t registerFormat(int logLevel, const char* format, const char* types)
+    {
+        Formats& formats = registry();
+        std::lock_guard<std::mutex> lock(formats.mutex);
+        formats.items.push_back({logLevel, format, types});
+        return static_cast<uint32_t>(formats.items.size() - 1);
+    }
+
+    template <typename... Args>
+    static const char* argTypes()
+    {
+        static const char types[] = {BinLogArg<std::decay_t<Args>>::type..., '\0'};
+        return types;
+    }
+
+  public:
+    void setLogLevel(int logLevel) { mLogLevel = logLevel; }
+    int logLevel() const { return mLogLevel; }
+    bool isOpen() const { return mOpen; }
+    unsigned long long droppedMessages() const { return mDropped.load(); }
+
+  protected:
+    struct Format {
+        int level;
+        std::string format;
+        std::string types;
+    };
+
+    struct Formats {
+        std::mutex mutex;
+        std::vector<Format> items;
+    };
+
+    static Formats& registry()
+    {
+        static Formats formats;
+        return formats;
+    }
+
+    /// Reference of a producer to the queue, true while the log is open. close() waits until
+    /// no reference is held before it stops the writer, open() replaces the queue after close().
+    class QueueRef {
+      public:
+        explicit QueueRef(BinLog* log)
+            : mLog(log)
+        {
+            mLog->mQueueRefs++;
+            mActive = mLog->mOpen.load();
+        }
+        ~QueueRef() { mLog->mQueueRefs--; }
+        QueueRef(const QueueRef&) = delete;
+        QueueRef& operator=(const QueueRef&) = delete;
+        explicit operator bool() const { return mActive; }
+
+      private:
+        BinLog* mLog;
+        bool mActive;
+    };
+
+    template <typename T>
+    static void put(char*& p, T value)
+    {
+        memcpy(p, &value, sizeof(value));
+        p += sizeof(value);
+    }
+
+    /// Size of an argument in the record, strings count their length field only
+    template <typename T>
+    static constexpr size_t argSize()
+    {
+        constexpr char type = BinLogArg<T>::type;
+        return type == 's' ? sizeof(uint16_t) : type == 'i' || type == 'u' ? 4 : 8;
+    }
+
+    template <typename T>
+    static void putArg(char*& p, size_t& stringSpace, const T& value)
+    {
+        (void)stringSpace;
+        constexpr char type = BinLogArg<T>::type;
+        if constexpr (type == 'i')
+            put(p, static_cast<int32_t>(value));
+        else if constexpr (type == 'I')
+            put(p, static_cast<int64_t>(value));
+        else if constexpr (type == 'u')
+            put(p, static_cast<uint32_t>(value));
+        else if constexpr (type == 'U')
+            put(p, static_cast<uint64_t>(value));
+        else
+            put(p, static_cast<double>(value));
+    }
+
+    template <typename T>
+    static void putArg(char*& p, size_t& stringSpace, T* value)
+    {
+        (void)stringSpace;
+        put(p, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(value)));
+    }
+
+    static void putArg(char*& p, size_t& stringSpace, const char* value)
+    {
+        putString(p, stringSpace, value, value ? strnlen(value, stringSpace) : 0);
+    }
+
+    static void putArg(char*& p, size_t& stringSpace, char* value)
+    {
+        putArg(p, stringSpace, const_cast<const char*>(value));
+    }
+
+    static void putArg(char*& p, size_t& stringSpace, const std::string& value)
+    {
+        putString(p, stringSpace, value.data(), std::min(value.size(), stringSpace));
+    }
+
+    static void putString(char*& p, size_t& stringSpace, const char* value, size_t size)
+    {
+        put(p, static_cast<uint16_t>(size));
+        if (size)
+            memcpy(p, value, size);
+        p += size;
+        stringSpace -= size;
+    }
+
+    void wakeWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mWakeMutex);
+            mWakePending = true;
+        }
+        mWakeCond.notify_one();
+    }
+
+    void appendRecord(std::string& batch, uint8_t kind, const char* payload, size_t size)
+    {
+        uint32_t size32 = static_cast<uint32_t>(size);
+        batch.push_back(static_cast<char>(kind));
+        batch.append(reinterpret_cast<const char*>(&size32), sizeof(size32));
+        batch.append(payload, size);
+    }
+
+    void appendFormat(std::string& batch, uint32_t id)
+    {
+        Format format;
+        {
+            Formats& formats = registry();
+            std::lock_guard<std::mutex> lock(formats.mutex);
+            if (id >= formats.items.size())
+                return;
+            format = formats.items[id];
+        }
+        std::string payload;
+        uint8_t level = static_cast<uint8_t>(format.level);
+        uint16_t typesSize = static_cast<uint16_t>(format.types.size());
+        uint32_t formatSize = static_cast<uint32_t>(format.format.size());
+        payload.append(reinterpret_cast<const char*>(&id), sizeof(id));
+        payload.append(reinterpret_cast<const char*>(&level), sizeof(level));
+        payload.append(reinterpret_cast<const char*>(&typesSize), sizeof(typesSize));
+        payload += format.types;
+        payload.append(reinterpret_cast<const char*>(&formatSize), sizeof(formatSize));
+        payload += format.format;
+        appendRecord(batch, BINLOG_FORMAT, payload.data(), payload.size());
+    }
+
+    void writerLoop()
+    {
+        std::string batch;
+        while (true) {
+            size_t count = 0;
+            size_t size;
+            const char* record;
+            batch.clear();
+            while (count < FILELOG_BATCH_SIZE && (record = mQueue->front(size))) {
+                uint32_t id;
+                memcpy(&id, record, sizeof(id));
+                if (id >= mFormatsWritten.size())
+                    mFormatsWritten.resize(id + 1, false);
+                if (!mFormatsWritten[id]) {
+                    appendFormat(batch, id);
+                    mFormatsWritten[id] = true;
+                }
+                appendRecord(batch, BINLOG_MESSAGE, record, size);
+                mQueue->pop();
+                count++;
+            }
+
+            if (count) {
+                fwrite(batch.data(), 1, batch.size(), mFile);
+                fflush(mFile);
+                std::lock_guard<std::mutex> lock(mWakeMutex);
+                mWritten += count;
+                mFlushCond.notify_all();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mWakeMutex);
+            if (mStopWriter && mQueue->empty())
+                break;
+            mWriterSleeping = true;
+            mWakeCond.wait_for(lock, std::chrono::milliseconds(BINLOG_WRITE_INTERVAL_MS),
+                               [this] { return mWakePending || mStopWriter; });
+            mWriterSleeping = false;
+            mWakePending = false;
+        }
+    }
+
+  protected:
+    FILE* mFile;
+    size_t mQueueSize;
+    LogOverflow mOverflow;
+    std::atomic<int> mLogLevel;
+    std::atomic<bool> mOpen;
+    std::atomic<int> mQueueRefs;
+    std::mutex mOpenMutex;
+    std::mutex mWakeMutex;
+    std::condition_variable mWakeCond;
+    std::condition_variable mFlushCond;
+    std::unique_ptr<BinLogQueue> mQueue;
+    std::vector<bool> mFormatsWritten;
+    std::thread mWriter;
+    bool mStopWriter;
+    bool mWakePending;
+    std::atomic<bool> mWriterSleeping;
+    std::atomic<unsigned long long> mEnqueued;
+    std::atomic<unsigned long long> mWritten;
+    std::atomic<unsigned long long> mDropped;
+};
+
+inline uint32_t BinLogSite::id(int logLevel)
+{
+    int level = std::min(std::max(logLevel, 0), static_cast<int>(LOG_DBG));
+    std::atomic<uint32_t>& id = mIds[level];
+    uint32_t value = id.load(std::memory_order_acquire);
+    if (value == UINT32_MAX) {
+        // a racing thread may register the same format again, both ids decode the same
+        value = BinLog::registerFormat(level, mFormat, mTypes);
+        id.store(value, std::memory_order_release);
+    }
+    return value;
+}
+
+/// Reads a binary log and formats its messages like FileLog does
+class BinLogReader {
+  public:
+    BinLogReader()
+        : mFile(NULL)
+    {
+    }
+
+    virtual ~BinLogReader()
+    {
+        close();
+    }
+
+    bool open(const char* fileName)
+    {
+        close();
+#ifdef _MSC_VER
+        if (fopen_s(&mFile, fileName, "rb"))
+            mFile = NULL;
+#else
+        mFile = fopen(fileName, "rb");
+#endif
+        char magic[BINLOG_MAGIC_SIZE];
+        if (mFile && fread(magic, 1, BINLOG_MAGIC_SIZE, mFile) == BINLOG_MAGIC_SIZE
+            && memcmp(magic, BINLOG_MAGIC, BINLOG_MAGIC_SIZE) == 0)
+            return true;
+        close();
+        return false;
+    }
+
+    void close()
+    {
+        if (mFile)
+            fclose(mFile);
+        mFile = NULL;
+        mFormats.clear();
+    }
+
+    /// Reads the next message as a text line (with the trailing newline), false at the end
+    bool next(std::string& line)
+    {
+        uint8_t kind;
+        uint32_t size;
+        std::string payload;
+        while (mFile && fread(&kind, 1, 1, mFile) == 1 && fread(&size, 1, sizeof(size), mFile) == sizeof(size)) {
+            payload.resize(size);
+            if (size && fread(&payload[0], 1, size, mFile) != size)
+                return false;
+            if (kind == BINLOG_FORMAT)
+                readFormat(payload);
+            else if (kind == BINLOG_MESSAGE && formatMessage(payload, line))
+                return true;
+        }
+        return false;
+    }
+
+    /// Decodes a whole binary log into the text file, returns the number of messages or -1
+    static long long decode(const char* fileName, FILE* out)
+    {
+        BinLogReader reader;
+        if (!reader.open(fileName))
+            return -1;
+        long long count = 0;
+        std::string line;
+        while (reader.next(line)) {
+            fwrite(line.data(), 1, line.size(), out);
+            count++;
+        }
+        return count;
+    }
+
+    /// Formats the raw arguments with a printf format string, the length modifiers of the
+    /// format are replaced by the ones of the stored types
+    static std::string formatArgs(const std::string& format, const std::string& types, const char* data, size_t size)
+    {
+        std::string text;
+        size_t arg = 0;
+        size_t pos = 0;
+        char buff[512];
+        for (size_t i = 0; i < format.size(); i++) {
+            if (format[i] != '%') {
+                text += format[i];
+                continue;
+            }
+            if (i + 1 < format.size() && format[i + 1] == '%') {
+                text += '%';
+                i++;
+                continue;
+            }
+
+            size_t end = i + 1;
+            std::string spec = "%";
+            while (end < format.size() && strchr("-+ #0", format[end]))
+                spec += format[end++];
+            while (end < format.size() && (isdigit((unsigned char)format[end]) || format[end] == '.'))
+                spec += format[end++];
+            while (end < format.size() && strchr("hlLqjzt", format[end]))
+                end++;
+            if (end >= format.size() || arg >= types.size()) {
+                text.append(format, i, end - i);
+                i = end - 1;
+                continue;
+            }
+            char conv = format[end];
+            i = end;
+
+            char type = types[arg++];
+            if (type == 's') {
+                uint16_t length = 0;
+                if (pos + sizeof(length) <= size)
+                    memcpy(&length, data + pos, sizeof(length));
+                pos += sizeof(length);
+                std::string value(data + std::min(pos, size), std::min<size_t>(length, size - std::min(pos, size)));
+                pos += length;
+                if (conv == 's') {
+                    snprintf(buff, sizeof(buff), (spec + "s").c_str(), value.c_str());
+                    text += value.size() < sizeof(buff) ? std::string(buff) : value;
+                }
+                else
+                    text += value;
+                continue;
+            }
+
+            size_t width = type == 'i' || type == 'u' ? 4 : 8;
+            char raw[8] = {0};
+            if (pos + width <= size)
+                memcpy(raw, data + pos, width);
+            pos += width;
+            long long ivalue = 0;
+            unsigned long long uvalue = 0;
+            double dvalue = 0;
+            if (type == 'i') {
+                int32_t v;
+                memcpy(&v, raw, 4);
+                ivalue = v;
+                uvalue = static_cast<uint32_t>(v);
+                dvalue = v;
+            }
+            else if (type == 'u') {
+                uint32_t v;
+                memcpy(&v, raw, 4);
+                ivalue = uvalue = v;
+                dvalue = v;
+            }
+            else if (type == 'd') {
+                memcpy(&dvalue, raw, 8);
+                ivalue = static_cast<long long>(dvalue);
+                uvalue = static_cast<unsigned long long>(ivalue);
+            }
+            else {
+                memcpy(&uvalue, raw, 8);
+                ivalue = static_cast<long long>(uvalue);
+                dvalue = type == 'I' ? static_cast<double>(ivalue) : static_cast<double>(uvalue);
+            }
+
+            if (strchr("di", conv))
+                snprintf(buff, sizeof(buff), (spec + "lld").c_str(), ivalue);
+            else if (strchr("ouxX", conv))
+                snprintf(buff, sizeof(buff), (spec + "ll" + conv).c_str(), uvalue);
+            else if (strchr("fFeEgGaA", conv))
+                snprintf(buff, sizeof(buff), (spec + conv).c_str(), dvalue);
+            else if (conv == 'c')
+                snprintf(buff, sizeof(buff), (spec + "c").c_str(), static_cast<int>(ivalue));
+            else if (conv == 'p')
+                snprintf(buff, sizeof(buff), (spec + "p").c_str(), reinterpret_cast<void*>(static_cast<uintptr_t>(uvalue)));
+            else
+                snprintf(buff, sizeof(buff), "%lld", ivalue);
+            text += buff;
+        }
+        return text;
+    }
+
+    /// Formats the time like FileLog: day-month-year hours:minutes:seconds.milliseconds
+    static std::string formatTime(int64_t timeNs)
+    {
+        std::time_t timet = static_cast<std::time_t>(timeNs / 1000000000);
+        long long millis = (timeNs % 1000000000) / 1000000;
+        std::tm tm;
+#ifdef _MSC_VER
+        localtime_s(&tm, &timet);
+#else
+        localtime_r(&timet, &tm);
+#endif
+        char str[30] = {0};
+        std::strftime(str, sizeof(str), "%d-%m-%y %H:%M:%S.", &tm);
+        return std::string(str) + std::to_string(millis);
+    }
+
+  protected:
+    struct Format {
+        int level;
+        std::string types;
+        std::string format;
+    };
+
+    void readFormat(const std::string& payload)
+    {
+        uint32_t id;
+        uint8_t level;
+        uint16_t typesSize;
+        uint32_t formatSize;
+        size_t pos = 0;
+        if (payload.size() < sizeof(id) + sizeof(level) + sizeof(typesSize))
+            return;
+        memcpy(&id, payload.data(), sizeof(id));
+        pos += sizeof(id);
+        memcpy(&level, payload.data() + pos, sizeof(level));
+        pos += sizeof(level);
+        memcpy(&typesSize, payload.data() + pos, sizeof(typesSize));
+        pos += sizeof(typesSize);
+        if (pos + typesSize + sizeof(formatSize) > payload.size())
+            return;
+        Format format;
+        format.level = level;
+        format.types = payload.substr(pos, typesSize);
+        pos += typesSize;
+        memcpy(&formatSize, payload.data() + pos, sizeof(formatSize));
+        pos += sizeof(formatSize);
+        format.format = payload.substr(pos, formatSize);
+        if (id >= mFormats.size())
+            mFormats.resize(id + 1);
+        mFormats[id] = format;
+    }
+
+    bool formatMessage(const std::string& payload, std::string& line)
+    {
+        uint32_t id;
+        int64_t timeNs;
+        if (payload.size() < sizeof(id) + sizeof(timeNs))
+            return false;
+        memcpy(&id, payload.data(), sizeof(id));
+        memcpy(&timeNs, payload.data() + sizeof(id), sizeof(timeNs));
+        if (id >= mFormats.size())
+            return false;
+        const Format& format = mFormats[id];
+        const size_t header = sizeof(id) + sizeof(timeNs);
+        int level = std::min(std::max(format.level, 0), static_cast<int>(LOG_DBG));
+        line = "(" + formatTime(timeNs) + ") [" + LOG_PREFIX[level] + "]: "
+            + formatArgs(format.format, format.types, payload.data() + header, payload.size() - header) + "\n";
+        return true;
+    }
+
+  protected:
+    FILE* mFile;
+    std::vector<Format> mFormats;
+};
+
+#endif /* !BINLOG_H */
@@ -21,82 +21,224 @@ SOFTWARE.
 */
 #ifndef BUFFER_H
 #define BUFFER_H
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
 #include <memory>
 #include <memory.h>
-#include <vector>
+#include <new>
+#include <type_traits>
+#include <utility>
 
+#define BUFFER_CACHE_LINE   64
+#define BUFFER_PAGE         4096
+
+/// How the elements of a newly allocated buffer are set
+enum BufferInit { BUFFER_INIT_ZERO, BUFFER_INIT_NONE };
+
+/// Source of the memory of buffers. The default is the heap, a BufferPool reuses the memory.
+class BufferAllocator
+{
+public:
+    virtual ~BufferAllocator() {}
+
+    /// Returns memory for at least bytes bytes aligned to alignment and sets capacity to its usable
+    /// size, throws std::bad_alloc if there is none
+    virtual void* allocate(size_t bytes, size_t alignment, size_t& capacity) = 0;
+
+    /// Takes back memory returned by allocate(), capacity is the capacity it reported
+    virtual void deallocate(void* data, size_t capacity) = 0;
+
+    static void* alignedAlloc(size_t bytes, size_t alignment)
+    {
+#ifdef _MSC_VER
+        void* data = _aligned_malloc(bytes, alignment);
+#else
+        void* data = nullptr;
+        if (alignment <= alignof(std::max_align_t))
+            data = malloc(bytes);
+        else if (posix_memalign(&data, alignment, bytes))
+            data = nullptr;
+#endif
+        if (!data)
+            throw std::bad_alloc();
+        return data;
+    }
+
+    static void alignedFree(void* data)
+    {
+#ifdef _MSC_VER
+        _aligned_free(data);
+#else
+        free(data);
+#endif
+    }
+};
+
+/// Contiguous array of plain values. The memory is aligned to at least the alignment given at
+/// construction (a power of two, cache line or page for transfer buffers) and it is zeroed unless BUFFER_INIT_NONE
+/// is requested, which skips a full pass over buffers the device overwrites anyway. A buffer
+/// created with an allocator returns its memory to it when destroyed.
 template <class T> class Buffer
 {
+    static_assert(std::is_trivially_copyable<T>::value, "Buffer holds plain values only");
+
 public:
 
     Buffer(size_t size = 0)
+        : Buffer(size, BUFFER_INIT_ZERO)
     {
-        if (size)
-            mBuff = std::vector<T>(size);
+    }
+
+    Buffer(size_t size, BufferInit init, size_t alignment = 0, BufferAllocator* allocator = nullptr)
+        : mData(nullptr)
+        , mSize(0)
+        , mCapacity(0)
+        , mCapacityBytes(0)
+        , mAlignment(std::max(alignment, alignof(T)))
+        , mAllocator(allocator)
+    {
+        reinit(size, init);
     }
 
     Buffer(const Buffer<T> &b)
+        : Buffer(b.mSize, BUFFER_INIT_NONE, b.mAlignment, b.mAllocator)
+    {
+        if (mSize)
+            memcpy(mData, b.mData, byteSize());
+    }
+
+    Buffer(Buffer<T> &&b) noexcept
+        : mData(b.mData)
+        , mSize(b.mSize)
+        , mCapacity(b.mCapacity)
+        , mCapacityBytes(b.mCapacityBytes)
+        , mAlignment(b.mAlignment)
+        , mAllocator(b.mAllocator)
     {
-        mBuff.assign(b.mBuff.begin(), b.mBuff.end());
+        b.mData = nullptr;
+        b.mSize = b.mCapacity = b.mCapacityBytes = 0;
     }
 
     ~Buffer() {
+        deallocate();
     }
 
     Buffer<T> & operator=(const Buffer<T> &b) {
-        if (this != &b)
-            mBuff.assign(b.mBuff.begin(), b.mBuff.end());
+        if (this != &b){
+            reinit(b.mSize, BUFFER_INIT_NONE);
+            if (mSize)
+                memcpy(mData, b.mData, byteSize());
+        }
+        return *this;
+    }
+
+    Buffer<T> & operator=(Buffer<T> &&b) noexcept {
+        if (this != &b){
+            deallocate();
+            mData = b.mData;
+            mSize = b.mSize;
+            mCapacity = b.mCapacity;
+            mCapacityBytes = b.mCapacityBytes;
+            mAlignment = b.mAlignment;
+            mAllocator = b.mAllocator;
+            b.mData = nullptr;
+            b.mSize = b.mCapacity = b.mCapacityBytes = 0;
+        }
         return *this;
     }
 
     bool operator==(const Buffer<T> &b) {
-        return mBuff.size() == b.size() && memcmp(mBuff.data(), b.data(), byteSize()) == 0;
+        return mSize == b.size() && (mSize == 0 || memcmp(mData, b.data(), byteSize()) == 0);
     }
 
     void setVal(T val) {
-        mBuff.assign(mBuff.size(), val);
+        std::fill(mData, mData + mSize, val);
     }
 
     void zero() {
-        mBuff.assign(mBuff.size(), 0);
+        if (mSize)
+            memset(mData, 0, byteSize());
     }
 
-    void reinit(size_t size) {
-        if (size == mBuff.size())
+    /// Resizes the buffer, the memory is reused when the capacity suffices. All elements are
+    /// zeroed when the size changes (BUFFER_INIT_ZERO) or left as they are (BUFFER_INIT_NONE).
+    void reinit(size_t size, BufferInit init = BUFFER_INIT_ZERO) {
+        if (size == mSize)
             return;
 
-        mBuff.clear();
-        mBuff.resize(size);
+        if (size > mCapacity){
+            size_t capacityBytes = 0;
+            T* data = allocate(size, capacityBytes);
+            deallocate();
+            mData = data;
+            mCapacity = capacityBytes / sizeof(T);
+            mCapacityBytes = capacityBytes;
+        }
+        mSize = size;
+        if (init == BUFFER_INIT_ZERO)
+            zero();
     }
 
     void reinit(size_t size, T val) {
-        reinit(size);
+        reinit(size, BUFFER_INIT_NONE);
         setVal(val);
     }
 
     template<typename U> void assignData(U *data, size_t size) {
-        mBuff.assign(data, data + size);
+        reinit(size, BUFFER_INIT_NONE);
+        std::copy(data, data + size, mData);
     }
 
     void clear() {
-        mBuff.clear();
+        mSize = 0;
     }
 
 public:
-    operator T*()                   { return mBuff.data(); }
-    T* data()                       { return mBuff.data(); }
-    const T* data() const           { return mBuff.data(); }
-    size_t size() const             { return mBuff.size(); }
-    size_t byteSize() const         { return mBuff.size() * sizeof(T); }
-    const T& get(size_t i) const    { return mBuff[i]; }
-    void set(size_t i, T val)       { mBuff[i] = val; }
-    T& last()                       { return mBuff[mBuff.size() - 1]; }
-    bool empty() const              { return mBuff.empty(); }
+    operator T*()                   { return mData; }
+    T* data()                       { return mData; }
+    const T* data() const           { return mData; }
+    size_t size() const             { return mSize; }
+    size_t byteSize() const         { return mSize * sizeof(T); }
+    size_t capacity() const         { return mCapacity; }
+    size_t alignment() const        { return mAlignment; }
+    BufferAllocator* allocator() const { return mAllocator; }
+    const T& get(size_t i) const    { return mData[i]; }
+    void set(size_t i, T val)       { mData[i] = val; }
+    T& last()                       { return mData[mSize - 1]; }
+    bool empty() const              { return mSize == 0; }
 
 private:
-    std::vector<T> mBuff;
+    // capacityBytes is what the allocator handed out, it gets exactly that back
+    T* allocate(size_t size, size_t& capacityBytes) {
+        size_t bytes = size * sizeof(T);
+        if (bytes / size != sizeof(T))
+            throw std::bad_alloc();
+        if (!mAllocator){
+            capacityBytes = bytes;
+            return static_cast<T*>(BufferAllocator::alignedAlloc(bytes, mAlignment));
+        }
+        return static_cast<T*>(mAllocator->allocate(bytes, mAlignment, capacityBytes));
+    }
+
+    void deallocate() {
+        if (!mData)
+            return;
+        if (mAllocator)
+            mAllocator->deallocate(mData, mCapacityBytes);
+        else
+            BufferAllocator::alignedFree(mData);
+        mData = nullptr;
+    }
+
+private:
+    T* mData;
+    size_t mSize;
+    size_t mCapacity;
+    size_t mCapacityBytes;
+    size_t mAlignment;
+    BufferAllocator* mAllocator;
 };
 
 
 #endif // BUFFER_H
-
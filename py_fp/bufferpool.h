@@ -0,0 +1,388 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "buffer.h"
+#include "largepages.h"
+
+#define BUFFERPOOL_MIN_SHIFT        6           // smallest size class, 64 B
+#define BUFFERPOOL_MAX_SHIFT        30          // largest size class, 1 GB, larger buffers are not pooled
+#define BUFFERPOOL_THREAD_SHIFT     20          // size classes up to 1 MB are cached per thread
+#define BUFFERPOOL_THREAD_BLOCKS    4           // blocks of each size class cached per thread
+#define BUFFERPOOL_LARGE_SHIFT      21          // size classes from 2 MB up come from the large page allocator
+#define BUFFERPOOL_MAX_BYTES        (256ull << 20)
+
+/// Memory usage of a BufferPool
+struct BufferPoolStats {
+    size_t leasedBytes;         // memory of the outstanding leases
+    size_t cachedBytes;         // free memory kept for reuse
+    size_t peakLeasedBytes;
+    size_t peakTotalBytes;      // leased + cached
+    size_t maxBytes;
+    unsigned long long leases;
+    unsigned long long hits;    // leases served from the cached memory
+};
+
+/// Thread-safe pool of transfer buffers. Requests are rounded up to power of two size classes and
+/// released blocks are kept for the next lease of the same class, the small classes in a cache of
+/// the releasing thread, the rest in shared lists. The pool keeps at most maxBytes of leased and
+/// cached memory: cached blocks are freed to make room for new ones and released blocks over the
+/// limit are freed. A lease never fails because of the limit. Leases of 2 MB and more whose class
+/// is larger than maxBytes are not pooled, they are allocated at their size and freed on release.
+///
+/// Blocks of 2 MB and more are allocated by a LargePageAllocator, setLargePages() selects huge,
+/// pre-faulted or locked pages for them.
+///
+/// A lease is a Buffer allocated from the pool, its memory returns to the pool when it is
+/// destroyed. Leases must not outlive the pool, global() is never destroyed.
+class BufferPool : public BufferAllocator
+{
+public:
+    explicit BufferPool(size_t maxBytes = BUFFERPOOL_MAX_BYTES)
+        : mId(++poolCounter())
+        , mMaxBytes(maxBytes)
+        , mLeasedBytes(0)
+        , mCachedBytes(0)
+        , mPeakLeasedBytes(0)
+        , mPeakTotalBytes(0)
+        , mLeases(0)
+        , mHits(0)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        registry()[mId] = this;
+    }
+
+    virtual ~BufferPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(registryMutex());
+            registry().erase(mId);
+        }
+        trim();
+    }
+
+    static BufferPool& global()
+    {
+        static BufferPool* pool = new BufferPool();
+        return *pool;
+    }
+
+    /// Buffer of size elements whose memory comes from the pool, alignment is at most a page
+    template<class T> Buffer<T> lease(size_t size, BufferInit init = BUFFER_INIT_NONE, size_t alignment = BUFFER_CACHE_LINE)
+    {
+        return Buffer<T>(size, init, alignment, this);
+    }
+
+    void setMaxBytes(size_t maxBytes)
+    {
+        mMaxBytes = maxBytes;
+        trimTo(cachedLimit(0));
+    }
+
+    /// Frees all cached memory
+    void trim() { trimTo(0); }
+
+    /// Flags (LargePageFlags) of the blocks of 2 MB and more, the cached ones are freed, so that
+    /// the next leases get memory with the new flags
+    void setLargePages(int flags)
+    {
+        mLarge.setFlags(flags);
+        trim();
+    }
+
+    int largePages() const { return mLarge.flags(); }
+    LargePageStats largePageStats() const { return mLarge.stats(); }
+    LargePageAllocator& largePageAllocator() { return mLarge; }
+
+    BufferPoolStats stats() const
+    {
+        BufferPoolStats stats;
+        stats.leasedBytes = mLeasedBytes;
+        stats.cachedBytes = mCachedBytes;
+        stats.peakLeasedBytes = mPeakLeasedBytes;
+        stats.peakTotalBytes = mPeakTotalBytes;
+        stats.maxBytes = mMaxBytes;
+        stats.leases = mLeases;
+        stats.hits = mHits;
+        return stats;
+    }
+
+    void resetPeaks()
+    {
+        mPeakLeasedBytes = mLeasedBytes.load();
+        mPeakTotalBytes = mLeasedBytes + mCachedBytes;
+    }
+
+public:
+    void* allocate(size_t bytes, size_t alignment, size_t& capacity) override
+    {
+        if (alignment > BUFFER_PAGE)
+            throw std::invalid_argument("BufferPool alignment is limited to a page.");
+        mLeases++;
+        int sizeClass = classOf(std::max(bytes, alignment));
+        size_t blockSize = size_t(1) << std::min(sizeClass, BUFFERPOOL_MAX_SHIFT);
+        if (sizeClass > BUFFERPOOL_MAX_SHIFT || (sizeClass >= BUFFERPOOL_LARGE_SHIFT && blockSize > mMaxBytes)){
+            // could never be cached, so it is not rounded up to its class either
+            void* data = mLarge.allocate(std::max(bytes, alignment), alignment, capacity);
+            addLeased(capacity);
+            return data;
+        }
+
+        void* data = takeCached(sizeClass);
+        if (data){
+            mHits++;
+            mCachedBytes -= blockSize;
+        }else{
+            trimTo(cachedLimit(blockSize));
+            data = allocateBlock(sizeClass);
+        }
+        addLeased(blockSize);
+        capacity = blockSize;
+        return data;
+    }
+
+    void deallocate(void* data, size_t capacity) override
+    {
+        if (!data)
+            return;
+        int sizeClass = classOf(capacity);
+        if (sizeClass > BUFFERPOOL_MAX_SHIFT || capacity != size_t(1) << sizeClass){
+            mLeasedBytes -= capacity;
+            mLarge.deallocate(data, capacity);
+            return;
+        }
+
+        size_t blockSize = size_t(1) << sizeClass;
+        mLeasedBytes -= blockSize;
+        if (mLeasedBytes + mCachedBytes + blockSize > mMaxBytes){
+            freeBlock(sizeClass, data);
+            return;
+        }
+        mCachedBytes += blockSize;
+        putCached(sizeClass, data);
+        updatePeak(mPeakTotalBytes, mLeasedBytes + mCachedBytes);
+    }
+
+private:
+    static const int CLASS_COUNT = BUFFERPOOL_MAX_SHIFT + 1;
+
+    struct ThreadCache {
+        std::mutex mutex;
+        std::vector<void*> blocks[BUFFERPOOL_THREAD_SHIFT + 1];
+    };
+
+    // Returns the thread caches to their pools when a thread exits
+    struct ThreadCaches {
+        std::vector<std::pair<unsigned long long, ThreadCache*>> caches;
+        ~ThreadCaches()
+        {
+            std::lock_guard<std::mutex> lock(registryMutex());
+            for (auto& cache : caches){
+                auto it = registry().find(cache.first);
+                if (it != registry().end())
+                    it->second->releaseThreadCache(cache.second);
+            }
+        }
+    };
+
+    static int classOf(size_t bytes)
+    {
+        int sizeClass = BUFFERPOOL_MIN_SHIFT;
+        while (sizeClass < 63 && (size_t(1) << sizeClass) < bytes)
+            sizeClass++;
+        return sizeClass;
+    }
+
+    static size_t blockAlignment(int sizeClass)
+    {
+        return std::min(size_t(1) << sizeClass, static_cast<size_t>(BUFFER_PAGE));
+    }
+
+    void* allocateBlock(int sizeClass)
+    {
+        size_t blockSize = size_t(1) << sizeClass;
+        if (sizeClass < BUFFERPOOL_LARGE_SHIFT)
+            return alignedAlloc(blockSize, blockAlignment(sizeClass));
+        size_t capacity = 0;
+        return mLarge.allocate(blockSize, blockAlignment(sizeClass), capacity);
+    }
+
+    void freeBlock(int sizeClass, void* data)
+    {
+        if (sizeClass < BUFFERPOOL_LARGE_SHIFT)
+            alignedFree(data);
+        else
+            mLarge.deallocate(data, size_t(1) << sizeClass);
+    }
+
+    // cached bytes that still fit under the limit when a block of the size is added
+    size_t cachedLimit(size_t blockSize) const
+    {
+        size_t used = mLeasedBytes + blockSize;
+        return used < mMaxBytes ? mMaxBytes - used : 0;
+    }
+
+    void addLeased(size_t bytes)
+    {
+        updatePeak(mPeakLeasedBytes, mLeasedBytes += bytes);
+        updatePeak(mPeakTotalBytes, mLeasedBytes + mCachedBytes);
+    }
+
+    static void updatePeak(std::atomic<size_t>& peak, size_t value)
+    {
+        size_t current = peak.load(std::memory_order_relaxed);
+        while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            ;
+    }
+
+    ThreadCache* threadCache()
+    {
+        thread_local ThreadCaches threadCaches;
+        for (auto& cache : threadCaches.caches)
+            if (cache.first == mId)
+                return cache.second;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mThreadCaches.emplace_back(new ThreadCache());
+        threadCaches.caches.emplace_back(mId, mThreadCaches.back().get());
+        return mThreadCaches.back().get();
+    }
+
+    void* takeCached(int sizeClass)
+    {
+        if (sizeClass <= BUFFERPOOL_THREAD_SHIFT){
+            ThreadCache* cache = threadCache();
+            std::lock_guard<std::mutex> lock(cache->mutex);
+            std::vector<void*>& blocks = cache->blocks[sizeClass];
+            if (!blocks.empty()){
+                void* data = blocks.back();
+                blocks.pop_back();
+                return data;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::vector<void*>& blocks = mBlocks[sizeClass];
+        if (blocks.empty())
+            return nullptr;
+        void* data = blocks.back();
+        blocks.pop_back();
+        return data;
+    }
+
+    void putCached(int sizeClass, void* data)
+    {
+        if (sizeClass <= BUFFERPOOL_THREAD_SHIFT){
+            ThreadCache* cache = threadCache();
+            std::lock_guard<std::mutex> lock(cache->mutex);
+            std::vector<void*>& blocks = cache->blocks[sizeClass];
+            if (blocks.size() < BUFFERPOOL_THREAD_BLOCKS){
+                blocks.push_back(data);
+                return;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        mBlocks[sizeClass].push_back(data);
+    }
+
+    // Frees cached blocks, the largest first, until at most maxCached bytes are cached
+    void trimTo(size_t maxCached)
+    {
+        if (mCachedBytes <= maxCached)
+            return;
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (int sizeClass = CLASS_COUNT - 1; sizeClass >= BUFFERPOOL_MIN_SHIFT && mCachedBytes > maxCached; sizeClass--){
+            freeBlocks(mBlocks[sizeClass], sizeClass, maxCached);
+            if (sizeClass > BUFFERPOOL_THREAD_SHIFT)
+                continue;
+            for (auto& cache : mThreadCaches){
+                std::lock_guard<std::mutex> cacheLock(cache->mutex);
+                freeBlocks(cache->blocks[sizeClass], sizeClass, maxCached);
+            }
+        }
+    }
+
+    void freeBlocks(std::vector<void*>& blocks, int sizeClass, size_t maxCached)
+    {
+        while (!blocks.empty() && mCachedBytes > maxCached){
+            freeBlock(sizeClass, blocks.back());
+            blocks.pop_back();
+            mCachedBytes -= size_t(1) << sizeClass;
+        }
+    }
+
+    // Moves the blocks of a finished thread to the shared lists, called with the registry locked
+    void releaseThreadCache(ThreadCache* cache)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (int sizeClass = 0; sizeClass <= BUFFERPOOL_THREAD_SHIFT; sizeClass++)
+            mBlocks[sizeClass].insert(mBlocks[sizeClass].end(), cache->blocks[sizeClass].begin(), cache->blocks[sizeClass].end());
+        for (auto it = mThreadCaches.begin(); it != mThreadCaches.end(); ++it){
+            if (it->get() == cache){
+                mThreadCaches.erase(it);
+                break;
+            }
+        }
+    }
+
+    static std::atomic<unsigned long long>& poolCounter()
+    {
+        static std::atomic<unsigned long long> counter(0);
+        return counter;
+    }
+
+    static std::mutex& registryMutex()
+    {
+        static std::mutex* mutex = new std::mutex();
+        return *mutex;
+    }
+
+    // live pools by id, thread caches of destroyed pools are not returned
+    static std::unordered_map<unsigned long long, BufferPool*>& registry()
+    {
+        static std::unordered_map<unsigned long long, BufferPool*>* pools = new std::unordered_map<unsigned long long, BufferPool*>();
+        return *pools;
+    }
+
+private:
+    const unsigned long long mId;
+    LargePageAllocator mLarge;
+    std::mutex mMutex;
+    std::vector<void*> mBlocks[CLASS_COUNT];
+    std::vector<std::unique_ptr<ThreadCache>> mThreadCaches;
+    std::atomic<size_t> mMaxBytes;
+    std::atomic<size_t> mLeasedBytes;
+    std::atomic<size_t> mCachedBytes;
+    std::atomic<size_t> mPeakLeasedBytes;
+    std::atomic<size_t> mPeakTotalBytes;
+    std::atomic<unsigned long long> mLeases;
+    std::atomic<unsigned long long> mHits;
+};
+
+#endif /* !BUFFERPOOL_H */
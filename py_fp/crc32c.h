@@ -0,0 +1,160 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef CRC32C_H
+#define CRC32C_H
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(_M_X64)
+#define CRC32C_X86
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARM
+#include <arm_acle.h>
+#endif
+
+/// CRC-32C (Castagnoli, iSCSI) checksums of pipe payloads. The SSE 4.2 crc32 instruction is used
+/// when the CPU has it (checked once at run time), the ARMv8 CRC instructions when the compiler
+/// targets them and a slicing-by-8 table otherwise. All variants give the same result.
+class Crc32c {
+  public:
+    /// Continues the checksum crc (0 for the first call) over the data
+    static uint32_t update(uint32_t crc, const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+#if defined(CRC32C_X86)
+        if (hardware())
+            return ~updateSse42(~crc, bytes, size);
+#elif defined(CRC32C_ARM)
+        return ~updateArm(~crc, bytes, size);
+#endif
+        return ~updateTable(~crc, bytes, size);
+    }
+
+    /// Checksum of the data
+    static uint32_t compute(const void* data, size_t size) { return update(0, data, size); }
+
+    /// True if the checksum is computed by the CPU instructions
+    static bool hardware()
+    {
+#if defined(CRC32C_X86)
+        static const bool supported = detectSse42();
+        return supported;
+#elif defined(CRC32C_ARM)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+  private:
+    struct Tables {
+        uint32_t crc[8][256];
+        Tables()
+        {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? 0x82F63B78 ^ (c >> 1) : c >> 1;
+                crc[0][i] = c;
+            }
+            for (uint32_t i = 0; i < 256; i++)
+                for (int t = 1; t < 8; t++)
+                    crc[t][i] = crc[0][crc[t - 1][i] & 0xFF] ^ (crc[t - 1][i] >> 8);
+        }
+    };
+
+    static uint32_t updateTable(uint32_t crc, const uint8_t* data, size_t size)
+    {
+        static const Tables tables;
+        const uint32_t(*t)[256] = tables.crc;
+        for (; size >= 8; size -= 8, data += 8) {
+            uint32_t lo, hi;
+            memcpy(&lo, data, 4);
+            memcpy(&hi, data + 4, 4);
+            lo = littleEndian(lo) ^ crc;
+            hi = littleEndian(hi);
+            crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+                  t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        }
+        for (; size; size--, data++)
+            crc = t[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+        return crc;
+    }
+
+    static uint32_t littleEndian(uint32_t value)
+    {
+        const uint16_t one = 1;
+        if (*reinterpret_cast<const uint8_t*>(&one))
+            return value;
+        return (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+    }
+
+#if defined(CRC32C_X86)
+    static bool detectSse42()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+#else
+        return __builtin_cpu_supports("sse4.2");
+#endif
+    }
+
+#ifndef _MSC_VER
+    __attribute__((target("sse4.2")))
+#endif
+    static uint32_t updateSse42(uint32_t crc, const uint8_t* data, size_t size)
+    {
+        uint64_t crc64 = crc;
+        for (; size >= 8; size -= 8, data += 8) {
+            uint64_t value;
+            memcpy(&value, data, 8);
+            crc64 = _mm_crc32_u64(crc64, value);
+        }
+        crc = static_cast<uint32_t>(crc64);
+        for (; size; size--, data++)
+            crc = _mm_crc32_u8(crc, *data);
+        return crc;
+    }
+#endif
+
+#if defined(CRC32C_ARM)
+    static uint32_t updateArm(uint32_t crc, const uint8_t* data, size_t size)
+    {
+        for (; size >= 8; size -= 8, data += 8) {
+            uint64_t value;
+            memcpy(&value, data, 8);
+            crc = __crc32cd(crc, value);
+        }
+        for (; size; size--, data++)
+            crc = __crc32cb(crc, *data);
+        return crc;
+    }
+#endif
+};
+
+#endif /* !CRC32C_H */
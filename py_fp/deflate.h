@@ -0,0 +1,350 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef DEFLATE_H
+#define DEFLATE_H
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+/// Self-contained gzip (RFC 1952) writer. The data is compressed with deflate (RFC 1951):
+/// greedy LZ77 matching over a 32 kB window with hash chains, encoded as a single block with
+/// the fixed Huffman codes. It is meant for log files, which compress well without the dynamic
+/// Huffman tables, and trades some ratio for a small and dependency-free implementation.
+class GzipWriter {
+  public:
+    GzipWriter()
+        : mFile(NULL)
+    {
+    }
+
+    virtual ~GzipWriter()
+    {
+        close();
+    }
+
+    bool open(const char* fileName)
+    {
+        close();
+#ifdef _MSC_VER
+        if (fopen_s(&mFile, fileName, "wb"))
+            mFile = NULL;
+#else
+        mFile = fopen(fileName, "wb");
+#endif
+        if (!mFile)
+            return false;
+
+        mData.clear();
+        mBase = 0;
+        mPos = 0;
+        mHead.assign(HASH_SIZE, -1);
+        mPrev.assign(WINDOW_SIZE, -1);
+        mBits = 0;
+        mBitCount = 0;
+        mOut.clear();
+        mCrc = 0xFFFFFFFF;
+        mSize = 0;
+        mError = false;
+
+        uint32_t mtime = static_cast<uint32_t>(time(NULL));
+        const uint8_t header[10] = {0x1F, 0x8B, 8, 0, static_cast<uint8_t>(mtime), static_cast<uint8_t>(mtime >> 8),
+                                    static_cast<uint8_t>(mtime >> 16), static_cast<uint8_t>(mtime >> 24), 0, 0xFF};
+        mOut.insert(mOut.end(), header, header + sizeof(header));
+        putBits(1, 1);  // final block
+        putBits(1, 2);  // fixed Huffman codes
+        return true;
+    }
+
+    bool write(const void* data, size_t size)
+    {
+        if (!mFile)
+            return false;
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        mCrc = crc32(mCrc, bytes, size);
+        mSize += size;
+        mData.insert(mData.end(), bytes, bytes + size);
+        if (mData.size() - (mPos - mBase) > MAX_MATCH + CHUNK_SIZE)
+            compress(false);
+        return !mError;
+    }
+
+    /// Finishes the stream and closes the file, returns false if anything failed
+    bool close()
+    {
+        if (!mFile)
+            return false;
+        compress(true);
+        putLiteral(256);
+        if (mBitCount)
+            putBits(0, 8 - mBitCount);
+        for (int i = 0; i < 4; i++)
+            mOut.push_back(static_cast<uint8_t>((mCrc ^ 0xFFFFFFFF) >> (8 * i)));
+        for (int i = 0; i < 4; i++)
+            mOut.push_back(static_cast<uint8_t>(mSize >> (8 * i)));
+        flushOut();
+        bool ok = !mError && fclose(mFile) == 0;
+        mFile = NULL;
+        return ok;
+    }
+
+    /// Compresses the file into dstFileName, returns false if either file fails
+    static bool compressFile(const char* srcFileName, const char* dstFileName)
+    {
+        FILE* src = NULL;
+#ifdef _MSC_VER
+        if (fopen_s(&src, srcFileName, "rb"))
+            src = NULL;
+#else
+        src = fopen(srcFileName, "rb");
+#endif
+        if (!src)
+            return false;
+        GzipWriter writer;
+        bool ok = writer.open(dstFileName);
+        std::vector<uint8_t> buff(256 * 1024);
+        size_t n;
+        while (ok && (n = fread(buff.data(), 1, buff.size(), src)) > 0)
+            ok = writer.write(buff.data(), n);
+        ok = !ferror(src) && ok;
+        fclose(src);
+        return writer.close() && ok;
+    }
+
+    static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size)
+    {
+        static const Tables tables;
+        for (size_t i = 0; i < size; i++)
+            crc = tables.crc[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return crc;
+    }
+
+  private:
+    static const size_t WINDOW_SIZE = 32768;
+    static const size_t HASH_BITS = 15;
+    static const size_t HASH_SIZE = 1 << HASH_BITS;
+    static const size_t MIN_MATCH = 3;
+    static const size_t MAX_MATCH = 258;
+    static const int MAX_CHAIN = 32;
+    static const size_t CHUNK_SIZE = 256 * 1024;
+
+    struct Tables {
+        uint32_t crc[256];
+        Tables()
+        {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                crc[i] = c;
+            }
+        }
+    };
+
+    static uint32_t reverseBits(uint32_t code, int length)
+    {
+        uint32_t result = 0;
+        for (int i = 0; i < length; i++, code >>= 1)
+            result = (result << 1) | (code & 1);
+        return result;
+    }
+
+    /// Fixed Huffman codes (RFC 1951, 3.2.6), bit-reversed for the LSB-first bit stream
+    struct FixedCodes {
+        uint16_t codes[288];
+        uint8_t lengths[288];
+        FixedCodes()
+        {
+            for (uint32_t i = 0; i < 288; i++) {
+                if (i < 144) {
+                    lengths[i] = 8;
+                    codes[i] = static_cast<uint16_t>(reverseBits(0x30 + i, 8));
+                }
+                else if (i < 256) {
+                    lengths[i] = 9;
+                    codes[i] = static_cast<uint16_t>(reverseBits(0x190 + i - 144, 9));
+                }
+                else if (i < 280) {
+                    lengths[i] = 7;
+                    codes[i] = static_cast<uint16_t>(reverseBits(i - 256, 7));
+                }
+                else {
+                    lengths[i] = 8;
+                    codes[i] = static_cast<uint16_t>(reverseBits(0xC0 + i - 280, 8));
+                }
+            }
+        }
+    };
+
+    static const FixedCodes& fixedCodes()
+    {
+        static const FixedCodes codes;
+        return codes;
+    }
+
+    void putBits(uint32_t value, int count)
+    {
+        mBits |= static_cast<uint64_t>(value) << mBitCount;
+        mBitCount += count;
+        while (mBitCount >= 8) {
+            mOut.push_back(static_cast<uint8_t>(mBits));
+            mBits >>= 8;
+            mBitCount -= 8;
+        }
+    }
+
+    void putLiteral(uint32_t symbol)
+    {
+        const FixedCodes& fixed = fixedCodes();
+        putBits(fixed.codes[symbol], fixed.lengths[symbol]);
+    }
+
+    void putMatch(size_t length, size_t distance)
+    {
+        static const uint16_t lengthBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                                31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                                2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const uint16_t distBase[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+                                              193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        static const uint8_t distExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                              6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+        int code = 28;
+        while (lengthBase[code] > length)
+            code--;
+        putLiteral(257 + code);
+        if (lengthExtra[code])
+            putBits(static_cast<uint32_t>(length - lengthBase[code]), lengthExtra[code]);
+
+        code = 29;
+        while (distBase[code] > distance)
+            code--;
+        putBits(reverseBits(code, 5), 5);
+        if (distExtra[code])
+            putBits(static_cast<uint32_t>(distance - distBase[code]), distExtra[code]);
+    }
+
+    uint32_t hash(size_t index) const
+    {
+        return ((mData[index] << 10) ^ (mData[index + 1] << 5) ^ mData[index + 2]) & (HASH_SIZE - 1);
+    }
+
+    void insert(size_t index, int64_t pos)
+    {
+        uint32_t h = hash(index);
+        mPrev[pos & (WINDOW_SIZE - 1)] = mHead[h];
+        mHead[h] = pos;
+    }
+
+    /// Encodes the buffered data, keeps MAX_MATCH bytes of lookahead unless it is the end
+    void compress(bool final)
+    {
+        size_t end = final ? mData.size() : mData.size() - MAX_MATCH;
+        while (mPos - mBase < end) {
+            size_t index = mPos - mBase;
+            size_t available = mData.size() - index;
+            size_t bestLength = 0;
+            size_t bestDistance = 0;
+
+            if (available >= MIN_MATCH) {
+                size_t maxLength = available < MAX_MATCH ? available : MAX_MATCH;
+                int64_t candidate = mHead[hash(index)];
+                int chain = MAX_CHAIN;
+                while (candidate >= 0 && chain-- > 0) {
+                    size_t distance = static_cast<size_t>(static_cast<int64_t>(mPos) - candidate);
+                    if (distance == 0 || distance > WINDOW_SIZE)
+                        break;
+                    const uint8_t* a = &mData[index];
+                    const uint8_t* b = a - distance;
+                    if (b[bestLength] == a[bestLength]) {
+                        size_t length = 0;
+                        while (length < maxLength && a[length] == b[length])
+                            length++;
+                        if (length > bestLength) {
+                            bestLength = length;
+                            bestDistance = distance;
+                            if (length == maxLength)
+                                break;
+                        }
+                    }
+                    int64_t next = mPrev[candidate & (WINDOW_SIZE - 1)];
+                    if (next >= candidate)
+                        break;
+                    candidate = next;
+                }
+            }
+
+            if (bestLength >= MIN_MATCH) {
+                putMatch(bestLength, bestDistance);
+                for (size_t i = 0; i < bestLength; i++) {
+                    if (index + i + MIN_MATCH <= mData.size())
+                        insert(index + i, static_cast<int64_t>(mPos + i));
+                }
+                mPos += bestLength;
+            }
+            else {
+                putLiteral(mData[index]);
+                if (available >= MIN_MATCH)
+                    insert(index, static_cast<int64_t>(mPos));
+                mPos++;
+            }
+            if (mOut.size() >= CHUNK_SIZE)
+                flushOut();
+        }
+
+        // keep one window of history in front of the next position
+        size_t index = mPos - mBase;
+        if (index > WINDOW_SIZE) {
+            size_t drop = index - WINDOW_SIZE;
+            mData.erase(mData.begin(), mData.begin() + drop);
+            mBase += drop;
+        }
+        flushOut();
+    }
+
+    void flushOut()
+    {
+        if (mOut.empty())
+            return;
+        if (fwrite(mOut.data(), 1, mOut.size(), mFile) != mOut.size())
+            mError = true;
+        mOut.clear();
+    }
+
+  private:
+    FILE* mFile;
+    std::vector<uint8_t> mData;   // input from absolute position mBase
+    size_t mBase;
+    size_t mPos;                  // absolute position of the next byte to encode
+    std::vector<int64_t> mHead;
+    std::vector<int64_t> mPrev;
+    uint64_t mBits;
+    int mBitCount;
+    std::vector<uint8_t> mOut;
+    uint32_t mCrc;
+    uint32_t mSize;
+    bool mError;
+};
+
+#endif /* !DEFLATE_H */
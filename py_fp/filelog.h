@@ -21,16 +21,24 @@ SOFTWARE.
 */
 #ifndef FILELOG_H
 #define FILELOG_H
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdarg>
 #include <cstdio>
 #include <cstring>
 #include <ctime>
+#include <deque>
 #include <filesystem>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+#include "deflate.h"
 
 #ifdef TESTING
 #define TESTING_VIRTUAL virtual
@@ -43,6 +51,9 @@ SOFTWARE.
 #endif
 
 #define FILELOG_DEFLEN 512
+#define FILELOG_TIME_SIZE 32
+#define FILELOG_QUEUE_SIZE 8192
+#define FILELOG_BATCH_SIZE 256
 
 using namespace std::chrono;
 
@@ -50,6 +61,107 @@ enum LogLevel { LOG_FATAL_ERR = 0, LOG_ERR, LOG_MSG, LOG_DBG};
 
 static const char* LOG_PREFIX[] = {"FAIL", "!ERR", " MSG", "DBG"};
 
+// Messages above this level are removed at compile time when logged with FILELOG(), release
+// builds keep LOG_MSG and below by default
+#ifndef FILELOG_MIN_LEVEL
+#ifdef NDEBUG
+#define FILELOG_MIN_LEVEL LOG_MSG
+#else
+#define FILELOG_MIN_LEVEL LOG_DBG
+#endif
+#endif
+
+/// Logs a message into a FileLog, the arguments are not evaluated when the level is above
+/// FILELOG_MIN_LEVEL or the level of the log
+#define FILELOG(fileLog, level, ...)                                                                           \
+    do {                                                                                                       \
+        if ((level) <= FILELOG_MIN_LEVEL && (level) <= (fileLog).logLevel())                                   \
+            (fileLog).log(level, __VA_ARGS__);                                                                 \
+    } while (0)
+
+/// What an asynchronous log does when its queue is full
+enum LogOverflow { LOG_OVERFLOW_BLOCK = 0, LOG_OVERFLOW_DROP };
+
+/// Bounded lock-free queue of preformatted log records, any number of producers and a single
+/// consumer. Every slot carries a sequence number that tells whether it is free for the producer
+/// that claimed its position or filled for the consumer. Records are swapped in and out, so the
+/// string buffers are recycled between producers and the writer.
+class LogQueue {
+  public:
+    explicit LogQueue(size_t capacity)
+        : mEnqueuePos(0)
+        , mDequeuePos(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mMask = size - 1;
+        mSlots.reset(new Slot[size]);
+        for (size_t i = 0; i < size; i++)
+            mSlots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    /// Moves the record into the queue, returns false if the queue is full
+    bool push(std::string& record)
+    {
+        size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &mSlots[pos & mMask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+        }
+        slot->record.swap(record);
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Takes the oldest record, consumer thread only
+    bool pop(std::string& record)
+    {
+        Slot* slot = &mSlots[mDequeuePos & mMask];
+        if (slot->seq.load(std::memory_order_acquire) != mDequeuePos + 1)
+            return false;
+        record.swap(slot->record);
+        slot->record.clear();
+        slot->seq.store(mDequeuePos + mMask + 1, std::memory_order_release);
+        mDequeuePos++;
+        return true;
+    }
+
+    bool empty() const
+    {
+        return mSlots[mDequeuePos & mMask].seq.load(std::memory_order_acquire) != mDequeuePos + 1;
+    }
+
+  private:
+    struct alignas(64) Slot {
+        std::atomic<size_t> seq;
+        std::string record;
+    };
+
+    alignas(64) std::atomic<size_t> mEnqueuePos;
+    alignas(64) size_t mDequeuePos;
+    size_t mMask;
+    std::unique_ptr<Slot[]> mSlots;
+};
+
+/// Receives a copy of every message that passes the level of a FileLog. It is called on the
+/// thread that logs the message, with the sink lock of the log held, and must not block.
+class LogSink {
+  public:
+    virtual ~LogSink() {}
+    virtual void write(LogLevel logLevel, const std::string& text) = 0;
+};
+
 class FileLog {
   public:
     FileLog(const char* logFileName = "log.log", bool logToFile = true, bool logToStdout = true, LogLevel logLevel = LOG_ERR)
@@ -60,6 +172,24 @@ class FileLog {
         , mLogToStdout(logToStdout)
         , mLogLevel(logLevel)
         , mMaxLogBufferSize(250)
+        , mAsync(false)
+        , mQueueRefs(0)
+        , mOverflow(LOG_OVERFLOW_BLOCK)
+        , mStopWriter(false)
+        , mWakePending(false)
+        , mWriterSleeping(false)
+        , mEnqueued(0)
+        , mWritten(0)
+        , mDropped(0)
+        , mRotateSize(0)
+        , mRotateInterval(0)
+        , mRotateKeep(0)
+        , mRotateCompress(false)
+        , mFileSize(0)
+        , mFileOpenedAt(steady_clock::now())
+        , mRotatedIndex(0)
+        , mStopHousekeeper(false)
+        , mSink(NULL)
     {
         if (mLogToFile) {
             openFile(!fileExists(mLogFileName.c_str()));
@@ -74,6 +204,8 @@ class FileLog {
 
     virtual ~FileLog()
     {
+        setAsync(false);
+        stopHousekeeper();
         if (mLogFile)
             fclose(mLogFile);
     }
@@ -98,6 +230,8 @@ class FileLog {
 
     int log(int err, LogLevel logLevel, const char* text, ...)
     {
+        if (logLevel > mLogLevel)
+            return err;
         va_list args;
         va_start(args, text);
         log(logLevel, text, args);
@@ -107,6 +241,8 @@ class FileLog {
 
     int log(LogLevel logLevel, const char* text, ...)
     {
+        if (logLevel > mLogLevel)
+            return 0;
         va_list args;
         va_start(args, text);
         int rc = log(logLevel, text, args);
@@ -116,6 +252,8 @@ class FileLog {
 
     int log(LogLevel logLevel, const char* text, va_list args)
     {
+        if (logLevel > mLogLevel)
+            return 0;
         int size = FILELOG_DEFLEN;
         std::string str;
         while (1) {
@@ -134,19 +272,32 @@ class FileLog {
 
     int log(int err, LogLevel logLevel, std::string text)
     {
+        if (mSink.load(std::memory_order_relaxed) && logLevel <= mLogLevel)
+            writeSink(logLevel, text);
+        if (QueueRef queue{this}) {
+            if (logLevel > mLogLevel)
+                return 0;
+            enqueue(formatLine(logLevel, text.c_str()));
+            std::lock_guard<std::mutex> lock(mLastMsgMutex);
+            mLastLogMsg = text;
+            return err;
+        }
+
         std::lock_guard<std::mutex> lock(mMutex);
         if (logLevel > mLogLevel)
             return 0;
 
+        char time[FILELOG_TIME_SIZE];
+        formatTime(time);
         if (mLogToStdout) {
-            printf("(%s) [%s]: %s\n", currentTime().c_str(), LOG_PREFIX[logLevel], text.c_str());
+            printf("(%s) [%s]: %s\n", time, LOG_PREFIX[logLevel], text.c_str());
             fflush(stdout);
         }
 
         if (mLogToFile && !openFile()) {
-            fprintf(mLogFile, "(%s) [%s]: %s\n", currentTime().c_str(), LOG_PREFIX[logLevel], text.c_str());
+            fprintf(mLogFile, "(%s) [%s]: %s\n", time, LOG_PREFIX[logLevel], text.c_str());
             fflush(mLogFile);
-            closeFile();
+            closeWrittenFile();
         }
         mLastLogMsg = text;
         return err;
@@ -155,20 +306,27 @@ class FileLog {
     int logTextBuffer(int err, LogLevel logLevel, const char* text, const char* prefix = NULL)
     {
         log(err, logLevel, prefix ? prefix : "Buffer:");
+        if (QueueRef queue{this}) {
+            if (logLevel <= mLogLevel)
+                enqueue(formatLine(logLevel, text));
+            return err;
+        }
         {
             std::lock_guard<std::mutex> lock(mMutex);
             if (logLevel > mLogLevel)
                 return 0;
 
+            char time[FILELOG_TIME_SIZE];
+            formatTime(time);
             if (mLogToStdout) {
-                printf("(%s) [%s]: %s\n", currentTime().c_str(), LOG_PREFIX[logLevel], text);
+                printf("(%s) [%s]: %s\n", time, LOG_PREFIX[logLevel], text);
                 fflush(stdout);
             }
 
             if (mLogToFile && !openFile()) {
-                fprintf(mLogFile, "(%s) [%s]: %s\n", currentTime().c_str(), LOG_PREFIX[logLevel], text);
+                fprintf(mLogFile, "(%s) [%s]: %s\n", time, LOG_PREFIX[logLevel], text);
                 fflush(mLogFile);
-                closeFile();
+                closeWrittenFile();
             }
         }
         return err;
@@ -184,18 +342,29 @@ class FileLog {
                   bool showAsciiTranscript = true)
     {
         log(err, logLevel, prefix ? prefix : "Buffer:");
+        if (QueueRef queue{this}) {
+            if (logLevel <= mLogLevel) {
+                std::string record;
+                formatBuffer(record, (unsigned char*)buffer, size, mMaxLogBufferSize, showAsciiTranscript);
+                enqueue(std::move(record));
+            }
+            return err;
+        }
         {
             std::lock_guard<std::mutex> lock(mMutex);
             if (logLevel > mLogLevel)
                 return 0;
 
+            std::string dump;
+            formatBuffer(dump, (unsigned char*)buffer, size, mMaxLogBufferSize, showAsciiTranscript);
             if (mLogToStdout) {
-                logBuffer(stdout, (unsigned char*)buffer, size, mMaxLogBufferSize, showAsciiTranscript);
+                fwrite(dump.data(), 1, dump.size(), stdout);
+                fflush(stdout);
             }
 
             if (mLogToFile && !openFile()) {
-                logBuffer(mLogFile, (unsigned char*)buffer, size, mMaxLogBufferSize, showAsciiTranscript);
-                closeFile();
+                fwrite(dump.data(), 1, dump.size(), mLogFile);
+                closeWrittenFile();
             }
         }
         return err;
@@ -203,6 +372,14 @@ class FileLog {
 
     void logNoTime(LogLevel logLevel, const char* text)
     {
+        if (mSink.load(std::memory_order_relaxed) && logLevel <= mLogLevel)
+            writeSink(logLevel, text);
+        if (QueueRef queue{this}) {
+            if (logLevel <= mLogLevel)
+                enqueue(std::string(text));
+            return;
+        }
+
         std::lock_guard<std::mutex> lock(mMutex);
         if (logLevel > mLogLevel)
             return;
@@ -215,13 +392,16 @@ class FileLog {
         if (mLogToFile && !openFile()) {
             fprintf(mLogFile, "%s", text);
             fflush(mLogFile);
-            closeFile();
+            closeWrittenFile();
         }
     }
 
     int rotateLog(const char* newFileName)
     {
+        if (mAsync)
+            flush();
         std::lock_guard<std::mutex> lock(mMutex);
+        closeFile();
         int rc = std::rename(mLogFileName.c_str(), newFileName);
         if (rc == 0) {
             openFile(!fileExists(mLogFileName.c_str()));
@@ -232,15 +412,94 @@ class FileLog {
         return rc;
     }
 
+    /// Rotates the log automatically when it grows over maxSize bytes or is older than intervalSec
+    /// seconds (0 disables either). The file is renamed to <name>-<date>-<time><ext>, the newest
+    /// keepFiles rotated files are kept (0 keeps all) and with compress they are gzipped. Both run
+    /// on a background thread, loggers only wait for the rename.
+    void setRotation(unsigned long long maxSize, unsigned intervalSec = 0, int keepFiles = 5, bool compress = true)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRotateSize = maxSize;
+        mRotateInterval = intervalSec;
+        mRotateKeep = keepFiles > 0 ? keepFiles : 0;
+        mRotateCompress = compress;
+        std::error_code err;
+        mFileSize = std::filesystem::file_size(mLogFileName, err);
+        if (err)
+            mFileSize = 0;
+        mFileOpenedAt = steady_clock::now();
+        if ((maxSize || intervalSec) && !mHousekeeper.joinable()) {
+            mStopHousekeeper = false;
+            mHousekeeper = std::thread(&FileLog::housekeeperLoop, this);
+        }
+    }
+
+    /// Switches to asynchronous logging: records are formatted by the caller and put into a queue
+    /// of queueSize records, a writer thread keeps the file open and writes them in batches. When
+    /// the queue is full the caller either waits or the record is dropped and counted. Disabling
+    /// the mode (and destroying the log) writes all queued records first. It may be switched while
+    /// other threads log: the writer is stopped only after the last of them left the queue.
+    void setAsync(bool async, size_t queueSize = FILELOG_QUEUE_SIZE, LogOverflow overflow = LOG_OVERFLOW_BLOCK)
+    {
+        std::lock_guard<std::mutex> lock(mAsyncMutex);
+        if (mAsync) {
+            mAsync = false;
+            while (mQueueRefs.load())
+                std::this_thread::yield();
+            {
+                std::lock_guard<std::mutex> wakeLock(mWakeMutex);
+                mStopWriter = true;
+            }
+            mWakeCond.notify_all();
+            mWriter.join();
+            std::lock_guard<std::mutex> fileLock(mMutex);
+            closeFile();
+        }
+        if (!async)
+            return;
+        mQueue.reset(new LogQueue(queueSize));
+        mOverflow = overflow;
+        mStopWriter = false;
+        mEnqueued = 0;
+        mWritten = 0;
+        mWriter = std::thread(&FileLog::writerLoop, this);
+        mAsync = true;
+    }
+
+    /// Waits until all records queued so far are written
+    void flush()
+    {
+        if (!mAsync)
+            return;
+        unsigned long long target = mEnqueued.load();
+        std::unique_lock<std::mutex> lock(mWakeMutex);
+        while (mWritten.load() < target && !mStopWriter) {
+            mWakePending = true;
+            mWakeCond.notify_all();
+            mFlushCond.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+
   public:
+    /// Forwards the messages to the sink as well (NULL to stop). The sink is owned by the caller,
+    /// it is not used any more once this returns.
+    void setSink(LogSink* sink)
+    {
+        std::lock_guard<std::mutex> lock(mSinkMutex);
+        mSink = sink;
+    }
+
     void setLogToFile(bool logToFile) { mLogToFile = logToFile; }
     void setLogToStdout(bool logToStdout) { mLogToStdout = logToStdout; }
     void setLogLevel(int logLevel) { mLogLevel = logLevel; }
+    int logLevel() const { return mLogLevel; }
     void setMaxLogBufferSize(size_t size) { mMaxLogBufferSize = size; }
     bool isLoggingToFile() { return mLogToFile; }
     bool isLoggingToStdout() { return mLogToStdout; }
     std::string getLogFileName() { return mLogFileName; }
     std::string getLastMessage() { return mLastLogMsg; }
+    bool isAsync() { return mAsync; }
+    unsigned long long droppedMessages() { return mDropped.load(); }
 
   protected:
     TESTING_VIRTUAL std::chrono::system_clock::time_point getTimeNow()
@@ -250,77 +509,422 @@ class FileLog {
 
     std::string currentTime()
     {
+        char time[FILELOG_TIME_SIZE];
+        size_t size = formatTime(time);
+        return std::string(time, size);
+    }
+
+    /// Writes the current time (day-month-year hours:minutes:seconds.milliseconds) into a buffer
+    /// of FILELOG_TIME_SIZE bytes, returns its length. The date part is formatted once per second
+    /// and thread, only the milliseconds are converted for every message.
+    size_t formatTime(char* out)
+    {
+        struct TimeCache {
+            std::time_t second = -1;
+            char prefix[FILELOG_TIME_SIZE];
+            size_t size = 0;
+        };
+        thread_local TimeCache cache;
+
         auto timeNow = getTimeNow();
         std::time_t timet = system_clock::to_time_t(timeNow);
-        auto millis = duration_cast<milliseconds>(timeNow.time_since_epoch()).count() - timet * 1000;
-        const size_t size = 30;
-        char str[size] = {0};
-        std::strftime(str, size, "%d-%m-%y %H:%M:%S.", std::localtime(&timet));
-        return std::string(str) + std::to_string(millis);
+        long long millis = duration_cast<milliseconds>(timeNow.time_since_epoch()).count() - (long long)timet * 1000;
+        if (timet != cache.second) {
+            std::tm tm;
+#ifdef _MSC_VER
+            localtime_s(&tm, &timet);
+#else
+            localtime_r(&timet, &tm);
+#endif
+            cache.size = std::strftime(cache.prefix, sizeof(cache.prefix), "%d-%m-%y %H:%M:%S.", &tm);
+            cache.second = timet;
+        }
+
+        memcpy(out, cache.prefix, cache.size);
+        size_t size = cache.size;
+        if (millis < 0 || millis > 999)
+            size += snprintf(out + size, FILELOG_TIME_SIZE - size, "%lld", millis);
+        else {
+            // no zero padding, as before
+            if (millis >= 100)
+                out[size++] = static_cast<char>('0' + millis / 100);
+            if (millis >= 10)
+                out[size++] = static_cast<char>('0' + millis / 10 % 10);
+            out[size++] = static_cast<char>('0' + millis % 10);
+        }
+        out[size] = '\0';
+        return size;
+    }
+
+    void writeSink(LogLevel logLevel, const std::string& text)
+    {
+        std::lock_guard<std::mutex> lock(mSinkMutex);
+        if (mSink)
+            mSink.load()->write(logLevel, text);
+    }
+
+    std::string formatLine(LogLevel logLevel, const char* text)
+    {
+        char time[FILELOG_TIME_SIZE];
+        size_t timeSize = formatTime(time);
+        const char* prefix = LOG_PREFIX[logLevel];
+        std::string line;
+        line.reserve(timeSize + strlen(prefix) + strlen(text) + 8);
+        line += '(';
+        line.append(time, timeSize);
+        line += ") [";
+        line += prefix;
+        line += "]: ";
+        line += text;
+        line += '\n';
+        return line;
+    }
+
+    /// Reference of a producer to the queue of the asynchronous mode, true while the mode is on.
+    /// setAsync waits until no reference is held before it stops the writer or replaces the queue.
+    class QueueRef {
+      public:
+        explicit QueueRef(FileLog* log)
+            : mLog(log)
+        {
+            mLog->mQueueRefs++;
+            mActive = mLog->mAsync.load();
+        }
+        ~QueueRef() { mLog->mQueueRefs--; }
+        QueueRef(const QueueRef&) = delete;
+        QueueRef& operator=(const QueueRef&) = delete;
+        explicit operator bool() const { return mActive; }
+
+      private:
+        FileLog* mLog;
+        bool mActive;
+    };
+
+    void enqueue(std::string record)
+    {
+        if (!mQueue->push(record)) {
+            if (mOverflow == LOG_OVERFLOW_DROP) {
+                mDropped++;
+                return;
+            }
+            do {
+                wakeWriter();
+                std::this_thread::yield();
+            } while (!mQueue->push(record));
+        }
+        mEnqueued++;
+        if (mWriterSleeping.load())
+            wakeWriter();
+    }
+
+    void wakeWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mWakeMutex);
+            mWakePending = true;
+        }
+        mWakeCond.notify_one();
+    }
+
+    void writerLoop()
+    {
+        std::string record;
+        std::string batch;
+        while (true) {
+            size_t count = 0;
+            batch.clear();
+            while (count < FILELOG_BATCH_SIZE && mQueue->pop(record)) {
+                batch += record;
+                count++;
+            }
+
+            if (count) {
+                writeBatch(batch);
+                std::lock_guard<std::mutex> lock(mWakeMutex);
+                mWritten += count;
+                mFlushCond.notify_all();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mWakeMutex);
+            if (mStopWriter && mQueue->empty())
+                break;
+            mWriterSleeping = true;
+            mWakeCond.wait_for(lock, std::chrono::milliseconds(50),
+                               [this] { return mWakePending || mStopWriter || !mQueue->empty(); });
+            mWriterSleeping = false;
+            mWakePending = false;
+        }
+    }
+
+    void writeBatch(const std::string& batch)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mLogToStdout) {
+            fwrite(batch.data(), 1, batch.size(), stdout);
+            fflush(stdout);
+        }
+        if (mLogToFile && (mLogFile || !openFile())) {
+            fwrite(batch.data(), 1, batch.size(), mLogFile);
+            fflush(mLogFile);
+            mFileSize = fileSize();
+            rotateIfNeeded();
+        }
+    }
+
+    unsigned long long fileSize()
+    {
+#ifdef _MSC_VER
+        long long size = _ftelli64(mLogFile);
+#else
+        long long size = ftello(mLogFile);
+#endif
+        return size > 0 ? static_cast<unsigned long long>(size) : 0;
+    }
+
+    /// Closes the file after a message was written and rotates it if needed, mMutex is locked
+    void closeWrittenFile()
+    {
+        if (mRotateSize)
+            mFileSize = fileSize();
+        closeFile();
+        rotateIfNeeded();
+    }
+
+    void rotateIfNeeded()
+    {
+        bool rotate = mRotateSize && mFileSize >= mRotateSize;
+        if (!rotate && mRotateInterval)
+            rotate = steady_clock::now() - mFileOpenedAt >= seconds(mRotateInterval);
+        if (!rotate)
+            return;
+
+        closeFile();
+        std::string rotatedName = rotatedFileName();
+        if (std::rename(mLogFileName.c_str(), rotatedName.c_str()) == 0) {
+            {
+                std::lock_guard<std::mutex> lock(mHousekeepingMutex);
+                mHousekeepingFiles.push_back(rotatedName);
+            }
+            mHousekeepingCond.notify_one();
+            openFile(true);
+            if (mLogFile)
+                fprintf(mLogFile, "################# LOG OPENED (%s) ###################### \n", currentTime().c_str());
+            closeFile();
+        }
+        mFileSize = 0;
+        mFileOpenedAt = steady_clock::now();
+    }
+
+    /// <stem>-<yyyymmdd>-<hhmmss>[-n]<ext> next to the log file
+    std::string rotatedFileName()
+    {
+        std::filesystem::path path(mLogFileName);
+        std::time_t timet = system_clock::to_time_t(getTimeNow());
+        std::tm tm;
+#ifdef _MSC_VER
+        localtime_s(&tm, &timet);
+#else
+        localtime_r(&timet, &tm);
+#endif
+        char stamp[32] = {0};
+        std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+        std::string base = (path.parent_path() / path.stem()).string() + "-" + stamp;
+        std::string ext = path.extension().string();
+
+        // more rotations within a second get increasing indexes, also when older ones were deleted
+        int index = mRotatedStamp == stamp ? mRotatedIndex + 1 : 0;
+        std::string name;
+        do {
+            name = index ? base + "-" + std::to_string(index) + ext : base + ext;
+        } while ((fileExists(name) || fileExists(name + ".gz")) && ++index);
+        mRotatedStamp = stamp;
+        mRotatedIndex = index;
+        return name;
+    }
+
+    void housekeeperLoop()
+    {
+        std::unique_lock<std::mutex> lock(mHousekeepingMutex);
+        while (true) {
+            mHousekeepingCond.wait(lock, [this] { return mStopHousekeeper || !mHousekeepingFiles.empty(); });
+            if (mHousekeepingFiles.empty())
+                break;
+            std::string fileName = mHousekeepingFiles.front();
+            mHousekeepingFiles.pop_front();
+            bool compress = mRotateCompress;
+            int keep = mRotateKeep;
+            lock.unlock();
+
+            if (compress) {
+                std::string gzName = fileName + ".gz";
+                if (GzipWriter::compressFile(fileName.c_str(), gzName.c_str()))
+                    std::remove(fileName.c_str());
+                else
+                    std::remove(gzName.c_str());
+            }
+            if (keep)
+                removeOldFiles(keep);
+
+            lock.lock();
+        }
+    }
+
+    void stopHousekeeper()
+    {
+        if (!mHousekeeper.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mHousekeepingMutex);
+            mStopHousekeeper = true;
+        }
+        mHousekeepingCond.notify_all();
+        mHousekeeper.join();
+    }
+
+    /// Deletes all but the newest keep rotated files (compressed or not) of this log
+    void removeOldFiles(int keep)
+    {
+        struct Rotated {
+            std::string stamp;
+            int index;
+            std::string name;
+            bool operator<(const Rotated& other) const
+            {
+                return stamp != other.stamp ? stamp < other.stamp : index < other.index;
+            }
+        };
+
+        std::filesystem::path path(mLogFileName);
+        std::filesystem::path dir = path.parent_path().empty() ? std::filesystem::path(".") : path.parent_path();
+        std::string prefix = path.stem().string() + "-";
+        std::string ext = path.extension().string();
+        std::vector<Rotated> rotated;
+        std::error_code err;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, err)) {
+            std::string name = entry.path().filename().string();
+            std::string plain = name;
+            if (plain.size() > 3 && plain.compare(plain.size() - 3, 3, ".gz") == 0)
+                plain.resize(plain.size() - 3);
+            if (plain.size() < prefix.size() + 15 + ext.size() || plain.compare(0, prefix.size(), prefix) != 0
+                || plain.compare(plain.size() - ext.size(), ext.size(), ext) != 0)
+                continue;
+
+            // <yyyymmdd>-<hhmmss>[-n]
+            std::string stamp = plain.substr(prefix.size(), plain.size() - prefix.size() - ext.size());
+            bool valid = true;
+            for (size_t i = 0; i < 15 && valid; i++)
+                valid = i == 8 ? stamp[i] == '-' : isdigit((unsigned char)stamp[i]) != 0;
+            int index = 0;
+            if (valid && stamp.size() > 15) {
+                valid = stamp[15] == '-' && stamp.size() > 16;
+                for (size_t i = 16; i < stamp.size() && valid; i++)
+                    valid = isdigit((unsigned char)stamp[i]) != 0;
+                if (valid)
+                    index = atoi(stamp.c_str() + 16);
+            }
+            if (valid)
+                rotated.push_back({stamp.substr(0, 15), index, name});
+        }
+
+        // newest first, a file and its .gz count once
+        std::sort(rotated.begin(), rotated.end());
+        int count = 0;
+        for (size_t i = rotated.size(); i-- > 0;) {
+            bool sameRotation = i + 1 < rotated.size() && !(rotated[i] < rotated[i + 1]);
+            if (!sameRotation)
+                count++;
+            if (count > keep)
+                std::filesystem::remove(dir / rotated[i].name, err);
+        }
     }
 
     void logBuffer(FILE* file, unsigned char* data, size_t size, size_t showSize = 250, bool asciiTrans = true)
     {
+        std::string out;
+        formatBuffer(out, data, size, showSize, asciiTrans);
+        fwrite(out.data(), 1, out.size(), file);
+    }
+
+    /// Appends the hex dump of the buffer: rows of 32 bytes in hex (first 16 lowercase, next 16
+    /// uppercase) padded to 100 columns, optionally followed by the ASCII transcript. Buffers over
+    /// showSize bytes only show their beginning and end.
+    void formatBuffer(std::string& out, unsigned char* data, size_t size, size_t showSize = 250, bool asciiTrans = true)
+    {
+        struct Tables {
+            char lower[256][2];
+            char upper[256][2];
+            char ascii[256];
+            Tables()
+            {
+                const char* lowerDigits = "0123456789abcdef";
+                const char* upperDigits = "0123456789ABCDEF";
+                for (int b = 0; b < 256; b++) {
+                    lower[b][0] = lowerDigits[b >> 4];
+                    lower[b][1] = lowerDigits[b & 15];
+                    upper[b][0] = upperDigits[b >> 4];
+                    upper[b][1] = upperDigits[b & 15];
+                    ascii[b] = (b > 0x20 && b < 0x80) ? static_cast<char>(b) : '.';
+                }
+            }
+        };
+        static const Tables tables;
+
+        // "   " hex (100 columns) [ "| " 16 chars "  " 16 chars ] " \n"
         const size_t asciiOffset = 100;
-        const size_t lineSize = 256;
-        char line[lineSize] = {0};
+        const size_t indent = 3;
+        char line[indent + asciiOffset + 2 + 16 + 2 + 16 + 2];
         bool skipped = false;
 
         if (size > showSize)
             showSize /= 2;
 
+        size_t rows = (std::min(size, 2 * showSize + 64) + 31) / 32;
+        out.reserve(out.size() + rows * sizeof(line) + 128);
+
         for (size_t i = 0; i < size; i += 32) {
 
             if (i >= showSize && !skipped) {
                 skipped = true;
-                fprintf(file, "                                          ----- DATA SKIPPED -----\n");
+                out += "                                          ----- DATA SKIPPED -----\n";
                 if (size - showSize > i)
                     i = size - showSize;
             }
 
-            memset(line, ' ', asciiOffset);
-
-            // HEX bytes first 16
-            for (size_t j = 0; (j < 16) && (j + i < size); j++)
-                snprintf(&line[j * 3], 4, "%02x ", data[i + j]);
-            line[strlen(line)] = ' ';
+            size_t count = std::min<size_t>(size - i, 32);
+            const unsigned char* row = data + i;
+            char* hex = line + indent;
+            memset(line, ' ', indent + asciiOffset);
 
-            // HEX bytes next 16
-            for (size_t j = 16; (j < 32) && (j + i < size); j++)
-                snprintf(&line[j * 3 + 3], 4, "%02X ", data[i + j]);
-            line[strlen(line)] = ' ';
+            // HEX bytes first 16, next 16 after an extra space
+            for (size_t j = 0; j < count && j < 16; j++)
+                memcpy(hex + j * 3, tables.lower[row[j]], 2);
+            for (size_t j = 16; j < count; j++)
+                memcpy(hex + j * 3 + 3, tables.upper[row[j]], 2);
 
+            size_t length = indent + asciiOffset;
             if (asciiTrans) {
-                memset(line + asciiOffset, 0, lineSize - asciiOffset);
-                line[strlen(line)] = '|';
-                line[strlen(line)] = ' ';
-
-                // first 16 chars
-                for (size_t j = 0; (j < 16) && (j + i < size); j++) {
-                    unsigned char b = data[i + j];
-                    line[asciiOffset + 2 + j] = (b > 0x20 && b < 0x80) ? b : '.';
-                }
-
-                line[strlen(line)] = ' ';
-                line[strlen(line)] = ' ';
-
-                // next 16 chars
-                for (size_t j = 16; (j < 32) && (j + i < size); j++) {
-                    unsigned char b = data[i + j];
-                    line[asciiOffset + 2 + j + 1] = (b > 0x20 && b < 0x80) ? b : '.';
-                }
-            }
-            else {
-                line[asciiOffset] = '\0';
+                char* ascii = hex + asciiOffset;
+                ascii[0] = '|';
+                ascii[1] = ' ';
+                for (size_t j = 0; j < count && j < 16; j++)
+                    ascii[2 + j] = tables.ascii[row[j]];
+                size_t first = std::min<size_t>(count, 16);
+                ascii[2 + first] = ' ';
+                ascii[3 + first] = ' ';
+                for (size_t j = 16; j < count; j++)
+                    ascii[3 + j] = tables.ascii[row[j]];
+                length += count > 16 ? 3 + count : 4 + count;
             }
-
-            fprintf(file, "   %s \n", line);
+            line[length] = ' ';
+            line[length + 1] = '\n';
+            out.append(line, length + 2);
         }
 
         if (size > 64)
-            fprintf(file, "   Bytes: %u\n", (unsigned)size);
+            out += "   Bytes: " + std::to_string((unsigned)size) + "\n";
 
-        fprintf(file, "\n");
+        out += "\n";
     }
 
     bool fileExists(std::string path)
@@ -336,8 +940,45 @@ class FileLog {
     std::string mLastLogMsg;
     bool mLogToFile;
     bool mLogToStdout;
-    int mLogLevel;
+    std::atomic<int> mLogLevel;
     size_t mMaxLogBufferSize;
+
+    // asynchronous mode
+    std::mutex mAsyncMutex;
+    std::mutex mLastMsgMutex;
+    std::mutex mWakeMutex;
+    std::condition_variable mWakeCond;
+    std::condition_variable mFlushCond;
+    std::unique_ptr<LogQueue> mQueue;
+    std::thread mWriter;
+    std::atomic<bool> mAsync;
+    std::atomic<int> mQueueRefs;
+    LogOverflow mOverflow;
+    bool mStopWriter;
+    bool mWakePending;
+    std::atomic<bool> mWriterSleeping;
+    std::atomic<unsigned long long> mEnqueued;
+    std::atomic<unsigned long long> mWritten;
+    std::atomic<unsigned long long> mDropped;
+
+    // automatic rotation
+    unsigned long long mRotateSize;
+    unsigned mRotateInterval;
+    std::atomic<int> mRotateKeep;
+    std::atomic<bool> mRotateCompress;
+    unsigned long long mFileSize;
+    steady_clock::time_point mFileOpenedAt;
+    std::string mRotatedStamp;
+    int mRotatedIndex;
+    std::mutex mHousekeepingMutex;
+    std::condition_variable mHousekeepingCond;
+    std::deque<std::string> mHousekeepingFiles;
+    std::thread mHousekeeper;
+    bool mStopHousekeeper;
+
+    // copy of the messages for another consumer
+    std::mutex mSinkMutex;
+    std::atomic<LogSink*> mSink;
 };
 
 #endif // FILELOG_H
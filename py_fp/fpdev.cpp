@@ -23,13 +23,20 @@ SOFTWARE.
 #include "fpdev.h"
 #include <cmath>
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <thread>
 
 #include "buffer.h"
-#include "okFrontPanelDLL.h"
+#include "bufferpool.h"
+#include "crc32c.h"
+#include "filelog.h"
+#include "fptransport.h"
 #include "strutils.h"
 
 
 #define CHECK_CONNECTED \
+    std::lock_guard<FPDevMutex> devLock(mDevMutex); \
     if (!mFp){ \
         mLastError = "Device not connected.";\
         return FPERR_NOT_CONNECTED; \
@@ -37,247 +44,1050 @@ SOFTWARE.
 
 std::string FPDev::mLibDate;
 
+static i64 steadyNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 FPDev::FPDev()
     : mFp(NULL)
     , mIsUSB3Speed(false)
     , mCloseOnFailure(false)
+    , mFlashLayout()
+    , mLink()
+    , mUserBlockSize(0)
+    , mUserMaxChunkSize(0)
+    , mFlashIndex(-1)
+    , mTimeout(-1)
+    , mAutoReconnect(false)
+    , mReconnectReconfigure(false)
+    , mReconnecting(false)
+    , mReconnectAttempts(5)
+    , mReconnectDelayMs(10)
+    , mReconnectInfo()
+    , mOpenGeneration(0)
+    , mDownSinceNs(0)
+    , mDowntimeCountedNs(0)
+    , mWireIns()
+    , mWireInsValid(0)
+    , mWireInsDirty(0)
+    , mRecordRegisterWrites(false)
+    , mWireOuts()
+    , mWireOutsTimeNs(0)
+    , mWatcherQueueSize(0)
+    , mWatcherStop(true)
+    , mWatcherDropped(0)
+    , mStats(new FPStats())
+    , mMonitor(new FPPipeMonitor())
+    , mStatsEnabled(true)
+    , mTracer(new FPTracer())
+    , mPipeLog(nullptr)
+    , mPipeLogDumpEvery(0)
+    , mPipeLogDumpErrors(true)
+    , mPipeLogDumpSize(256)
+    , mPipeLogCount(0)
 {
 
 }
 
 FPDev::~FPDev()
 {
-
+    stopWireOutWatcher();
 }
 
 int FPDev::loadFrontPanelLibrary(const char* path)
 {
     (void)path;
-    if (!okFrontPanelDLL_LoadLib(NULL))
+    if (!OkTransport::loadLibrary(mLibDate))
         return FPERR_LIBRARY_NOT_FOUND;
-    char dllDate[32], dllTime[32];
-    okFrontPanelDLL_GetVersion(dllDate, dllTime);
-    mLibDate = str::format("%s %s", dllDate, dllTime);
     return 0;
 }
 
 std::vector<std::string> FPDev::listDevices()
 {
-    std::vector<std::string> devs;
-    okCFrontPanel* fp = new okCFrontPanel();
-    int deviceCount = fp->GetDeviceCount();
-    for (int i = 0; i < deviceCount; i++)
-        devs.push_back(fp->GetDeviceListSerial(i));
-    delete fp;
-    return devs;
+    return OkTransport::listSerials();
 }
 
 std::vector<FPDevInfo> FPDev::listDevicesInfo()
 {
     std::vector<FPDevInfo> devs;
-    okCFrontPanel* fp = new okCFrontPanel();
-    int deviceCount = fp->GetDeviceCount();
-    for (int i = 0; i < deviceCount; i++){
+    for (const auto& serial : OkTransport::listSerials()){
         FPDevInfo info;
-        info.devSerial = fp->GetDeviceListSerial(i);
-
-        if (fp->OpenBySerial(info.devSerial) != okCFrontPanel::NoError)
-            continue;
-
-        okTDeviceInfo devInfo;
-        fp->GetDeviceInfo(&devInfo);
-        fp->Close();
-
-        info.deviceID = std::string(devInfo.deviceID);
-        devs.push_back(info);
+        info.devSerial = serial;
+        info.deviceID = deviceID(serial.c_str());
+        if (!info.deviceID.empty())
+            devs.push_back(info);
     }
-    delete fp;
     return devs;
 }
 
 std::string FPDev::deviceID(const char* serial)
 {
-    OpalKellyLegacy::okCFrontPanel* fp = new okCFrontPanel();
-    if (fp->OpenBySerial(std::string(serial)) != okCFrontPanel::NoError) {
-        delete fp;
+    OkTransport fp;
+    if (fp.openBySerial(std::string(serial)) != FP_NO_ERROR)
         return "";
-    }
 
-    okTDeviceInfo devInfo;
-    fp->GetDeviceInfo(&devInfo);
-    fp->Close();
-    delete fp;
+    FPTransportInfo devInfo;
+    fp.getDeviceInfo(devInfo);
+    fp.close();
     return devInfo.deviceID;
 }
 
-int FPDev::open(const char* serial, const char* firmwareFile)
+int FPDev::open(const char* serial, const char* firmwareFile, int flashIndex)
 {
+    std::lock_guard<FPDevMutex> devLock(mDevMutex);
     if (mFp){
         mLastError = "Cannot open: Device alraedy opened.";
         return FPERR_ALREADY_OPENED;
     }
 
-    mFp = new okCFrontPanel();
-    if (mFp->OpenBySerial(std::string(serial)) != okCFrontPanel::NoError) {
+    mOpenSerial = serial;
+    mFirmwareFile = firmwareFile ? firmwareFile : "";
+    mFlashIndex = flashIndex;
+    mOpenGeneration++;
+    mDownSinceNs = 0;
+    mWireInsValid = 0;
+    mRegisterWrites.clear();
+    return openDevice(serial, firmwareFile, flashIndex);
+}
+
+int FPDev::openDevice(const char* serial, const char* firmwareFile, int flashIndex)
+{
+    mFp = FPTransport::create(serial);
+    if (mFp->openBySerial(std::string(serial)) != FP_NO_ERROR) {
         delete mFp;
         mFp = NULL;
         mLastError = "Device could not be opened.";
         return FPERR_CANNOT_OPEN;
     }
 
-    okTDeviceInfo devInfo;
-    mFp->GetDeviceInfo(&devInfo);
-    mFpFirmwareVersion = str::format("Firmware %d.%d", devInfo.deviceMajorVersion, devInfo.deviceMinorVersion);
+    FPTransportInfo devInfo;
+    mFp->getDeviceInfo(devInfo);
+    mFpFirmwareVersion = str::format("Firmware %d.%d", devInfo.majorVersion, devInfo.minorVersion);
     mDeviceID = devInfo.deviceID;
-    mSerial = devInfo.serialNumber;
-    mIsUSB3Speed = devInfo.usbSpeed == OK_USBSPEED_SUPER;
+    mSerial = devInfo.serial;
+    mIsUSB3Speed = devInfo.usb3Speed;
+    mLink.boardModel = devInfo.boardModel;
+    mLink.boardModelId = devInfo.boardModelId;
+    mLink.deviceInterface = devInfo.deviceInterface;
+    mLink.usbSpeed = devInfo.usbSpeed;
+    mLink.hostInterfaceWidth = devInfo.hostInterfaceWidth;
+    mLink.highSpeed = devInfo.highSpeed;
+    mLink.usb3Speed = devInfo.usb3Speed;
+    mLink.frontPanel3Supported = devInfo.frontPanel3Supported;
+    selectTransferDefaults(mLink);
+    if (mUserBlockSize)
+        mLink.blockSize = mUserBlockSize;
+    if (mUserMaxChunkSize)
+        mLink.maxChunkSize = mUserMaxChunkSize;
+    mFlashLayout.sectorCount = devInfo.flashSectorCount;
+    mFlashLayout.sectorSize = devInfo.flashSectorSize;
+    mFlashLayout.pageSize = devInfo.flashPageSize;
+    mFlashLayout.minUserSector = devInfo.flashMinUserSector;
+    mFlashLayout.maxUserSector = devInfo.flashMaxUserSector;
 
-    mFp->LoadDefaultPLLConfiguration();
+    mFp->loadDefaultPLLConfiguration();
 
-    if (firmwareFile){
-        if (mFp->ConfigureFPGA(firmwareFile) != okCFrontPanel::NoError) {
-            mFp->Close();
+    // boot from flash first, the firmware file (if any) is used as a fallback
+    bool configured = false;
+    if (flashIndex >= 0)
+        configured = mFp->configureFPGAFromFlash(static_cast<u32>(flashIndex)) == FP_NO_ERROR;
+
+    if (!configured && firmwareFile && *firmwareFile){
+        if (mFp->configureFPGA(firmwareFile) != FP_NO_ERROR) {
+            mFp->close();
             delete mFp;
             mFp = NULL;
             mLastError = "FPG configuration failed.";
             return FPERR_FPG_CFG_FAILED;
         }
+    }else if (!configured && flashIndex >= 0){
+        mFp->close();
+        delete mFp;
+        mFp = NULL;
+        mLastError = "FPG configuration from flash failed.";
+        return FPERR_FPG_CFG_FAILED;
     }
 
-    if (!mFp->IsFrontPanelEnabled()){
-        mFp->Close();
+    if (!mFp->isFrontPanelEnabled()){
+        mFp->close();
         delete mFp;
         mFp = NULL;
         mLastError = "FrontPanel support is not enabled.";
         return FPERR_FP_NOT_ENABLED;
     }
 
+    // wire-ins not set by the user mirror the library's own copy
+    for (u32 i = 0; i < 32; i++)
+        if (!(mWireInsValid & (1u << i)))
+            mFp->getWireInValue(i, &mWireIns[i]);
+    mWireInsDirty = 0;
+    mWireOutsTimeNs = 0;
+
+    if (mRecorder){
+        mRecorder->writeInfo(mFp);
+        mFp = new RecordingTransport(mFp, mRecorder.get());
+    }
     return 0;
 }
 
 int FPDev::setTimeout(u32 timeout)
 {
-    mFp->SetTimeout((u32)timeout);
+    CHECK_CONNECTED;
+    mTimeout = static_cast<int>(timeout);
+    mFp->setTimeout((u32)timeout);
     return 0;
 }
 
 int FPDev::close()
 {
+    stopWireOutWatcher();
+    std::lock_guard<FPDevMutex> devLock(mDevMutex);
+    closeLocked();
+    return 0;
+}
+
+void FPDev::closeLocked()
+{
+    stopRecording();
+    closeDevice();
+    mOpenGeneration++;
+    mFlashLayout = FPFlashLayout();
+}
+
+void FPDev::closeDevice()
+{
+    mWireOutsTimeNs = 0;
     if (mFp){
-        mFp->Close();
+        mFp->close();
         delete mFp;
         mFp = NULL;
     }
-    return 0;
+}
+
+void FPDev::setAutoReconnect(bool enabled, u32 maxAttempts, u32 initialDelayMs, bool reconfigure)
+{
+    mAutoReconnect = enabled;
+    mReconnectAttempts = std::max(maxAttempts, 1u);
+    mReconnectDelayMs = initialDelayMs;
+    mReconnectReconfigure = reconfigure;
+}
+
+void FPDev::setRecordRegisterWrites(bool record)
+{
+    mRecordRegisterWrites = record;
+}
+
+void FPDev::clearRecordedRegisterWrites()
+{
+    mRegisterWrites.clear();
+}
+
+void FPDev::recordRegisterWrite(u32 address, u32 value)
+{
+    // keep only the last value of each register, in the order of the first write
+    for (auto& reg : mRegisterWrites){
+        if (reg.first == address){
+            reg.second = value;
+            return;
+        }
+    }
+    mRegisterWrites.emplace_back(address, value);
+}
+
+int FPDev::reconnect()
+{
+    std::lock_guard<FPDevMutex> devLock(mDevMutex);
+    if (mOpenSerial.empty()){
+        mLastError = "Cannot reconnect: device was never opened.";
+        return FPERR_CANNOT_OPEN;
+    }
+    if (mReconnecting){
+        mLastError = "Cannot reconnect: reconnect already in progress.";
+        return FPERR_CANNOT_OPEN;
+    }
+
+    // the downtime runs from the failure, or from now if the device was working
+    if (!mDownSinceNs)
+        mDownSinceNs = steadyNowNs();
+    u64 generation = mOpenGeneration;
+    std::string serial = mOpenSerial;
+    const char* firmware = mReconnectReconfigure ? mFirmwareFile.c_str() : NULL;
+    int flashIndex = mReconnectReconfigure ? mFlashIndex : -1;
+    u32 delayMs = mReconnectDelayMs;
+    int rc = FPERR_CANNOT_OPEN;
+
+    mReconnecting = true;
+    closeDevice();
+    for (u32 attempt = 0; attempt < mReconnectAttempts; attempt++){
+        if (attempt){
+            // the device is unlocked during the backoff, other threads get FPERR_NOT_CONNECTED
+            // meanwhile instead of waiting, or may close or reopen the device
+            u32 depth = mDevMutex.unlockAll();
+            std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+            mDevMutex.relock(depth);
+            delayMs = std::min(std::max(delayMs * 2, 1u), 1000u);
+            if (generation != mOpenGeneration || mFp){
+                mReconnecting = false;
+                mLastError = "Reconnect aborted: device was closed or reopened.";
+                return FPERR_ABORTED;
+            }
+        }
+        if ((rc = openDevice(serial.c_str(), firmware, flashIndex)) == 0)
+            break;
+    }
+
+    // restore the last known state of the device
+    if (rc == 0){
+        if (mTimeout >= 0)
+            mFp->setTimeout(mTimeout);
+        for (u32 i = 0; i < 32; i++)
+            if (mWireInsValid & (1u << i))
+                mFp->setWireInValue(i, mWireIns[i]);
+        if (mWireInsValid)
+            mFp->updateWireIns();
+        mWireInsDirty = 0;
+        for (const auto& reg : mRegisterWrites)
+            if ((rc = mFp->writeRegister(reg.first, reg.second)) != FP_NO_ERROR)
+                break;
+        if (rc){
+            closeDevice();
+            mLastError = "Reconnect failed: register replay failed.";
+        }
+    }
+    mReconnecting = false;
+
+    // a failed reconnect leaves the device down, the next one continues its downtime
+    i64 endNs = steadyNowNs();
+    mReconnectInfo.lastDowntimeUs = static_cast<u64>(endNs - mDownSinceNs) / 1000;
+    mReconnectInfo.totalDowntimeUs += static_cast<u64>(endNs - std::max(mDownSinceNs, mDowntimeCountedNs)) / 1000;
+    mDowntimeCountedNs = endNs;
+    if (rc == 0){
+        mReconnectInfo.reconnectCount++;
+        mDownSinceNs = 0;
+    }else
+        mReconnectInfo.failedReconnects++;
+    return rc;
+}
+
+template<typename T> T FPDev::checkFailure(T rc)
+{
+    if (rc != static_cast<T>(FP_FAILED) || mReconnecting)
+        return rc;
+
+    if ((mAutoReconnect || mCloseOnFailure) && !mDownSinceNs)
+        mDownSinceNs = steadyNowNs();
+    if (mAutoReconnect)
+        reconnect();
+    else if (mCloseOnFailure){
+        // the device lock is held and the watcher may be waiting for it, so the watcher is only
+        // told to stop here and joined by the next close or start
+        signalWireOutWatcher();
+        closeLocked();
+    }
+    return rc;
 }
 
 bool FPDev::isOpen() const
 {
+    std::lock_guard<FPDevMutex> devLock(mDevMutex);
     if (!mFp)
         return false;
-    return mFp->IsOpen();
+    return mFp->isOpen();
 }
 
 int FPDev::resetDevice()
 {
     CHECK_CONNECTED;
-    return mFp->ResetFPGA();
+    return mFp->resetFPGA();
 }
 
 std::string FPDev::getDeviceID() const
 {
+    std::lock_guard<FPDevMutex> devLock(mDevMutex);
     if (!mFp){
         mLastError = "Device not connected";
         return "";
     }
-    return mFp->GetDeviceID();
+    return mFp->getDeviceID();
 }
 
 void FPDev::setDeviceID(const char deviceID[32])
 {
+    std::lock_guard<FPDevMutex> devLock(mDevMutex);
     if (!mFp)
         mLastError = "Device not connected";
-    mFp->SetDeviceID(deviceID);
+    mFp->setDeviceID(deviceID);
 }
 
 int FPDev::setWireIn(u32 address, u32 value, bool sendNow)
+{
+    return setWireInBits(address, 0xFFFFFFFF, value, sendNow);
+}
+
+int FPDev::setWireInBits(u32 address, u32 mask, u32 value, bool sendNow)
+{
+    i64 startNs = steadyNowNs();
+    int rc = setWireInBitsImpl(address, mask, value, sendNow);
+    return opDone(FPOP_SET_WIRE_IN, address, rc ? 0 : 4, rc, startNs);
+}
+
+int FPDev::setWireInBitsImpl(u32 address, u32 mask, u32 value, bool sendNow)
 {
     CHECK_CONNECTED;
-    int rc = mFp->SetWireInValue(address, value);
-    if (rc == okCFrontPanel::Failed && mCloseOnFailure){
-        close();
-        return rc;
+    if (address >= 32){
+        mLastError = str::format("Invalid wire-in address 0x%02X.", address);
+        return FP_INVALID_ENDPOINT;
     }
-    if (sendNow)
-        mFp->UpdateWireIns();
-    return rc;
+
+    // only changed bits are passed to the library and marked for the next update
+    u32 newValue = (mWireIns[address] & ~mask) | (value & mask);
+    if (newValue != mWireIns[address]){
+        int rc = mFp->setWireInValue(address, value, mask);
+        if (rc != FP_NO_ERROR)
+            return checkFailure(rc);
+        mWireIns[address] = newValue;
+        mWireInsDirty |= 1u << address;
+    }
+    mWireInsValid |= 1u << address;
+
+    return sendNow ? updateWireIns() : 0;
+}
+
+int FPDev::updateWireIns(bool force)
+{
+    CHECK_CONNECTED;
+    if (mWireInsDirty || force){
+        mFp->updateWireIns();
+        mWireInsDirty = 0;
+    }
+    return 0;
+}
+
+i64 FPDev::getWireIn(u32 address) const
+{
+    std::lock_guard<FPDevMutex> devLock(mDevMutex);
+    if (address >= 32){
+        mLastError = str::format("Invalid wire-in address 0x%02X.", address);
+        return FP_INVALID_ENDPOINT;
+    }
+    return mWireIns[address];
 }
 
 i64 FPDev::getWireOut(u32 address, bool refreshWireOuts)
 {
+    return getWireOutCached(address, refreshWireOuts ? 0 : UINT64_MAX);
+}
+
+i64 FPDev::getWireOutCached(u32 address, u64 maxAgeUs)
+{
+    i64 startNs = steadyNowNs();
+    i64 rc = getWireOutCachedImpl(address, maxAgeUs);
+    return opDone(FPOP_GET_WIRE_OUT, address, rc < 0 ? 0 : 4, rc, startNs);
+}
+
+i64 FPDev::getWireOutCachedImpl(u32 address, u64 maxAgeUs)
+{
+    if (address < 0x20 || address > 0x3F){
+        mLastError = str::format("Invalid wire-out address 0x%02X.", address);
+        return FP_INVALID_ENDPOINT;
+    }
+
+    int rc = refreshWireOuts(maxAgeUs);
+    if (rc)
+        return rc;
+    return mWireOuts[address - 0x20].load(std::memory_order_relaxed);
+}
+
+u64 FPDev::wireOutsAgeUs() const
+{
+    i64 timeNs = mWireOutsTimeNs.load(std::memory_order_acquire);
+    return timeNs ? static_cast<u64>(steadyNowNs() - timeNs) / 1000 : UINT64_MAX;
+}
+
+int FPDev::refreshWireOuts(u64 maxAgeUs)
+{
+    i64 requestNs = steadyNowNs();
+    if (maxAgeUs && wireOutsAgeUs() <= maxAgeUs)
+        return 0;
+
     CHECK_CONNECTED;
-    if (refreshWireOuts)
-        mFp->UpdateWireOuts();
-    u32 value = static_cast<u32>(mFp->GetWireOutValue(address));
-    return value;
+
+    // a refresh started after this request has finished while we waited for the lock
+    i64 timeNs = mWireOutsTimeNs.load(std::memory_order_acquire);
+    if (timeNs >= requestNs || (maxAgeUs && wireOutsAgeUs() <= maxAgeUs))
+        return 0;
+
+    i64 startNs = steadyNowNs();
+    mFp->updateWireOuts();
+    for (u32 i = 0; i < 32; i++)
+        mWireOuts[i].store(static_cast<u32>(mFp->getWireOutValue(0x20 + i)), std::memory_order_relaxed);
+    mWireOutsTimeNs.store(startNs, std::memory_order_release);
+    return 0;
+}
+
+int FPDev::startWireOutWatcher(u32 periodUs, u32 addressMask, FPWireOutCallback callback, size_t queueSize)
+{
+    if (onWireOutWatcher()){
+        mLastError = "Wire-out watcher cannot be restarted from its callback.";
+        return FPERR_INVALID_ARGUMENT;
+    }
+    stopWireOutWatcher();
+
+    // the baseline is taken before returning, so that changes made right after the start are reported
+    std::array<u32, 32> baseline;
+    {
+        CHECK_CONNECTED;
+        int rc = refreshWireOuts(0);
+        if (rc)
+            return rc;
+        for (u32 i = 0; i < 32; i++)
+            baseline[i] = mWireOuts[i].load(std::memory_order_relaxed);
+    }
+
+    std::lock_guard<std::mutex> lock(mWatcherMutex);
+    mWatcherEvents.clear();
+    mWatcherCallback = callback;
+    mWatcherQueueSize = std::max(queueSize, (size_t)1);
+    mWatcherStop = false;
+    mWatcherDropped = 0;
+    mWatcherThread = std::thread(&FPDev::wireOutWatcherLoop, this, std::max(periodUs, 1u), addressMask, baseline);
+    return 0;
+}
+
+void FPDev::stopWireOutWatcher()
+{
+    signalWireOutWatcher();
+    // from the callback the thread ends once the callback returns, the next stop or start joins it
+    if (mWatcherThread.joinable() && !onWireOutWatcher())
+        mWatcherThread.join();
+}
+
+void FPDev::signalWireOutWatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mWatcherMutex);
+        mWatcherStop = true;
+    }
+    mWatcherCond.notify_all();
+}
+
+bool FPDev::onWireOutWatcher() const
+{
+    return mWatcherThread.get_id() == std::this_thread::get_id();
+}
+
+size_t FPDev::waitWireOutEvents(std::vector<FPWireOutEvent>& events, int timeoutMs, size_t maxEvents)
+{
+    std::unique_lock<std::mutex> lock(mWatcherMutex);
+    auto ready = [this]{ return !mWatcherEvents.empty() || mWatcherStop; };
+    if (timeoutMs < 0)
+        mWatcherCond.wait(lock, ready);
+    else
+        mWatcherCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), ready);
+
+    size_t count = maxEvents ? std::min(maxEvents, mWatcherEvents.size()) : mWatcherEvents.size();
+    events.insert(events.end(), mWatcherEvents.begin(), mWatcherEvents.begin() + count);
+    mWatcherEvents.erase(mWatcherEvents.begin(), mWatcherEvents.begin() + count);
+    return count;
+}
+
+void FPDev::wireOutWatcherLoop(u32 periodUs, u32 addressMask, std::array<u32, 32> previous)
+{
+    std::vector<FPWireOutEvent> events;
+    auto next = std::chrono::steady_clock::now();
+
+    while (true) {
+        next += std::chrono::microseconds(periodUs);
+        events.clear();
+
+        // force a new snapshot unless another reader has just refreshed it
+        if (refreshWireOuts(periodUs / 2) == 0){
+            u64 timestampUs = static_cast<u64>(mWireOutsTimeNs.load(std::memory_order_acquire)) / 1000;
+            for (u32 i = 0; i < 32; i++){
+                u32 value = mWireOuts[i].load(std::memory_order_relaxed);
+                if (value != previous[i] && (addressMask & (1u << i)))
+                    events.push_back({0x20 + i, previous[i], value, timestampUs});
+                previous[i] = value;
+            }
+        }
+
+        if (!events.empty() && mWatcherCallback)
+            mWatcherCallback(events);
+
+        std::unique_lock<std::mutex> lock(mWatcherMutex);
+        if (!events.empty() && !mWatcherCallback){
+            for (const auto& event : events){
+                if (mWatcherEvents.size() >= mWatcherQueueSize){
+                    mWatcherEvents.pop_front();
+                    mWatcherDropped++;
+                }
+                mWatcherEvents.push_back(event);
+            }
+            mWatcherCond.notify_all();
+        }
+
+        // do not try to catch up after a long stall
+        if (next < std::chrono::steady_clock::now())
+            next = std::chrono::steady_clock::now();
+        if (mWatcherCond.wait_until(lock, next, [this]{ return mWatcherStop; }))
+            break;
+    }
+}
+
+int FPDev::activateTriggerIn(u32 address, int bit)
+{
+    CHECK_CONNECTED;
+    return checkFailure(mFp->activateTriggerIn(address, bit));
+}
+
+int FPDev::updateTriggerOuts()
+{
+    CHECK_CONNECTED;
+    mFp->updateTriggerOuts();
+    return 0;
+}
+
+i64 FPDev::isTriggered(u32 address, u32 mask)
+{
+    CHECK_CONNECTED;
+    return mFp->isTriggered(address, mask) ? 1 : 0;
 }
 
 int FPDev::writeRegister(u32 address, u32 value)
+{
+    i64 startNs = steadyNowNs();
+    int rc = writeRegisterImpl(address, value);
+    return opDone(FPOP_WRITE_REGISTER, address, rc ? 0 : 4, rc, startNs);
+}
+
+int FPDev::writeRegisterImpl(u32 address, u32 value)
 {
     CHECK_CONNECTED;
-    int rc = mFp->WriteRegister(address, value);
-    if (rc == okCFrontPanel::Failed && mCloseOnFailure)
-        close();
-    return rc;
+    int rc = mFp->writeRegister(address, value);
+    if (rc == FP_NO_ERROR && mRecordRegisterWrites)
+        recordRegisterWrite(address, value);
+    return checkFailure(rc);
 }
 
 i64 FPDev::readRegister(u32 address)
+{
+    i64 startNs = steadyNowNs();
+    i64 rc = readRegisterImpl(address);
+    return opDone(FPOP_READ_REGISTER, address, rc < 0 ? 0 : 4, rc, startNs);
+}
+
+i64 FPDev::readRegisterImpl(u32 address)
 {
     CHECK_CONNECTED;
     u32 value = 0;
-    int rc = mFp->ReadRegister(address, &value);
-    if (rc == okCFrontPanel::Failed && mCloseOnFailure)
-        close();
+    int rc = checkFailure<int>(mFp->readRegister(address, &value));
     return rc ? static_cast<i64>(rc) : static_cast<i64>(value);
 }
 
-int FPDev::writePipe(u32 address, byte* data, size_t size, size_t blockSize)
+i64 FPDev::writePipe(u32 address, byte* data, size_t size, size_t blockSize)
+{
+    i64 startNs = steadyNowNs();
+    i64 rc = writePipeImpl(address, data, size, blockSize);
+    opDone(FPOP_WRITE_PIPE, address, rc < 0 ? 0 : rc, rc, startNs, size);
+    if (mPipeLog.load(std::memory_order_relaxed))
+        logPipe(FPOP_WRITE_PIPE, address, data, size, rc, startNs);
+    return rc;
+}
+
+i64 FPDev::writePipeImpl(u32 address, byte* data, size_t size, size_t blockSize)
 {
     CHECK_CONNECTED;
-    int rc = 0;
+    if (blockSize == 0)
+        blockSize = mLink.blockSize;
+
+    size_t chunkSize = pipeChunkSize(blockSize);
+    if (size <= chunkSize)
+        return checkFailure(writePipeBlocks(address, data, size, blockSize));
+
+    i64 written = 0;
+    for (size_t offset = 0; offset < size; offset += chunkSize){
+        i64 rc = writePipeBlocks(address, data + offset, std::min(chunkSize, size - offset), blockSize);
+        if (rc < 0)
+            return checkFailure(rc);
+        written += rc;
+    }
+    return written;
+}
+
+i64 FPDev::writePipeBlocks(u32 address, byte* data, size_t size, size_t blockSize)
+{
     if (size % blockSize != 0){
-        u32 writeSize = (u32)(ceil(size / (double)blockSize) * blockSize);
-        writeSize = std::max((u32)blockSize, writeSize);
-        Buffer<byte> buff(writeSize);
+        size_t writeSize = (size_t)(ceil(size / (double)blockSize) * blockSize);
+        writeSize = std::max((size_t)blockSize, writeSize);
+        Buffer<byte> buff = BufferPool::global().lease<byte>(writeSize);
         memcpy(buff.data(), data, size);
-        rc = static_cast<int>(mFp->WriteToBlockPipeIn(address, static_cast<u32>(blockSize), writeSize, buff.data()));
-    }else
-        rc = static_cast<int>(mFp->WriteToBlockPipeIn(address, static_cast<u32>(blockSize), (long)size, data));
+        memset(buff.data() + size, 0, writeSize - size);
+        return mFp->writeToBlockPipeIn(address, static_cast<u32>(blockSize), (long)writeSize, buff.data());
+    }
+    return mFp->writeToBlockPipeIn(address, static_cast<u32>(blockSize), (long)size, data);
+}
 
-    if (rc == okCFrontPanel::Failed && mCloseOnFailure)
-        close();
+i64 FPDev::readPipe(u32 address, byte* data, size_t size, size_t blockSize)
+{
+    i64 startNs = steadyNowNs();
+    i64 rc = readPipeImpl(address, data, size, blockSize);
+    opDone(FPOP_READ_PIPE, address, rc < 0 ? 0 : rc, rc, startNs, size);
+    if (mPipeLog.load(std::memory_order_relaxed))
+        logPipe(FPOP_READ_PIPE, address, data, size, rc, startNs);
     return rc;
 }
 
-i64 FPDev::readPipe(u32 address, byte* data, size_t size, size_t blockSize)
+i64 FPDev::readPipeImpl(u32 address, byte* data, size_t size, size_t blockSize)
 {
     CHECK_CONNECTED;
+    if (blockSize == 0)
+        blockSize = mLink.blockSize;
+
+    size_t chunkSize = pipeChunkSize(blockSize);
+    if (size <= chunkSize)
+        return checkFailure(readPipeBlocks(address, data, size, blockSize));
+
+    i64 read = 0;
+    for (size_t offset = 0; offset < size; offset += chunkSize){
+        size_t length = std::min(chunkSize, size - offset);
+        i64 rc = readPipeBlocks(address, data + offset, length, blockSize);
+        if (rc < 0)
+            return checkFailure(rc);
+        read += rc;
+        if (rc < static_cast<i64>(length))
+            break;
+    }
+    return read;
+}
+
+i64 FPDev::readPipeBlocks(u32 address, byte* data, size_t size, size_t blockSize)
+{
     i64 rc = 0;
     if (size % blockSize != 0){
         size_t readSize = (size_t)(ceil(size / (double)blockSize) * blockSize);
         readSize = std::max((size_t)blockSize, readSize);
-        Buffer<byte> buff(readSize);
-        rc = static_cast<i64>(mFp->ReadFromBlockPipeOut(address, static_cast<int>(blockSize), static_cast<long>(readSize), buff.data()));
+        Buffer<byte> buff = BufferPool::global().lease<byte>(readSize);
+        rc = static_cast<i64>(mFp->readFromBlockPipeOut(address, static_cast<int>(blockSize), static_cast<long>(readSize), buff.data()));
         if (rc == static_cast<i64>(readSize)){
             memcpy(data, buff.data(), size);
             rc = size;
         }
     }else
-        rc = static_cast<i64>(mFp->ReadFromBlockPipeOut(address, static_cast<int>(blockSize), (long)size, data));
+        rc = static_cast<i64>(mFp->readFromBlockPipeOut(address, static_cast<int>(blockSize), (long)size, data));
+    return rc;
+}
+
+size_t FPDev::pipeChunkSize(size_t blockSize) const
+{
+    size_t chunkSize = mLink.maxChunkSize ? mLink.maxChunkSize : SIZE_MAX;
+    return std::max(chunkSize - chunkSize % blockSize, blockSize);
+}
+
+void FPDev::setTransferDefaults(size_t blockSize, size_t maxChunkSize)
+{
+    std::lock_guard<FPDevMutex> devLock(mDevMutex);
+    mUserBlockSize = blockSize;
+    mUserMaxChunkSize = maxChunkSize;
+    selectTransferDefaults(mLink);
+    if (mUserBlockSize)
+        mLink.blockSize = mUserBlockSize;
+    if (mUserMaxChunkSize)
+        mLink.maxChunkSize = mUserMaxChunkSize;
+}
+
+FPLinkProfile FPDev::linkProfile() const
+{
+    std::lock_guard<FPDevMutex> devLock(mDevMutex);
+    return mLink;
+}
+
+void FPDev::selectTransferDefaults(FPLinkProfile& link)
+{
+    // the implicit block size stays 1024: shorter transfers are padded to a whole block, so a
+    // larger default would inflate every small pipe write. The largest block size the link
+    // supports is only reported, callers streaming long aligned transfers select it explicitly.
+    // chunk: long enough to hide the per-call overhead, short enough to keep the latency of
+    // a single call in the range of tens of ms
+    link.blockSize = 1024;
+    if (link.deviceInterface == FP_INTERFACE_PCIE){
+        link.linkBlockSize = 1024;
+        link.maxChunkSize = 16 * 1024 * 1024;
+    }else if (link.usbSpeed == FP_USBSPEED_SUPER || link.usb3Speed){
+        link.linkBlockSize = 16384;
+        link.maxChunkSize = 16 * 1024 * 1024;
+    }else if (link.usbSpeed == FP_USBSPEED_FULL){
+        link.linkBlockSize = 64;
+        link.maxChunkSize = 64 * 1024;
+    }else{
+        link.linkBlockSize = 1024;
+        link.maxChunkSize = 4 * 1024 * 1024;
+    }
+}
+
+
+//################################################################################
+//                      FLASH
+//################################################################################
+
+int FPDev::checkFlashRange(u32 address, size_t size, u32 alignment)
+{
+    if (mFlashLayout.sectorSize == 0 || mFlashLayout.pageSize == 0){
+        mLastError = "Device does not have a user flash.";
+        return FPERR_INVALID_ARGUMENT;
+    }
+
+    u64 userStart = static_cast<u64>(mFlashLayout.minUserSector) * mFlashLayout.sectorSize;
+    u64 userEnd = static_cast<u64>(mFlashLayout.maxUserSector + 1) * mFlashLayout.sectorSize;
+    if (address < userStart || address + static_cast<u64>(size) > userEnd){
+        mLastError = str::format("Flash range 0x%08X-0x%08X is outside of the user area.", address, (u32)(address + size));
+        return FPERR_INVALID_ARGUMENT;
+    }
+
+    if (alignment && address % alignment != 0){
+        mLastError = str::format("Flash address 0x%08X is not aligned to %u bytes.", address, alignment);
+        return FPERR_INVALID_ARGUMENT;
+    }
+    return 0;
+}
+
+int FPDev::flashEraseSector(u32 address)
+{
+    CHECK_CONNECTED;
+    int rc = checkFlashRange(address, mFlashLayout.sectorSize, mFlashLayout.sectorSize);
+    if (rc)
+        return rc;
+
+    rc = mFp->flashEraseSector(address);
+    return checkFailure(rc);
+}
+
+int FPDev::flashWrite(u32 address, const byte* data, size_t size)
+{
+    CHECK_CONNECTED;
+    int rc = checkFlashRange(address, size, mFlashLayout.pageSize);
+    if (rc)
+        return rc;
+
+    // write sector sized chunks, the last partial page is padded with erased (0xFF) bytes
+    const u32 sectorSize = mFlashLayout.sectorSize;
+    const u32 pageSize = mFlashLayout.pageSize;
+    for (size_t done = 0; done < size && !rc; ){
+        u32 addr = address + static_cast<u32>(done);
+        size_t len = std::min(size - done, static_cast<size_t>(sectorSize - addr % sectorSize));
+        if (len % pageSize != 0){
+            Buffer<byte> buff((len / pageSize + 1) * pageSize, BUFFER_INIT_NONE);
+            memcpy(buff.data(), data + done, len);
+            memset(buff.data() + len, 0xFF, buff.size() - len);
+            rc = mFp->flashWrite(addr, static_cast<u32>(buff.size()), buff.data());
+        }else
+            rc = mFp->flashWrite(addr, static_cast<u32>(len), data + done);
+        done += len;
+    }
+
+    return checkFailure(rc);
+}
+
+int FPDev::flashRead(u32 address, byte* data, size_t size)
+{
+    CHECK_CONNECTED;
+    int rc = checkFlashRange(address, size, 0);
+    if (rc)
+        return rc;
+
+    const u32 sectorSize = mFlashLayout.sectorSize;
+    for (size_t done = 0; done < size && !rc; ){
+        u32 addr = address + static_cast<u32>(done);
+        size_t len = std::min(size - done, static_cast<size_t>(sectorSize - addr % sectorSize));
+        rc = mFp->flashRead(addr, static_cast<u32>(len), data + done);
+        done += len;
+    }
+
+    return checkFailure(rc);
+}
+
+int FPDev::flashProgram(u32 address, const byte* data, size_t size, bool verify, FPFlashProgress progress)
+{
+    u32 sectorSize = 0;
+    {
+        CHECK_CONNECTED;
+        int rc = checkFlashRange(address, size, mFlashLayout.sectorSize);
+        if (rc)
+            return rc;
+        sectorSize = mFlashLayout.sectorSize;
+    }
+
+    // erase, write and read back one sector at a time. The device is locked only for a sector,
+    // the progress callback runs unlocked, so it can wait for other threads using the device.
+    Buffer<byte> readBack(verify ? sectorSize : 0, BUFFER_INIT_NONE);
+    if (progress && !progress(0, size)){
+        mLastError = "Flash programming aborted.";
+        return FPERR_ABORTED;
+    }
 
-    if (rc == (i64)okCFrontPanel::Failed && mCloseOnFailure)
-        close();
+    for (size_t done = 0; done < size; ){
+        u32 addr = address + static_cast<u32>(done);
+        size_t len = std::min(size - done, static_cast<size_t>(sectorSize));
+        {
+            std::lock_guard<FPDevMutex> devLock(mDevMutex);
+            int rc = flashEraseSector(addr);
+            if (rc)
+                return rc;
+            if ((rc = flashWrite(addr, data + done, len)) != 0)
+                return rc;
+
+            if (verify){
+                if ((rc = flashRead(addr, readBack.data(), len)) != 0)
+                    return rc;
+                if (memcmp(readBack.data(), data + done, len) != 0){
+                    mLastError = str::format("Flash verification failed in sector at 0x%08X.", addr);
+                    return FPERR_FLASH_VERIFY;
+                }
+            }
+        }
+
+        done += len;
+        if (progress && !progress(done, size)){
+            mLastError = "Flash programming aborted.";
+            return FPERR_ABORTED;
+        }
+    }
+    return 0;
+}
+
+int FPDev::configureFromFlash(u32 configIndex)
+{
+    CHECK_CONNECTED;
+    int rc = mFp->configureFPGAFromFlash(configIndex);
+    if (rc != FP_NO_ERROR)
+        mLastError = "FPG configuration from flash failed.";
+    return checkFailure(rc);
+}
+
+//################################################################################
+//                      STATISTICS
+//################################################################################
+
+template<typename T> T FPDev::opDone(FPOpType op, u32 address, i64 bytes, T rc, i64 startNs, size_t requested)
+{
+    i64 endNs = steadyNowNs();
+    if (mStatsEnabled.load(std::memory_order_relaxed)){
+        mStats->record(op, address, static_cast<u64>(bytes), rc, static_cast<u64>(endNs - startNs));
+        if (requested)
+            mMonitor->record(address, requested, rc, startNs, endNs);
+    }
+    if (mTracer->isRunning())
+        mTracer->record(op, address, static_cast<u64>(bytes), rc, startNs, endNs);
     return rc;
 }
 
+void FPDev::setStatsEnabled(bool enabled)
+{
+    mStatsEnabled = enabled;
+}
 
+void FPDev::resetStats()
+{
+    mStats->reset();
+    mMonitor->reset();
+}
+
+bool FPDev::pipeMonitor(u32 address, FPPipeMonitorStats& stats) const
+{
+    return mMonitor->read(address, steadyNowNs(), stats);
+}
+
+//################################################################################
+//                      TRACE
+//################################################################################
+
+void FPDev::startTrace(size_t eventsPerThread, size_t maxThreads)
+{
+    mTracer->start(steadyNowNs(), eventsPerThread, maxThreads);
+}
+
+void FPDev::stopTrace()
+{
+    mTracer->stop();
+}
+
+i64 FPDev::dumpTrace(const char* fileName) const
+{
+    i64 rc = mTracer->dump(fileName);
+    if (rc < 0)
+        mLastError = str::format("Cannot write trace file %s.", fileName);
+    return rc;
+}
+
+//################################################################################
+//                      PIPE LOG
+//################################################################################
+
+void FPDev::setPipeLog(FileLog* log, u32 dumpEvery, bool dumpErrors, size_t dumpSize)
+{
+    std::lock_guard<std::mutex> lock(mPipeLogMutex);
+    mPipeLogDumpEvery = dumpEvery;
+    mPipeLogDumpErrors = dumpErrors;
+    mPipeLogDumpSize = dumpSize;
+    mPipeLogCount = 0;
+    mPipeLog = log;
+}
+
+void FPDev::logPipe(FPOpType op, u32 address, const byte* data, size_t size, i64 rc, i64 startNs)
+{
+    i64 endNs = steadyNowNs();
+    // the checksum covers what was sent to or received from the device: the whole payload of
+    // a write, the bytes actually read of a read
+    bool isWrite = op == FPOP_WRITE_PIPE;
+    size_t length = isWrite ? size : static_cast<size_t>(std::max<i64>(rc, 0));
+    u32 crc = Crc32c::compute(data, length);
+
+    std::lock_guard<std::mutex> lock(mPipeLogMutex);
+    FileLog* log = mPipeLog;
+    if (!log)
+        return;
+    u64 index = mPipeLogCount++;
+    LogLevel level = rc < 0 ? LOG_ERR : LOG_MSG;
+    FILELOG(*log, level, "Pipe %s 0x%02X #%llu: size %zu, rc %lld, %.1f us, crc32c %08X", isWrite ? "write" : "read",
+            address, static_cast<unsigned long long>(index), size, static_cast<long long>(rc),
+            (endNs - startNs) / 1000.0, crc);
+    bool dump = (mPipeLogDumpEvery && index % mPipeLogDumpEvery == 0) || (rc < 0 && mPipeLogDumpErrors);
+    if (dump && length && mPipeLogDumpSize && level <= FILELOG_MIN_LEVEL)
+        log->logBuffer(level, reinterpret_cast<char*>(const_cast<byte*>(data)), std::min(length, mPipeLogDumpSize),
+                       str::format("Pipe %s 0x%02X #%llu data:", isWrite ? "write" : "read", address,
+                                   static_cast<unsigned long long>(index)).c_str());
+}
+
+//################################################################################
+//                      SESSION RECORDING
+//################################################################################
+
+int FPDev::startRecording(const char* fileName, bool pipeInData)
+{
+    CHECK_CONNECTED;
+    stopRecording();
+    std::unique_ptr<FPSessionRecorder> recorder(new FPSessionRecorder());
+    if (!recorder->open(fileName, pipeInData)){
+        mLastError = str::format("Cannot create session file %s.", fileName);
+        return FPERR_FILE;
+    }
+    mRecorder = std::move(recorder);
+    mRecorder->writeInfo(mFp);
+    mFp = new RecordingTransport(mFp, mRecorder.get());
+    return 0;
+}
+
+i64 FPDev::stopRecording()
+{
+    std::lock_guard<FPDevMutex> devLock(mDevMutex);
+    if (!mRecorder)
+        return 0;
+    if (mFp){
+        RecordingTransport* recording = static_cast<RecordingTransport*>(mFp);
+        mFp = recording->release();
+        delete recording;
+    }
+    i64 records = static_cast<i64>(mRecorder->records());
+    mRecorder.reset();
+    return records;
+}
@@ -21,9 +21,22 @@ SOFTWARE.
 */
 #ifndef FPDEV_H
 #define FPDEV_H
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include "common.h"
+#include "fpmonitor.h"
+#include "fpsession.h"
+#include "fpstats.h"
+#include "fptrace.h"
+#include "fptransport.h"
 
 #define FPERR_LIBRARY_NOT_FOUND  -100
 #define FPERR_ALREADY_OPENED     -101
@@ -31,16 +44,97 @@ SOFTWARE.
 #define FPERR_FPG_CFG_FAILED     -103
 #define FPERR_FP_NOT_ENABLED     -104
 #define FPERR_NOT_CONNECTED      -105
-
-namespace OpalKellyLegacy{
-class okCFrontPanel;
-}
+#define FPERR_FLASH_VERIFY       -106
+#define FPERR_INVALID_ARGUMENT   -107
+#define FPERR_ABORTED            -108
+#define FPERR_FILE               -109
 
 struct FPDevInfo {
     std::string devSerial;
     std::string deviceID;
 };
 
+/// Layout of the user accessible part of the system flash
+struct FPFlashLayout {
+    u32 sectorCount;
+    u32 sectorSize;
+    u32 pageSize;
+    u32 minUserSector;
+    u32 maxUserSector;
+};
+
+/// Link capabilities probed at open and the transfer defaults selected for them
+struct FPLinkProfile {
+    std::string boardModel;
+    int boardModelId;
+    int deviceInterface;        // FP_INTERFACE_*
+    int usbSpeed;               // FP_USBSPEED_*
+    int hostInterfaceWidth;     // bits
+    bool highSpeed;
+    bool usb3Speed;
+    bool frontPanel3Supported;
+    size_t blockSize;           // default pipe block size
+    size_t linkBlockSize;       // largest block size of the link, opt in with setTransferDefaults
+    size_t maxChunkSize;        // longest single pipe transfer, longer transfers are split
+};
+
+/// Reconnection statistics of the auto reconnect mode
+struct FPReconnectInfo {
+    u32 reconnectCount;
+    u32 failedReconnects;
+    u64 totalDowntimeUs;
+    u64 lastDowntimeUs;
+};
+
+/// Change of a wire-out value detected by the wire-out watcher
+struct FPWireOutEvent {
+    u32 address;
+    u32 oldValue;
+    u32 newValue;
+    u64 timestampUs;    // steady (monotonic) clock
+};
+
+/// Batched delivery of wire-out changes, called from the watcher thread. It may stop the watcher
+/// or close the device, but must not restart the watcher or destroy the device.
+typedef std::function<void(const std::vector<FPWireOutEvent>&)> FPWireOutCallback;
+
+/// Flash programming progress: (bytes done, bytes total). Return false to abort.
+typedef std::function<bool(size_t, size_t)> FPFlashProgress;
+
+class FileLog;
+
+/// Recursive mutex of the device. The owning thread can release it completely for a while,
+/// however many times it has locked it, e.g. to sleep between reconnect attempts.
+class FPDevMutex
+{
+public:
+    FPDevMutex() : mDepth(0) {}
+    void lock() { mMutex.lock(); mDepth++; }
+    bool try_lock() { if (!mMutex.try_lock()) return false; mDepth++; return true; }
+    void unlock() { mDepth--; mMutex.unlock(); }
+
+    /// Releases all locks of the owning thread, returns their number for relock()
+    u32 unlockAll()
+    {
+        u32 depth = mDepth;
+        mDepth = 0;
+        for (u32 i = 0; i < depth; i++)
+            mMutex.unlock();
+        return depth;
+    }
+
+    void relock(u32 depth)
+    {
+        for (u32 i = 0; i < depth; i++)
+            mMutex.lock();
+        mDepth = depth;
+    }
+
+private:
+    std::recursive_mutex mMutex;
+    u32 mDepth;     // lock count of the owning thread, changed only with the mutex held
+};
+
 class FPDev
 {
 public:
@@ -52,37 +146,156 @@ public:
     static std::string deviceID(const char* serial);
 
 public:
-    int open(const char* serial, const char* firmwareFile);
+    int open(const char* serial, const char* firmwareFile, int flashIndex=-1);
     int close();
     bool isOpen() const;
     std::string getDeviceID() const;
     void setDeviceID(const char deviceID[32]);
     void setCloseOnFailure(bool closeOnFailure) { mCloseOnFailure = closeOnFailure; }
+    void setAutoReconnect(bool enabled, u32 maxAttempts=5, u32 initialDelayMs=10, bool reconfigure=false);
+    void setRecordRegisterWrites(bool record);
+    void clearRecordedRegisterWrites();
+    int reconnect();
     int resetDevice();
     int setWireIn(u32 address, u32 value, bool sendNow=true);
+    int setWireInBits(u32 address, u32 mask, u32 value, bool sendNow=true);
+    int updateWireIns(bool force=false);
+    i64 getWireIn(u32 address) const;
     i64 getWireOut(u32 address, bool refreshWireOuts=true);
+    i64 getWireOutCached(u32 address, u64 maxAgeUs);
+    int refreshWireOuts(u64 maxAgeUs=0);
+    u64 wireOutsAgeUs() const;
+    int startWireOutWatcher(u32 periodUs, u32 addressMask=0xFFFFFFFF, FPWireOutCallback callback=nullptr, size_t queueSize=4096);
+    void stopWireOutWatcher();
+    size_t waitWireOutEvents(std::vector<FPWireOutEvent>& events, int timeoutMs, size_t maxEvents=0);
+    u64 droppedWireOutEvents() const { return mWatcherDropped; }
+    int activateTriggerIn(u32 address, int bit);
+    int updateTriggerOuts();
+    i64 isTriggered(u32 address, u32 mask);
     int writeRegister(u32 address, u32 value);
     i64 readRegister(u32 address);
-    int writePipe(u32 address, byte* data, size_t size, size_t blockSize=1024);
-    i64 readPipe(u32 address, byte* data, size_t size, size_t blockSize=1024);
+    i64 writePipe(u32 address, byte* data, size_t size, size_t blockSize=0);
+    i64 readPipe(u32 address, byte* data, size_t size, size_t blockSize=0);
+    void setTransferDefaults(size_t blockSize, size_t maxChunkSize);
     int setTimeout(u32 timeout);
 
+public:
+    int flashEraseSector(u32 address);
+    int flashWrite(u32 address, const byte* data, size_t size);
+    int flashRead(u32 address, byte* data, size_t size);
+    int flashProgram(u32 address, const byte* data, size_t size, bool verify=true, FPFlashProgress progress=nullptr);
+    int configureFromFlash(u32 configIndex);
+
 public:
     static std::string libraryDate() { return mLibDate; }
     std::string serial() const { return mSerial; }
     std::string deviceID() const { return mDeviceID; }
     std::string fpFirmwareVersion() const { return mFpFirmwareVersion; }
     bool isUSB3Speed() const { return mIsUSB3Speed; }
+    FPFlashLayout flashLayout() const { return mFlashLayout; }
+    FPLinkProfile linkProfile() const;
     std::string lastError() const { return mLastError; }
+    FPReconnectInfo reconnectInfo() const { return mReconnectInfo; }
+    const FPStats& stats() const { return *mStats; }
+    void resetStats();
+    void setStatsEnabled(bool enabled);
+    bool pipeMonitor(u32 address, FPPipeMonitorStats& stats) const;
+    void setMonitorTimeConstant(double seconds) { mMonitor->setTimeConstant(seconds); }
+    void startTrace(size_t eventsPerThread=65536, size_t maxThreads=16);
+    void stopTrace();
+    i64 dumpTrace(const char* fileName) const;
+    void setPipeLog(FileLog* log, u32 dumpEvery=0, bool dumpErrors=true, size_t dumpSize=256);
+
+public:
+    int startRecording(const char* fileName, bool pipeInData=false);
+    i64 stopRecording();
+    bool isRecording() const { return mRecorder != nullptr; }
+
+private:
+    int openDevice(const char* serial, const char* firmwareFile, int flashIndex);
+    void closeDevice();
+    void closeLocked();
+    template<typename T> T checkFailure(T rc);
+    template<typename T> T opDone(FPOpType op, u32 address, i64 bytes, T rc, i64 startNs, size_t requested=0);
+    int setWireInBitsImpl(u32 address, u32 mask, u32 value, bool sendNow);
+    i64 getWireOutCachedImpl(u32 address, u64 maxAgeUs);
+    int writeRegisterImpl(u32 address, u32 value);
+    i64 readRegisterImpl(u32 address);
+    i64 writePipeImpl(u32 address, byte* data, size_t size, size_t blockSize);
+    i64 readPipeImpl(u32 address, byte* data, size_t size, size_t blockSize);
+    i64 writePipeBlocks(u32 address, byte* data, size_t size, size_t blockSize);
+    i64 readPipeBlocks(u32 address, byte* data, size_t size, size_t blockSize);
+    size_t pipeChunkSize(size_t blockSize) const;
+    static void selectTransferDefaults(FPLinkProfile& link);
+    void recordRegisterWrite(u32 address, u32 value);
+    void logPipe(FPOpType op, u32 address, const byte* data, size_t size, i64 rc, i64 startNs);
+    int checkFlashRange(u32 address, size_t size, u32 alignment);
 
 private:
     static std::string mLibDate;
-    OpalKellyLegacy::okCFrontPanel* mFp;
+    FPTransport* mFp;
+    mutable FPDevMutex mDevMutex;               // serializes all library calls
     std::string mFpFirmwareVersion;
     std::string mSerial;
     std::string mDeviceID;
     bool mIsUSB3Speed;
     bool mCloseOnFailure;
+    FPFlashLayout mFlashLayout;
+    FPLinkProfile mLink;
+    size_t mUserBlockSize;      // transfer defaults set by the user, 0 for the link default
+    size_t mUserMaxChunkSize;
+
+    // state needed to reopen the device and restore it after a failure
+    std::string mOpenSerial;
+    std::string mFirmwareFile;
+    int mFlashIndex;
+    int mTimeout;
+    bool mAutoReconnect;
+    bool mReconnectReconfigure;
+    bool mReconnecting;
+    u32 mReconnectAttempts;
+    u32 mReconnectDelayMs;
+    FPReconnectInfo mReconnectInfo;
+    u64 mOpenGeneration;    // incremented by open() and close(), a reconnect stops when it changes
+    i64 mDownSinceNs;       // time of the failure that the device has not recovered from yet, 0 if none
+    i64 mDowntimeCountedNs; // end of the downtime already added to totalDowntimeUs
+    u32 mWireIns[32];       // shadow of all wire-ins
+    u32 mWireInsValid;      // wire-ins set by the user (replayed after reconnect)
+    u32 mWireInsDirty;      // wire-ins changed since the last UpdateWireIns
+    bool mRecordRegisterWrites;
+
+    // last wire-out snapshot (0x20-0x3F), refreshes are serialized and coalesced
+    std::atomic<u32> mWireOuts[32];
+    std::atomic<i64> mWireOutsTimeNs;
+
+    // background wire-out watcher
+    void wireOutWatcherLoop(u32 periodUs, u32 addressMask, std::array<u32, 32> baseline);
+    void signalWireOutWatcher();
+    bool onWireOutWatcher() const;
+    std::thread mWatcherThread;
+    std::mutex mWatcherMutex;
+    std::condition_variable mWatcherCond;
+    std::deque<FPWireOutEvent> mWatcherEvents;
+    FPWireOutCallback mWatcherCallback;
+    size_t mWatcherQueueSize;
+    bool mWatcherStop;
+    std::atomic<u64> mWatcherDropped;
+
+    std::unique_ptr<FPStats> mStats;
+    std::unique_ptr<FPPipeMonitor> mMonitor;
+    std::atomic<bool> mStatsEnabled;
+    std::unique_ptr<FPTracer> mTracer;
+
+    // sampled pipe logging: a line with the CRC-32C of every transfer, hex dumps of some of them
+    std::mutex mPipeLogMutex;
+    std::atomic<FileLog*> mPipeLog;
+    u32 mPipeLogDumpEvery;
+    bool mPipeLogDumpErrors;
+    size_t mPipeLogDumpSize;
+    u64 mPipeLogCount;
+
+    std::unique_ptr<FPSessionRecorder> mRecorder;   // session recording, mFp is wrapped by a RecordingTransport
+    std::vector<std::pair<u32, u32>> mRegisterWrites;
     mutable std::string mLastError;
 };
 
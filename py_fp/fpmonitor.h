@@ -0,0 +1,176 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef FPMONITOR_H
+#define FPMONITOR_H
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include "common.h"
+#include "fptransport.h"
+
+#define FPMONITOR_ENDPOINTS     64  // pipe-ins 0x80-0x9F, pipe-outs 0xA0-0xBF (address & 0x3F)
+
+/// Snapshot of the health of one pipe endpoint
+struct FPPipeMonitorStats {
+    double bandwidth;       // exponentially weighted moving average in bytes/s
+    u64 transfers;
+    u64 bytes;
+    u64 shortReads;         // reads that returned less data than requested
+    u64 timeouts;
+    u64 fifoOverflows;
+    u64 fifoUnderflows;
+    i64 lastNs;             // end of the last transfer (steady clock)
+};
+
+/// Live bandwidth and FIFO health of the pipe endpoints. Every endpoint is protected
+/// by a seqlock: writers serialize on the sequence number, readers never lock and
+/// retry only when they raced a writer.
+class FPPipeMonitor
+{
+public:
+    FPPipeMonitor(double timeConstantSec = 1.0)
+        : mTauNs(timeConstantSec * 1e9)
+    {
+        reset();
+    }
+
+    /// Time constant of the moving average, a transfer older than that weights e^-1
+    void setTimeConstant(double seconds)    { mTauNs = std::max(seconds, 1e-6) * 1e9; }
+    double timeConstant() const             { return mTauNs / 1e9; }
+
+    void record(u32 address, u64 requested, i64 rc, i64 beginNs, i64 endNs)
+    {
+        Slot& slot = mSlots[address % FPMONITOR_ENDPOINTS];
+        u32 seq = lock(slot);
+
+        double tau = mTauNs;
+        double bandwidth = slot.bandwidth.load(std::memory_order_relaxed);
+        i64 lastNs = slot.lastNs.load(std::memory_order_relaxed);
+        if (lastNs == 0)
+            bandwidth = rc > 0 ? rc * 1e9 / std::max<double>(static_cast<double>(endNs - beginNs), 1) : 0;
+        else {
+            // irregular time series EWMA: the interval since the last transfer moved rc bytes
+            double dt = std::max<double>(static_cast<double>(endNs - lastNs), 1);
+            double decay = std::exp(-dt / tau);
+            bandwidth = (1 - decay) * (rc > 0 ? rc * 1e9 / dt : 0) + decay * bandwidth;
+        }
+        slot.bandwidth.store(bandwidth, std::memory_order_relaxed);
+        slot.lastNs.store(std::max(endNs, lastNs), std::memory_order_relaxed);
+
+        slot.transfers.store(slot.transfers.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (rc > 0)
+            slot.bytes.store(slot.bytes.load(std::memory_order_relaxed) + static_cast<u64>(rc), std::memory_order_relaxed);
+        if (rc >= 0 && static_cast<u64>(rc) < requested)
+            increment(slot.shortReads);
+        else if (rc == FP_TIMEOUT)
+            increment(slot.timeouts);
+        else if (rc == FP_FIFO_OVERFLOW)
+            increment(slot.fifoOverflows);
+        else if (rc == FP_FIFO_UNDERFLOW)
+            increment(slot.fifoUnderflows);
+
+        slot.seq.store(seq + 2, std::memory_order_release);
+    }
+
+    /// Consistent snapshot of an endpoint, the bandwidth decays to nowNs when no transfer happened since.
+    /// Returns false if the endpoint has no transfers.
+    bool read(u32 address, i64 nowNs, FPPipeMonitorStats& stats) const
+    {
+        const Slot& slot = mSlots[address % FPMONITOR_ENDPOINTS];
+        while (true){
+            u32 seq = slot.seq.load(std::memory_order_acquire);
+            if (seq & 1){
+                std::this_thread::yield();
+                continue;
+            }
+            stats.bandwidth = slot.bandwidth.load(std::memory_order_relaxed);
+            stats.transfers = slot.transfers.load(std::memory_order_relaxed);
+            stats.bytes = slot.bytes.load(std::memory_order_relaxed);
+            stats.shortReads = slot.shortReads.load(std::memory_order_relaxed);
+            stats.timeouts = slot.timeouts.load(std::memory_order_relaxed);
+            stats.fifoOverflows = slot.fifoOverflows.load(std::memory_order_relaxed);
+            stats.fifoUnderflows = slot.fifoUnderflows.load(std::memory_order_relaxed);
+            stats.lastNs = slot.lastNs.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == seq)
+                break;
+        }
+        if (stats.lastNs && nowNs > stats.lastNs)
+            stats.bandwidth *= std::exp(-static_cast<double>(nowNs - stats.lastNs) / mTauNs);
+        return stats.transfers != 0;
+    }
+
+    void reset()
+    {
+        for (Slot& slot : mSlots){
+            u32 seq = lock(slot);
+            slot.bandwidth.store(0, std::memory_order_relaxed);
+            slot.transfers.store(0, std::memory_order_relaxed);
+            slot.bytes.store(0, std::memory_order_relaxed);
+            slot.shortReads.store(0, std::memory_order_relaxed);
+            slot.timeouts.store(0, std::memory_order_relaxed);
+            slot.fifoOverflows.store(0, std::memory_order_relaxed);
+            slot.fifoUnderflows.store(0, std::memory_order_relaxed);
+            slot.lastNs.store(0, std::memory_order_relaxed);
+            slot.seq.store(seq + 2, std::memory_order_release);
+        }
+    }
+
+    static u32 endpointAddress(u32 slot)    { return 0x80 | slot; }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<u32> seq{0};
+        std::atomic<double> bandwidth{0};
+        std::atomic<u64> transfers{0};
+        std::atomic<u64> bytes{0};
+        std::atomic<u64> shortReads{0};
+        std::atomic<u64> timeouts{0};
+        std::atomic<u64> fifoOverflows{0};
+        std::atomic<u64> fifoUnderflows{0};
+        std::atomic<i64> lastNs{0};
+    };
+
+    /// Makes the sequence odd (write in progress), returns the previous even value
+    static u32 lock(Slot& slot)
+    {
+        u32 seq = slot.seq.load(std::memory_order_relaxed);
+        while ((seq & 1) || !slot.seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire, std::memory_order_relaxed)){
+            std::this_thread::yield();
+            seq = slot.seq.load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        return seq;
+    }
+
+    static void increment(std::atomic<u64>& counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<double> mTauNs;
+    Slot mSlots[FPMONITOR_ENDPOINTS];
+};
+
+#endif /* !FPMONITOR_H */
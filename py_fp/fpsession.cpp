@@ -0,0 +1,648 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#define NOMINMAX
+#include "fpsession.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include "strutils.h"
+
+// number of records an operation may skip to find its match during replay
+#define FPSESSION_LOOKAHEAD     64
+
+static void appendString(std::vector<byte>& data, const std::string& text)
+{
+    u32 size = static_cast<u32>(text.size());
+    data.insert(data.end(), reinterpret_cast<const byte*>(&size), reinterpret_cast<const byte*>(&size) + sizeof(size));
+    data.insert(data.end(), text.begin(), text.end());
+}
+
+static bool readString(const byte*& data, const byte* end, std::string& text)
+{
+    u32 size = 0;
+    if (end - data < (long)sizeof(size))
+        return false;
+    memcpy(&size, data, sizeof(size));
+    data += sizeof(size);
+    if (end - data < (long)size)
+        return false;
+    text.assign(reinterpret_cast<const char*>(data), size);
+    data += size;
+    return true;
+}
+
+//################################################################################
+//                      RECORDER
+//################################################################################
+
+FPSessionRecorder::FPSessionRecorder()
+    : mFile(NULL)
+    , mPipeInData(false)
+    , mStartNs(0)
+    , mRecords(0)
+{
+}
+
+FPSessionRecorder::~FPSessionRecorder()
+{
+    close();
+}
+
+i64 FPSessionRecorder::nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool FPSessionRecorder::open(const char* fileName, bool pipeInData)
+{
+    close();
+    mFile = fopen(fileName, "wb");
+    if (!mFile)
+        return false;
+    setvbuf(mFile, NULL, _IOFBF, 1 << 20);
+    fwrite(FPSESSION_MAGIC, 1, FPSESSION_MAGIC_SIZE, mFile);
+    mPipeInData = pipeInData;
+    mStartNs = nowNs();
+    mRecords = 0;
+    return true;
+}
+
+void FPSessionRecorder::close()
+{
+    if (mFile){
+        fclose(mFile);
+        mFile = NULL;
+    }
+}
+
+void FPSessionRecorder::writeInfo(FPTransport* transport)
+{
+    FPTransportInfo devInfo;
+    transport->getDeviceInfo(devInfo);
+
+    FPSessionInfo info;
+    memset(&info, 0, sizeof(info));
+    info.majorVersion = devInfo.majorVersion;
+    info.minorVersion = devInfo.minorVersion;
+    info.usb3Speed = devInfo.usb3Speed ? 1 : 0;
+    info.boardModelId = devInfo.boardModelId;
+    info.deviceInterface = devInfo.deviceInterface;
+    info.usbSpeed = devInfo.usbSpeed;
+    info.hostInterfaceWidth = devInfo.hostInterfaceWidth;
+    info.highSpeed = devInfo.highSpeed ? 1 : 0;
+    info.frontPanel3Supported = devInfo.frontPanel3Supported ? 1 : 0;
+    info.flashSectorCount = devInfo.flashSectorCount;
+    info.flashSectorSize = devInfo.flashSectorSize;
+    info.flashPageSize = devInfo.flashPageSize;
+    info.flashMinUserSector = devInfo.flashMinUserSector;
+    info.flashMaxUserSector = devInfo.flashMaxUserSector;
+    for (u32 i = 0; i < 32; i++)
+        transport->getWireInValue(i, &info.wireIns[i]);
+
+    std::vector<byte> data(reinterpret_cast<const byte*>(&info), reinterpret_cast<const byte*>(&info) + sizeof(info));
+    appendString(data, devInfo.deviceID);
+    appendString(data, devInfo.serial);
+    appendString(data, devInfo.boardModel);
+    write(FPSES_INFO, 0, 0, 0, 0, nowNs(), data.data(), data.size());
+}
+
+void FPSessionRecorder::write(FPSessionOp op, u32 address, u32 arg0, u32 arg1, i64 rc, i64 beginNs, const void* data, size_t dataSize)
+{
+    if (!mFile)
+        return;
+    i64 endNs = nowNs();
+    FPSessionRecord record;
+    memset(&record, 0, sizeof(record));
+    record.op = static_cast<u8>(op);
+    record.address = address;
+    record.arg0 = arg0;
+    record.arg1 = arg1;
+    record.rc = rc;
+    record.timeNs = static_cast<u64>(std::max<i64>(beginNs - mStartNs, 0));
+    record.durationNs = static_cast<u32>(std::min<i64>(endNs - beginNs, 0xFFFFFFFF));
+    record.dataSize = data ? static_cast<u32>(dataSize) : 0;
+    fwrite(&record, sizeof(record), 1, mFile);
+    if (record.dataSize)
+        fwrite(data, 1, record.dataSize, mFile);
+    mRecords++;
+}
+
+//################################################################################
+//                      RECORDING TRANSPORT
+//################################################################################
+
+RecordingTransport::RecordingTransport(FPTransport* transport, FPSessionRecorder* recorder)
+    : mTransport(transport)
+    , mRecorder(recorder)
+{
+}
+
+RecordingTransport::~RecordingTransport()
+{
+    delete mTransport;
+}
+
+FPTransport* RecordingTransport::release()
+{
+    FPTransport* transport = mTransport;
+    mTransport = NULL;
+    return transport;
+}
+
+int RecordingTransport::openBySerial(const std::string& serial)
+{
+    return mTransport->openBySerial(serial);
+}
+
+void RecordingTransport::close()
+{
+    mTransport->close();
+}
+
+bool RecordingTransport::isOpen()
+{
+    return mTransport->isOpen();
+}
+
+int RecordingTransport::getDeviceInfo(FPTransportInfo& info)
+{
+    return mTransport->getDeviceInfo(info);
+}
+
+int RecordingTransport::loadDefaultPLLConfiguration()
+{
+    return mTransport->loadDefaultPLLConfiguration();
+}
+
+int RecordingTransport::configureFPGA(const std::string& fileName)
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    int rc = mTransport->configureFPGA(fileName);
+    mRecorder->write(FPSES_CONFIGURE_FPGA, 0, 0, 0, rc, beginNs);
+    return rc;
+}
+
+int RecordingTransport::configureFPGAFromFlash(u32 configIndex)
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    int rc = mTransport->configureFPGAFromFlash(configIndex);
+    mRecorder->write(FPSES_CONFIGURE_FROM_FLASH, configIndex, 0, 0, rc, beginNs);
+    return rc;
+}
+
+bool RecordingTransport::isFrontPanelEnabled()
+{
+    return mTransport->isFrontPanelEnabled();
+}
+
+void RecordingTransport::setTimeout(int timeout)
+{
+    mTransport->setTimeout(timeout);
+}
+
+int RecordingTransport::resetFPGA()
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    int rc = mTransport->resetFPGA();
+    mRecorder->write(FPSES_RESET_FPGA, 0, 0, 0, rc, beginNs);
+    return rc;
+}
+
+std::string RecordingTransport::getDeviceID()
+{
+    return mTransport->getDeviceID();
+}
+
+void RecordingTransport::setDeviceID(const std::string& deviceID)
+{
+    mTransport->setDeviceID(deviceID);
+}
+
+int RecordingTransport::setWireInValue(u32 address, u32 value, u32 mask)
+{
+    return mTransport->setWireInValue(address, value, mask);
+}
+
+int RecordingTransport::getWireInValue(u32 address, u32* value)
+{
+    return mTransport->getWireInValue(address, value);
+}
+
+void RecordingTransport::updateWireIns()
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    mTransport->updateWireIns();
+    u32 wireIns[32] = {0};
+    for (u32 i = 0; i < 32; i++)
+        mTransport->getWireInValue(i, &wireIns[i]);
+    mRecorder->write(FPSES_UPDATE_WIRE_INS, 0, 0, 0, 0, beginNs, wireIns, sizeof(wireIns));
+}
+
+void RecordingTransport::updateWireOuts()
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    mTransport->updateWireOuts();
+    u32 wireOuts[32];
+    for (u32 i = 0; i < 32; i++)
+        wireOuts[i] = mTransport->getWireOutValue(0x20 + i);
+    mRecorder->write(FPSES_UPDATE_WIRE_OUTS, 0x20, 0, 0, 0, beginNs, wireOuts, sizeof(wireOuts));
+}
+
+u32 RecordingTransport::getWireOutValue(u32 address)
+{
+    return mTransport->getWireOutValue(address);
+}
+
+int RecordingTransport::activateTriggerIn(u32 address, int bit)
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    int rc = mTransport->activateTriggerIn(address, bit);
+    mRecorder->write(FPSES_ACTIVATE_TRIGGER_IN, address, static_cast<u32>(bit), 0, rc, beginNs);
+    return rc;
+}
+
+void RecordingTransport::updateTriggerOuts()
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    mTransport->updateTriggerOuts();
+    mRecorder->write(FPSES_UPDATE_TRIGGER_OUTS, 0, 0, 0, 0, beginNs);
+}
+
+bool RecordingTransport::isTriggered(u32 address, u32 mask)
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    bool triggered = mTransport->isTriggered(address, mask);
+    mRecorder->write(FPSES_IS_TRIGGERED, address, mask, 0, triggered ? 1 : 0, beginNs);
+    return triggered;
+}
+
+int RecordingTransport::writeRegister(u32 address, u32 value)
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    int rc = mTransport->writeRegister(address, value);
+    mRecorder->write(FPSES_WRITE_REGISTER, address, value, 0, rc, beginNs);
+    return rc;
+}
+
+int RecordingTransport::readRegister(u32 address, u32* value)
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    int rc = mTransport->readRegister(address, value);
+    mRecorder->write(FPSES_READ_REGISTER, address, *value, 0, rc, beginNs);
+    return rc;
+}
+
+long RecordingTransport::writeToBlockPipeIn(u32 address, int blockSize, long length, const byte* data)
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    long rc = mTransport->writeToBlockPipeIn(address, blockSize, length, data);
+    mRecorder->write(FPSES_WRITE_PIPE, address, static_cast<u32>(blockSize), static_cast<u32>(length), rc, beginNs,
+                     mRecorder->pipeInData() ? data : nullptr, static_cast<size_t>(length));
+    return rc;
+}
+
+long RecordingTransport::readFromBlockPipeOut(u32 address, int blockSize, long length, byte* data)
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    long rc = mTransport->readFromBlockPipeOut(address, blockSize, length, data);
+    mRecorder->write(FPSES_READ_PIPE, address, static_cast<u32>(blockSize), static_cast<u32>(length), rc, beginNs,
+                     data, rc > 0 ? static_cast<size_t>(std::min(rc, length)) : 0);
+    return rc;
+}
+
+int RecordingTransport::flashEraseSector(u32 address)
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    int rc = mTransport->flashEraseSector(address);
+    mRecorder->write(FPSES_FLASH_ERASE_SECTOR, address, 0, 0, rc, beginNs);
+    return rc;
+}
+
+int RecordingTransport::flashWrite(u32 address, u32 length, const byte* data)
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    int rc = mTransport->flashWrite(address, length, data);
+    mRecorder->write(FPSES_FLASH_WRITE, address, 0, length, rc, beginNs);
+    return rc;
+}
+
+int RecordingTransport::flashRead(u32 address, u32 length, byte* data)
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    int rc = mTransport->flashRead(address, length, data);
+    mRecorder->write(FPSES_FLASH_READ, address, 0, length, rc, beginNs, data, rc == FP_NO_ERROR ? length : 0);
+    return rc;
+}
+
+//################################################################################
+//                      REPLAY TRANSPORT
+//################################################################################
+
+ReplayTransport::ReplayTransport()
+    : mOpen(false)
+    , mFast(false)
+    , mNext(0)
+    , mInfo()
+    , mWireIns()
+    , mWireOuts()
+{
+}
+
+ReplayTransport::~ReplayTransport()
+{
+}
+
+int ReplayTransport::openBySerial(const std::string& serial)
+{
+    std::string options = str::starts_with(serial, "REPLAY:") ? serial.substr(7) : serial;
+    std::string fileName = options;
+    if (options.find('=') != std::string::npos){
+        fileName.clear();
+        for (const auto& option : str::split(options, ",", true)) {
+            size_t separator = option.find('=');
+            std::string key = str::to_lower(str::strip(option.substr(0, separator)));
+            std::string value = separator != std::string::npos ? str::strip(option.substr(separator + 1)) : "";
+            if (key == "file")
+                fileName = value;
+            else if (key == "speed")
+                mFast = str::iequals(value, "fast");
+            else
+                return FP_INVALID_PARAMETER;
+        }
+    }
+
+    FILE* file = fopen(fileName.c_str(), "rb");
+    if (!file)
+        return FP_FILE_ERROR;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    mSession.resize(size > 0 ? static_cast<size_t>(size) : 0);
+    size_t read = fread(mSession.data(), 1, mSession.size(), file);
+    fclose(file);
+    if (read != mSession.size() || mSession.size() < FPSESSION_MAGIC_SIZE ||
+        memcmp(mSession.data(), FPSESSION_MAGIC, FPSESSION_MAGIC_SIZE) != 0)
+        return FP_FILE_ERROR;
+
+    mRecords.clear();
+    size_t offset = FPSESSION_MAGIC_SIZE;
+    while (offset + sizeof(FPSessionRecord) <= mSession.size()){
+        const FPSessionRecord* record = reinterpret_cast<const FPSessionRecord*>(&mSession[offset]);
+        if (offset + sizeof(FPSessionRecord) + record->dataSize > mSession.size())
+            break;
+        mRecords.push_back(offset);
+        offset += sizeof(FPSessionRecord) + record->dataSize;
+    }
+
+    if (mRecords.empty())
+        return FP_FILE_ERROR;
+    const FPSessionRecord* first = reinterpret_cast<const FPSessionRecord*>(&mSession[mRecords[0]]);
+    if (first->op != FPSES_INFO || !loadInfo(first, reinterpret_cast<const byte*>(first + 1)))
+        return FP_FILE_ERROR;
+
+    mNext = 1;
+    mOpen = true;
+    return FP_NO_ERROR;
+}
+
+bool ReplayTransport::loadInfo(const FPSessionRecord* record, const byte* data)
+{
+    FPSessionInfo info;
+    if (record->dataSize < sizeof(info))
+        return false;
+    memcpy(&info, data, sizeof(info));
+    const byte* end = data + record->dataSize;
+    data += sizeof(info);
+    if (!readString(data, end, mInfo.deviceID) || !readString(data, end, mInfo.serial) ||
+        !readString(data, end, mInfo.boardModel))
+        return false;
+
+    mInfo.majorVersion = info.majorVersion;
+    mInfo.minorVersion = info.minorVersion;
+    mInfo.usb3Speed = info.usb3Speed != 0;
+    mInfo.boardModelId = info.boardModelId;
+    mInfo.deviceInterface = info.deviceInterface;
+    mInfo.usbSpeed = info.usbSpeed;
+    mInfo.hostInterfaceWidth = info.hostInterfaceWidth;
+    mInfo.highSpeed = info.highSpeed != 0;
+    mInfo.frontPanel3Supported = info.frontPanel3Supported != 0;
+    mInfo.flashSectorCount = info.flashSectorCount;
+    mInfo.flashSectorSize = info.flashSectorSize;
+    mInfo.flashPageSize = info.flashPageSize;
+    mInfo.flashMinUserSector = info.flashMinUserSector;
+    mInfo.flashMaxUserSector = info.flashMaxUserSector;
+    memcpy(mWireIns, info.wireIns, sizeof(mWireIns));
+    return true;
+}
+
+const FPSessionRecord* ReplayTransport::next(FPSessionOp op, u32 address)
+{
+    size_t last = std::min(mNext + FPSESSION_LOOKAHEAD, mRecords.size());
+    for (size_t i = mNext; i < last; i++){
+        const FPSessionRecord* record = reinterpret_cast<const FPSessionRecord*>(&mSession[mRecords[i]]);
+        if (record->op == op && record->address == address){
+            mNext = i + 1;
+            return record;
+        }
+    }
+    return nullptr;
+}
+
+i64 ReplayTransport::replay(FPSessionOp op, u32 address, byte* data, size_t size, u32* arg0)
+{
+    i64 beginNs = FPSessionRecorder::nowNs();
+    if (!mOpen)
+        return FP_DEVICE_NOT_OPEN;
+
+    const FPSessionRecord* record = next(op, address);
+    if (!record)
+        return FP_COMMUNICATION_ERROR;
+
+    if (data)
+        memcpy(data, record + 1, std::min(size, static_cast<size_t>(record->dataSize)));
+    if (arg0)
+        *arg0 = record->arg0;
+
+    if (!mFast){
+        // sleep for the most of the time, spin for the rest to stay accurate
+        i64 endNs = beginNs + record->durationNs;
+        i64 remainingNs = endNs - FPSessionRecorder::nowNs();
+        if (remainingNs > 200000)
+            std::this_thread::sleep_for(std::chrono::nanoseconds(remainingNs - 100000));
+        while (FPSessionRecorder::nowNs() < endNs)
+            ;
+    }
+    return record->rc;
+}
+
+void ReplayTransport::close()
+{
+    mOpen = false;
+}
+
+bool ReplayTransport::isOpen()
+{
+    return mOpen;
+}
+
+int ReplayTransport::getDeviceInfo(FPTransportInfo& info)
+{
+    info = mInfo;
+    return FP_NO_ERROR;
+}
+
+int ReplayTransport::loadDefaultPLLConfiguration()
+{
+    return FP_NO_ERROR;
+}
+
+int ReplayTransport::configureFPGA(const std::string& fileName)
+{
+    // configuration done at open is usually not part of the recording
+    (void)fileName;
+    i64 rc = replay(FPSES_CONFIGURE_FPGA, 0);
+    return rc == FP_COMMUNICATION_ERROR ? FP_NO_ERROR : static_cast<int>(rc);
+}
+
+int ReplayTransport::configureFPGAFromFlash(u32 configIndex)
+{
+    i64 rc = replay(FPSES_CONFIGURE_FROM_FLASH, configIndex);
+    return rc == FP_COMMUNICATION_ERROR ? FP_NO_ERROR : static_cast<int>(rc);
+}
+
+bool ReplayTransport::isFrontPanelEnabled()
+{
+    return mOpen;
+}
+
+void ReplayTransport::setTimeout(int timeout)
+{
+    (void)timeout;
+}
+
+int ReplayTransport::resetFPGA()
+{
+    return static_cast<int>(replay(FPSES_RESET_FPGA, 0));
+}
+
+std::string ReplayTransport::getDeviceID()
+{
+    return mInfo.deviceID;
+}
+
+void ReplayTransport::setDeviceID(const std::string& deviceID)
+{
+    mInfo.deviceID = deviceID;
+}
+
+int ReplayTransport::setWireInValue(u32 address, u32 value, u32 mask)
+{
+    if (address >= 0x20)
+        return FP_INVALID_ENDPOINT;
+    mWireIns[address] = (mWireIns[address] & ~mask) | (value & mask);
+    return FP_NO_ERROR;
+}
+
+int ReplayTransport::getWireInValue(u32 address, u32* value)
+{
+    if (address >= 0x20)
+        return FP_INVALID_ENDPOINT;
+    *value = mWireIns[address];
+    return FP_NO_ERROR;
+}
+
+void ReplayTransport::updateWireIns()
+{
+    replay(FPSES_UPDATE_WIRE_INS, 0);
+}
+
+void ReplayTransport::updateWireOuts()
+{
+    replay(FPSES_UPDATE_WIRE_OUTS, 0x20, reinterpret_cast<byte*>(mWireOuts), sizeof(mWireOuts));
+}
+
+u32 ReplayTransport::getWireOutValue(u32 address)
+{
+    if (address < 0x20 || address >= 0x40)
+        return 0;
+    return mWireOuts[address - 0x20];
+}
+
+int ReplayTransport::activateTriggerIn(u32 address, int bit)
+{
+    (void)bit;
+    return static_cast<int>(replay(FPSES_ACTIVATE_TRIGGER_IN, address));
+}
+
+void ReplayTransport::updateTriggerOuts()
+{
+    replay(FPSES_UPDATE_TRIGGER_OUTS, 0);
+}
+
+bool ReplayTransport::isTriggered(u32 address, u32 mask)
+{
+    (void)mask;
+    return replay(FPSES_IS_TRIGGERED, address) == 1;
+}
+
+int ReplayTransport::writeRegister(u32 address, u32 value)
+{
+    (void)value;
+    return static_cast<int>(replay(FPSES_WRITE_REGISTER, address));
+}
+
+int ReplayTransport::readRegister(u32 address, u32* value)
+{
+    return static_cast<int>(replay(FPSES_READ_REGISTER, address, nullptr, 0, value));
+}
+
+long ReplayTransport::writeToBlockPipeIn(u32 address, int blockSize, long length, const byte* data)
+{
+    (void)blockSize;
+    (void)length;
+    (void)data;
+    return static_cast<long>(replay(FPSES_WRITE_PIPE, address));
+}
+
+long ReplayTransport::readFromBlockPipeOut(u32 address, int blockSize, long length, byte* data)
+{
+    (void)blockSize;
+    return static_cast<long>(replay(FPSES_READ_PIPE, address, data, static_cast<size_t>(length)));
+}
+
+int ReplayTransport::flashEraseSector(u32 address)
+{
+    return static_cast<int>(replay(FPSES_FLASH_ERASE_SECTOR, address));
+}
+
+int ReplayTransport::flashWrite(u32 address, u32 length, const byte* data)
+{
+    (void)length;
+    (void)data;
+    return static_cast<int>(replay(FPSES_FLASH_WRITE, address));
+}
+
+int ReplayTransport::flashRead(u32 address, u32 length, byte* data)
+{
+    return static_cast<int>(replay(FPSES_FLASH_READ, address, data, length));
+}
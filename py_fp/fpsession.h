@@ -0,0 +1,215 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef FPSESSION_H
+#define FPSESSION_H
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "fptransport.h"
+
+// Session file: 8 byte magic, then records (FPSessionRecord + data), written as they are in memory,
+// i.e. in the byte order of the recording host. Sessions are replayed on hosts of the same byte order.
+// The first record is always FPSES_INFO.
+#define FPSESSION_MAGIC         "FPSESS02"
+#define FPSESSION_MAGIC_SIZE    8
+
+/// Operations stored in a session file. Only calls that talk to the device are recorded,
+/// local calls (setWireInValue, getWireOutValue, ...) are served from the recorded state.
+enum FPSessionOp {
+    FPSES_INFO = 1,             // data: FPSessionInfo, device ID, serial, board model
+    FPSES_UPDATE_WIRE_INS,      // data: 32 wire-in values
+    FPSES_UPDATE_WIRE_OUTS,     // data: 32 wire-out values
+    FPSES_ACTIVATE_TRIGGER_IN,  // arg0: bit
+    FPSES_UPDATE_TRIGGER_OUTS,
+    FPSES_IS_TRIGGERED,         // arg0: mask, rc: result
+    FPSES_WRITE_REGISTER,       // arg0: value
+    FPSES_READ_REGISTER,        // arg0: value read
+    FPSES_WRITE_PIPE,           // arg0: block size, arg1: length, data: written data (optional)
+    FPSES_READ_PIPE,            // arg0: block size, arg1: length, data: data read
+    FPSES_FLASH_ERASE_SECTOR,
+    FPSES_FLASH_WRITE,          // arg1: length
+    FPSES_FLASH_READ,           // arg1: length, data: data read
+    FPSES_CONFIGURE_FPGA,
+    FPSES_CONFIGURE_FROM_FLASH,
+    FPSES_RESET_FPGA,
+};
+
+#pragma pack(push, 1)
+/// Header of one recorded operation, followed by dataSize bytes of data
+struct FPSessionRecord {
+    u8 op;
+    u8 reserved[3];
+    u32 address;
+    u32 arg0;
+    u32 arg1;
+    i64 rc;
+    u64 timeNs;         // start of the operation since the start of the recording
+    u32 durationNs;
+    u32 dataSize;
+};
+
+/// Fixed part of the FPSES_INFO data, followed by the device ID, serial and board model (u32 length + chars)
+struct FPSessionInfo {
+    i32 majorVersion;
+    i32 minorVersion;
+    u32 usb3Speed;
+    i32 boardModelId;
+    i32 deviceInterface;
+    i32 usbSpeed;
+    i32 hostInterfaceWidth;
+    u32 highSpeed;
+    u32 frontPanel3Supported;
+    u32 flashSectorCount;
+    u32 flashSectorSize;
+    u32 flashPageSize;
+    u32 flashMinUserSector;
+    u32 flashMaxUserSector;
+    u32 wireIns[32];
+};
+#pragma pack(pop)
+
+/// Writer of a session file
+class FPSessionRecorder
+{
+public:
+    FPSessionRecorder();
+    ~FPSessionRecorder();
+
+    bool open(const char* fileName, bool pipeInData);
+    void close();
+    /// Writes the FPSES_INFO record with the device info and wire-ins of the transport
+    void writeInfo(FPTransport* transport);
+    void write(FPSessionOp op, u32 address, u32 arg0, u32 arg1, i64 rc, i64 beginNs, const void* data = nullptr, size_t dataSize = 0);
+    bool pipeInData() const { return mPipeInData; }
+    u64 records() const { return mRecords; }
+    static i64 nowNs();
+
+private:
+    FILE* mFile;
+    bool mPipeInData;
+    i64 mStartNs;
+    u64 mRecords;
+};
+
+/// Transport decorator that records every device operation of the wrapped transport
+class RecordingTransport : public FPTransport
+{
+public:
+    RecordingTransport(FPTransport* transport, FPSessionRecorder* recorder);
+    virtual ~RecordingTransport();
+    /// Returns the wrapped transport, which is no longer owned by the recorder
+    FPTransport* release();
+
+    int openBySerial(const std::string& serial) override;
+    void close() override;
+    bool isOpen() override;
+    int getDeviceInfo(FPTransportInfo& info) override;
+    int loadDefaultPLLConfiguration() override;
+    int configureFPGA(const std::string& fileName) override;
+    int configureFPGAFromFlash(u32 configIndex) override;
+    bool isFrontPanelEnabled() override;
+    void setTimeout(int timeout) override;
+    int resetFPGA() override;
+    std::string getDeviceID() override;
+    void setDeviceID(const std::string& deviceID) override;
+
+    int setWireInValue(u32 address, u32 value, u32 mask = 0xFFFFFFFF) override;
+    int getWireInValue(u32 address, u32* value) override;
+    void updateWireIns() override;
+    void updateWireOuts() override;
+    u32 getWireOutValue(u32 address) override;
+    int activateTriggerIn(u32 address, int bit) override;
+    void updateTriggerOuts() override;
+    bool isTriggered(u32 address, u32 mask) override;
+
+    int writeRegister(u32 address, u32 value) override;
+    int readRegister(u32 address, u32* value) override;
+    long writeToBlockPipeIn(u32 address, int blockSize, long length, const byte* data) override;
+    long readFromBlockPipeOut(u32 address, int blockSize, long length, byte* data) override;
+
+    int flashEraseSector(u32 address) override;
+    int flashWrite(u32 address, u32 length, const byte* data) override;
+    int flashRead(u32 address, u32 length, byte* data) override;
+
+private:
+    FPTransport* mTransport;
+    FPSessionRecorder* mRecorder;
+};
+
+/// Transport that serves a recorded session, opened as "REPLAY:<file>" or "REPLAY:file=<file>,speed=recorded|fast".
+/// Operations are matched in order by type and address (a few skipped records are tolerated),
+/// unmatched operations fail with FP_COMMUNICATION_ERROR. With speed=recorded (default)
+/// every operation takes at least as long as it did during the recording.
+class ReplayTransport : public FPTransport
+{
+public:
+    ReplayTransport();
+    virtual ~ReplayTransport();
+
+    int openBySerial(const std::string& serial) override;
+    void close() override;
+    bool isOpen() override;
+    int getDeviceInfo(FPTransportInfo& info) override;
+    int loadDefaultPLLConfiguration() override;
+    int configureFPGA(const std::string& fileName) override;
+    int configureFPGAFromFlash(u32 configIndex) override;
+    bool isFrontPanelEnabled() override;
+    void setTimeout(int timeout) override;
+    int resetFPGA() override;
+    std::string getDeviceID() override;
+    void setDeviceID(const std::string& deviceID) override;
+
+    int setWireInValue(u32 address, u32 value, u32 mask = 0xFFFFFFFF) override;
+    int getWireInValue(u32 address, u32* value) override;
+    void updateWireIns() override;
+    void updateWireOuts() override;
+    u32 getWireOutValue(u32 address) override;
+    int activateTriggerIn(u32 address, int bit) override;
+    void updateTriggerOuts() override;
+    bool isTriggered(u32 address, u32 mask) override;
+
+    int writeRegister(u32 address, u32 value) override;
+    int readRegister(u32 address, u32* value) override;
+    long writeToBlockPipeIn(u32 address, int blockSize, long length, const byte* data) override;
+    long readFromBlockPipeOut(u32 address, int blockSize, long length, byte* data) override;
+
+    int flashEraseSector(u32 address) override;
+    int flashWrite(u32 address, u32 length, const byte* data) override;
+    int flashRead(u32 address, u32 length, byte* data) override;
+
+private:
+    const FPSessionRecord* next(FPSessionOp op, u32 address);
+    i64 replay(FPSessionOp op, u32 address, byte* data = nullptr, size_t size = 0, u32* arg0 = nullptr);
+    bool loadInfo(const FPSessionRecord* record, const byte* data);
+
+private:
+    bool mOpen;
+    bool mFast;
+    std::vector<byte> mSession;
+    std::vector<size_t> mRecords;   // offsets of the records in mSession
+    size_t mNext;                   // index of the next record to replay
+    FPTransportInfo mInfo;
+    u32 mWireIns[32];
+    u32 mWireOuts[32];
+};
+
+#endif /* !FPSESSION_H */
@@ -0,0 +1,402 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#define NOMINMAX
+#include "fpsim.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include "strutils.h"
+
+#define SIM_FLASH_SIZE          (16 * 1024 * 1024)
+#define SIM_FLASH_SECTOR_SIZE   (64 * 1024)
+#define SIM_FLASH_PAGE_SIZE     256
+#define SIM_FLASH_MIN_USER      16
+
+SimTransport::SimTransport()
+    : mOpen(false)
+    , mSerial("SIM0001")
+    , mDeviceID("Simulator")
+    , mPatternPipes(false)
+    , mFifoSize(64 * 1024 * 1024)
+    , mBandwidthMBs(0)
+    , mLatencyUs(0)
+    , mErrorRate(0)
+    , mErrorCode(FP_TIMEOUT)
+    , mUSB3(true)
+    , mWireInsPending()
+    , mWireIns()
+    , mWireOuts()
+    , mTriggersPending()
+    , mTriggers()
+    , mFifos()
+    , mPatternCounters()
+{
+}
+
+SimTransport::~SimTransport()
+{
+}
+
+int SimTransport::openBySerial(const std::string& serial)
+{
+    std::string options = str::starts_with(serial, "SIM:") ? serial.substr(4) : "";
+    for (const auto& option : str::split(options, ",", true)) {
+        // an option without a value (e.g. "usb3") has an empty value
+        size_t separator = option.find('=');
+        std::string key = str::to_lower(str::strip(option.substr(0, separator)));
+        std::string value = separator != std::string::npos ? str::strip(option.substr(separator + 1)) : "";
+        if (key == "serial")
+            mSerial = value;
+        else if (key == "pipe")
+            mPatternPipes = str::iequals(value, "pattern");
+        else if (key == "fifo")
+            mFifoSize = static_cast<size_t>(str::to_num_def<double>(value, (double)mFifoSize));
+        else if (key == "bw")
+            mBandwidthMBs = str::to_double_def(value, 0);
+        else if (key == "latency")
+            mLatencyUs = str::to_double_def(value, 0);
+        else if (key == "error_rate")
+            mErrorRate = str::to_double_def(value, 0);
+        else if (key == "error")
+            mErrorCode = str::to_int_def(value, FP_TIMEOUT);
+        else if (key == "seed")
+            mRandom.seed(str::to_num_def<u32>(value, 0));
+        else if (key == "usb3")
+            mUSB3 = str::to_int_def(value, 1) != 0;
+        else
+            return FP_INVALID_PARAMETER;
+    }
+
+    mFlash.assign(SIM_FLASH_SIZE, 0xFF);
+    mOpen = true;
+    return FP_NO_ERROR;
+}
+
+void SimTransport::close()
+{
+    mOpen = false;
+}
+
+bool SimTransport::isOpen()
+{
+    return mOpen;
+}
+
+int SimTransport::getDeviceInfo(FPTransportInfo& info)
+{
+    info.deviceID = mDeviceID;
+    info.serial = mSerial;
+    info.majorVersion = 1;
+    info.minorVersion = 0;
+    info.usb3Speed = mUSB3;
+    info.boardModel = "Simulator";
+    info.boardModelId = 0;
+    info.deviceInterface = mUSB3 ? FP_INTERFACE_USB3 : FP_INTERFACE_USB2;
+    info.usbSpeed = mUSB3 ? FP_USBSPEED_SUPER : FP_USBSPEED_HIGH;
+    info.hostInterfaceWidth = 32;
+    info.highSpeed = true;
+    info.frontPanel3Supported = mUSB3;
+    info.flashSectorCount = SIM_FLASH_SIZE / SIM_FLASH_SECTOR_SIZE;
+    info.flashSectorSize = SIM_FLASH_SECTOR_SIZE;
+    info.flashPageSize = SIM_FLASH_PAGE_SIZE;
+    info.flashMinUserSector = SIM_FLASH_MIN_USER;
+    info.flashMaxUserSector = SIM_FLASH_SIZE / SIM_FLASH_SECTOR_SIZE - 1;
+    return FP_NO_ERROR;
+}
+
+int SimTransport::loadDefaultPLLConfiguration()
+{
+    return FP_NO_ERROR;
+}
+
+int SimTransport::configureFPGA(const std::string& fileName)
+{
+    FILE* file = fopen(fileName.c_str(), "rb");
+    if (!file)
+        return FP_FILE_ERROR;
+    fclose(file);
+    return resetFPGA();
+}
+
+int SimTransport::configureFPGAFromFlash(u32 configIndex)
+{
+    (void)configIndex;
+    return resetFPGA();
+}
+
+bool SimTransport::isFrontPanelEnabled()
+{
+    return mOpen;
+}
+
+void SimTransport::setTimeout(int timeout)
+{
+    (void)timeout;
+}
+
+int SimTransport::resetFPGA()
+{
+    memset(mWireIns, 0, sizeof(mWireIns));
+    memset(mWireOuts, 0, sizeof(mWireOuts));
+    memset(mTriggersPending, 0, sizeof(mTriggersPending));
+    memset(mTriggers, 0, sizeof(mTriggers));
+    mRegisters.clear();
+    for (auto& fifo : mFifos)
+        fifo.head = fifo.size = 0;
+    return FP_NO_ERROR;
+}
+
+std::string SimTransport::getDeviceID()
+{
+    return mDeviceID;
+}
+
+void SimTransport::setDeviceID(const std::string& deviceID)
+{
+    mDeviceID = deviceID;
+}
+
+//################################################################################
+//                      WIRES AND TRIGGERS
+//################################################################################
+
+int SimTransport::setWireInValue(u32 address, u32 value, u32 mask)
+{
+    if (address >= 0x20)
+        return FP_INVALID_ENDPOINT;
+    mWireInsPending[address] = (mWireInsPending[address] & ~mask) | (value & mask);
+    return FP_NO_ERROR;
+}
+
+int SimTransport::getWireInValue(u32 address, u32* value)
+{
+    if (address >= 0x20)
+        return FP_INVALID_ENDPOINT;
+    *value = mWireInsPending[address];
+    return FP_NO_ERROR;
+}
+
+void SimTransport::updateWireIns()
+{
+    transaction(sizeof(mWireIns));
+    memcpy(mWireIns, mWireInsPending, sizeof(mWireIns));
+}
+
+void SimTransport::updateWireOuts()
+{
+    transaction(sizeof(mWireOuts));
+    memcpy(mWireOuts, mWireIns, sizeof(mWireOuts));
+}
+
+u32 SimTransport::getWireOutValue(u32 address)
+{
+    return (address >= 0x20 && address < 0x40) ? mWireOuts[address - 0x20] : 0;
+}
+
+int SimTransport::activateTriggerIn(u32 address, int bit)
+{
+    if (address < 0x40 || address >= 0x60 || bit < 0 || bit > 31)
+        return FP_INVALID_ENDPOINT;
+    int rc = transaction(4);
+    if (rc == FP_NO_ERROR)
+        mTriggersPending[address - 0x40] |= 1u << bit;
+    return rc;
+}
+
+void SimTransport::updateTriggerOuts()
+{
+    transaction(sizeof(mTriggers));
+    memcpy(mTriggers, mTriggersPending, sizeof(mTriggers));
+    memset(mTriggersPending, 0, sizeof(mTriggersPending));
+}
+
+bool SimTransport::isTriggered(u32 address, u32 mask)
+{
+    return address >= 0x60 && address < 0x80 && (mTriggers[address - 0x60] & mask) != 0;
+}
+
+//################################################################################
+//                      REGISTERS AND PIPES
+//################################################################################
+
+int SimTransport::writeRegister(u32 address, u32 value)
+{
+    int rc = transaction(8);
+    if (rc == FP_NO_ERROR)
+        mRegisters[address] = value;
+    return rc;
+}
+
+int SimTransport::readRegister(u32 address, u32* value)
+{
+    int rc = transaction(8);
+    if (rc == FP_NO_ERROR){
+        auto it = mRegisters.find(address);
+        *value = it != mRegisters.end() ? it->second : 0;
+    }
+    return rc;
+}
+
+long SimTransport::writeToBlockPipeIn(u32 address, int blockSize, long length, const byte* data)
+{
+    if (address < 0x80 || address >= 0xA0)
+        return FP_INVALID_ENDPOINT;
+    int rc = checkBlockSize(blockSize, length);
+    if (rc == FP_NO_ERROR)
+        rc = transaction(length);
+    if (rc != FP_NO_ERROR)
+        return rc;
+    if (mPatternPipes)
+        return length;
+
+    // data that does not fit to the loopback FIFO is not accepted by the device
+    Fifo& fifo = mFifos[address - 0x80];
+    if (fifo.data.size() != mFifoSize){
+        fifo.data.assign(mFifoSize, 0);
+        fifo.head = fifo.size = 0;
+    }
+    if (fifo.size + length > fifo.data.size())
+        return FP_TIMEOUT;
+
+    size_t tail = (fifo.head + fifo.size) % fifo.data.size();
+    size_t first = std::min(static_cast<size_t>(length), fifo.data.size() - tail);
+    memcpy(fifo.data.data() + tail, data, first);
+    memcpy(fifo.data.data(), data + first, length - first);
+    fifo.size += length;
+    return length;
+}
+
+long SimTransport::readFromBlockPipeOut(u32 address, int blockSize, long length, byte* data)
+{
+    if (address < 0xA0 || address >= 0xC0)
+        return FP_INVALID_ENDPOINT;
+    int rc = checkBlockSize(blockSize, length);
+    if (rc == FP_NO_ERROR)
+        rc = transaction(length);
+    if (rc != FP_NO_ERROR)
+        return rc;
+
+    if (mPatternPipes){
+        u32& counter = mPatternCounters[address - 0xA0];
+        long i = 0;
+        for (; i + 4 <= length; i += 4, counter++)
+            memcpy(data + i, &counter, 4);
+        for (; i < length; i++)
+            data[i] = static_cast<byte>(counter >> (8 * (i % 4)));
+        return length;
+    }
+
+    Fifo& fifo = mFifos[address - 0xA0];
+    if (fifo.size < static_cast<size_t>(length))
+        return FP_TIMEOUT;
+
+    size_t first = std::min(static_cast<size_t>(length), fifo.data.size() - fifo.head);
+    memcpy(data, fifo.data.data() + fifo.head, first);
+    memcpy(data + first, fifo.data.data(), length - first);
+    fifo.head = (fifo.head + length) % fifo.data.size();
+    fifo.size -= length;
+    return length;
+}
+
+//################################################################################
+//                      FLASH
+//################################################################################
+
+int SimTransport::flashEraseSector(u32 address)
+{
+    int rc = checkFlash(address, SIM_FLASH_SECTOR_SIZE, SIM_FLASH_SECTOR_SIZE);
+    if (rc == FP_NO_ERROR)
+        rc = transaction(8);
+    if (rc == FP_NO_ERROR)
+        memset(mFlash.data() + address, 0xFF, SIM_FLASH_SECTOR_SIZE);
+    return rc;
+}
+
+int SimTransport::flashWrite(u32 address, u32 length, const byte* data)
+{
+    int rc = checkFlash(address, length, SIM_FLASH_PAGE_SIZE);
+    if (rc == FP_NO_ERROR && length % SIM_FLASH_PAGE_SIZE != 0)
+        rc = FP_INVALID_PARAMETER;
+    if (rc == FP_NO_ERROR)
+        rc = transaction(length);
+    if (rc == FP_NO_ERROR){
+        // programming can only clear bits
+        for (u32 i = 0; i < length; i++)
+            mFlash[address + i] &= data[i];
+    }
+    return rc;
+}
+
+int SimTransport::flashRead(u32 address, u32 length, byte* data)
+{
+    int rc = checkFlash(address, length, 1);
+    if (rc == FP_NO_ERROR)
+        rc = transaction(length);
+    if (rc == FP_NO_ERROR)
+        memcpy(data, mFlash.data() + address, length);
+    return rc;
+}
+
+//################################################################################
+//                      HELPERS
+//################################################################################
+
+int SimTransport::transaction(u64 bytes)
+{
+    if (!mOpen)
+        return FP_DEVICE_NOT_OPEN;
+
+    double us = mLatencyUs + (mBandwidthMBs > 0 ? static_cast<double>(bytes) / mBandwidthMBs : 0);
+    if (us > 0){
+        // sleep for the most of the time, spin for the rest to stay accurate
+        auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(static_cast<i64>(us * 1000));
+        if (us > 200)
+            std::this_thread::sleep_for(std::chrono::microseconds(static_cast<i64>(us) - 100));
+        while (std::chrono::steady_clock::now() < end)
+            ;
+    }
+
+    if (mErrorRate > 0 && std::uniform_real_distribution<double>(0, 1)(mRandom) < mErrorRate)
+        return mErrorCode;
+    return FP_NO_ERROR;
+}
+
+int SimTransport::checkBlockSize(int blockSize, long length) const
+{
+    int maxBlockSize = mUSB3 ? 16384 : 1024;
+    bool powerOfTwo = blockSize > 0 && (blockSize & (blockSize - 1)) == 0;
+    if (!powerOfTwo || blockSize < 16 || blockSize > maxBlockSize)
+        return FP_INVALID_BLOCK_SIZE;
+    if (length <= 0 || length % blockSize != 0)
+        return FP_INVALID_BLOCK_SIZE;
+    return FP_NO_ERROR;
+}
+
+int SimTransport::checkFlash(u32 address, u32 length, u32 alignment) const
+{
+    if (address % alignment != 0)
+        return FP_INVALID_PARAMETER;
+    if (static_cast<u64>(address) + length > mFlash.size())
+        return FP_INVALID_PARAMETER;
+    return FP_NO_ERROR;
+}
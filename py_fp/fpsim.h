@@ -0,0 +1,118 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef FPSIM_H
+#define FPSIM_H
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "fptransport.h"
+
+/// Software model of a FrontPanel device, opened as "SIM:<key=value,...>"
+///
+/// Options:
+///   serial=<serial>       reported serial number (default SIM0001)
+///   pipe=loopback|pattern pipe-outs 0xA0+n return data written to pipe-ins 0x80+n (loopback)
+///                         or a 32-bit counter (pattern), default loopback
+///   fifo=<bytes>          size of a loopback FIFO (default 64 MB)
+///   bw=<MB/s>             pipe bandwidth, 0 is unlimited (default 0)
+///   latency=<us>          latency of every transaction (default 0)
+///   error_rate=<p>        probability that a transaction fails (default 0)
+///   error=<code>          error code of failed transactions (default -2, Timeout)
+///   seed=<n>              seed of the error injection
+///   usb3=0|1              report USB 3 speed (default 1)
+///
+/// Wire-outs 0x20+n loop back wire-ins 0x00+n, trigger-ins 0x40+n fire trigger-outs 0x60+n,
+/// registers are a plain memory and the flash is 16 MB with 64 kB sectors.
+class SimTransport : public FPTransport
+{
+public:
+    SimTransport();
+    virtual ~SimTransport();
+
+    int openBySerial(const std::string& serial) override;
+    void close() override;
+    bool isOpen() override;
+    int getDeviceInfo(FPTransportInfo& info) override;
+    int loadDefaultPLLConfiguration() override;
+    int configureFPGA(const std::string& fileName) override;
+    int configureFPGAFromFlash(u32 configIndex) override;
+    bool isFrontPanelEnabled() override;
+    void setTimeout(int timeout) override;
+    int resetFPGA() override;
+    std::string getDeviceID() override;
+    void setDeviceID(const std::string& deviceID) override;
+
+    int setWireInValue(u32 address, u32 value, u32 mask = 0xFFFFFFFF) override;
+    int getWireInValue(u32 address, u32* value) override;
+    void updateWireIns() override;
+    void updateWireOuts() override;
+    u32 getWireOutValue(u32 address) override;
+    int activateTriggerIn(u32 address, int bit) override;
+    void updateTriggerOuts() override;
+    bool isTriggered(u32 address, u32 mask) override;
+
+    int writeRegister(u32 address, u32 value) override;
+    int readRegister(u32 address, u32* value) override;
+    long writeToBlockPipeIn(u32 address, int blockSize, long length, const byte* data) override;
+    long readFromBlockPipeOut(u32 address, int blockSize, long length, byte* data) override;
+
+    int flashEraseSector(u32 address) override;
+    int flashWrite(u32 address, u32 length, const byte* data) override;
+    int flashRead(u32 address, u32 length, byte* data) override;
+
+private:
+    struct Fifo {
+        std::vector<byte> data;
+        size_t head;
+        size_t size;
+    };
+
+    int transaction(u64 bytes);
+    int checkBlockSize(int blockSize, long length) const;
+    int checkFlash(u32 address, u32 length, u32 alignment) const;
+
+private:
+    bool mOpen;
+    std::string mSerial;
+    std::string mDeviceID;
+    bool mPatternPipes;
+    size_t mFifoSize;
+    double mBandwidthMBs;
+    double mLatencyUs;
+    double mErrorRate;
+    int mErrorCode;
+    bool mUSB3;
+    std::mt19937 mRandom;
+
+    u32 mWireInsPending[32];
+    u32 mWireIns[32];
+    u32 mWireOuts[32];
+    u32 mTriggersPending[32];
+    u32 mTriggers[32];
+    std::unordered_map<u32, u32> mRegisters;
+    Fifo mFifos[32];
+    u32 mPatternCounters[32];
+    std::vector<byte> mFlash;
+};
+
+#endif /* !FPSIM_H */
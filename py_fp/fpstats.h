@@ -0,0 +1,142 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef FPSTATS_H
+#define FPSTATS_H
+#include <atomic>
+#include "common.h"
+
+enum FPOpType { FPOP_READ_PIPE = 0, FPOP_WRITE_PIPE, FPOP_READ_REGISTER, FPOP_WRITE_REGISTER,
+                FPOP_SET_WIRE_IN, FPOP_GET_WIRE_OUT, FPOP_COUNT };
+
+static const char* const FPOP_NAMES[] = {"read_pipe", "write_pipe", "read_register", "write_register",
+                                         "set_wire_in", "get_wire_out"};
+
+#define FPSTATS_ENDPOINTS       64  // wires 0x00-0x3F, pipes 0x80-0xBF (address & 0x3F)
+#define FPSTATS_ERROR_CODES     22  // index -rc for ErrorCode 0..-20, last index for other errors
+#define FPSTATS_HIST_BUCKETS    32  // bucket 0: < 1 us, bucket i: [2^(i-1), 2^i) us
+
+/// Plain copy of the counters of one operation / endpoint
+struct FPOpStats {
+    u64 calls;
+    u64 bytes;
+    u64 totalNs;
+    u64 errors[FPSTATS_ERROR_CODES];
+    u64 latency[FPSTATS_HIST_BUCKETS];
+};
+
+/// Lock-free counters of one operation / endpoint
+struct FPOpCounters {
+    std::atomic<u64> calls;
+    std::atomic<u64> bytes;
+    std::atomic<u64> totalNs;
+    std::atomic<u64> errors[FPSTATS_ERROR_CODES];
+    std::atomic<u64> latency[FPSTATS_HIST_BUCKETS];
+
+    void add(u64 size, int errorIndex, int bucket, u64 ns)
+    {
+        calls.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(size, std::memory_order_relaxed);
+        totalNs.fetch_add(ns, std::memory_order_relaxed);
+        if (errorIndex)
+            errors[errorIndex].fetch_add(1, std::memory_order_relaxed);
+        latency[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    FPOpStats snapshot() const
+    {
+        FPOpStats s;
+        s.calls = calls.load(std::memory_order_relaxed);
+        s.bytes = bytes.load(std::memory_order_relaxed);
+        s.totalNs = totalNs.load(std::memory_order_relaxed);
+        for (int i = 0; i < FPSTATS_ERROR_CODES; i++)
+            s.errors[i] = errors[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < FPSTATS_HIST_BUCKETS; i++)
+            s.latency[i] = latency[i].load(std::memory_order_relaxed);
+        return s;
+    }
+
+    void reset()
+    {
+        calls = 0;
+        bytes = 0;
+        totalNs = 0;
+        for (auto& e : errors) e = 0;
+        for (auto& l : latency) l = 0;
+    }
+};
+
+/// Transfer statistics per operation type and endpoint address
+class FPStats
+{
+public:
+    FPStats()
+    {
+        reset();
+    }
+
+    void record(FPOpType op, u32 address, u64 bytes, i64 rc, u64 ns)
+    {
+        int errorIndex = rc >= 0 ? 0 : (rc >= -(FPSTATS_ERROR_CODES - 2) ? static_cast<int>(-rc) : FPSTATS_ERROR_CODES - 1);
+        int bucket = latencyBucket(ns);
+        mTotal[op].add(bytes, errorIndex, bucket, ns);
+        if (hasEndpoints(op))
+            mEndpoints[op][address % FPSTATS_ENDPOINTS].add(bytes, errorIndex, bucket, ns);
+    }
+
+    void reset()
+    {
+        for (int op = 0; op < FPOP_COUNT; op++){
+            mTotal[op].reset();
+            for (auto& ep : mEndpoints[op])
+                ep.reset();
+        }
+    }
+
+    FPOpStats total(FPOpType op) const                  { return mTotal[op].snapshot(); }
+    FPOpStats endpoint(FPOpType op, u32 address) const  { return mEndpoints[op][address % FPSTATS_ENDPOINTS].snapshot(); }
+
+    /// Registers have 32 bit addresses, only the totals are kept for them
+    static bool hasEndpoints(FPOpType op)   { return op != FPOP_READ_REGISTER && op != FPOP_WRITE_REGISTER; }
+
+    /// Endpoint address of the statistics slot
+    static u32 endpointAddress(FPOpType op, u32 slot)
+    {
+        return (op == FPOP_READ_PIPE || op == FPOP_WRITE_PIPE) ? 0x80 | slot : slot;
+    }
+
+    static int latencyBucket(u64 ns)
+    {
+        u64 us = ns / 1000;
+        int bucket = 0;
+        while (us && bucket < FPSTATS_HIST_BUCKETS - 1){
+            us >>= 1;
+            bucket++;
+        }
+        return bucket;
+    }
+
+private:
+    FPOpCounters mTotal[FPOP_COUNT];
+    FPOpCounters mEndpoints[FPOP_COUNT][FPSTATS_ENDPOINTS];
+};
+
+#endif /* !FPSTATS_H */
@@ -0,0 +1,218 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef FPTRACE_H
+#define FPTRACE_H
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "common.h"
+#include "fpstats.h"
+
+/// One traced device operation
+struct FPTraceEvent {
+    i64 beginNs;
+    i64 endNs;
+    i64 rc;
+    u64 bytes;
+    u32 op;
+    u32 address;
+};
+
+/// Ring of events written by a single thread
+struct FPTraceThreadBuffer {
+    std::unique_ptr<FPTraceEvent[]> events;
+    size_t capacity;
+    std::atomic<u64> count;
+    u64 threadId;
+};
+
+/// Rings of one size for all threads
+struct FPTraceSession {
+    size_t capacity;
+    size_t maxThreads;
+    std::unique_ptr<FPTraceThreadBuffer[]> buffers;
+};
+
+/// Opt-in tracer of device operations. All buffers are allocated in start(),
+/// recording only writes into the calling thread's preallocated ring.
+/// Buffers are freed only with the tracer, a thread still recording into the rings of a
+/// previous start never writes to freed memory.
+/// The trace is exported in the Chrome trace-event JSON format (chrome://tracing, Perfetto).
+class FPTracer
+{
+public:
+    FPTracer()
+        : mRunning(false)
+        , mGeneration(0)
+        , mSession(nullptr)
+        , mThreadsUsed(0)
+        , mDropped(0)
+        , mStartNs(0)
+    {
+    }
+
+    /// Allocates eventsPerThread events for up to maxThreads threads and starts recording.
+    /// Buffers of a previous start with the same sizes are reused, buffers of other sizes are
+    /// kept until the tracer is destroyed.
+    void start(i64 nowNs, size_t eventsPerThread = 65536, size_t maxThreads = 16)
+    {
+        stop();
+        eventsPerThread = std::max(eventsPerThread, (size_t)1);
+        maxThreads = std::max(maxThreads, (size_t)1);
+        FPTraceSession* session = nullptr;
+        for (auto& s : mSessions)
+            if (s->capacity == eventsPerThread && s->maxThreads == maxThreads)
+                session = s.get();
+        if (!session){
+            session = new FPTraceSession{eventsPerThread, maxThreads, nullptr};
+            session->buffers.reset(new FPTraceThreadBuffer[maxThreads]);
+            for (size_t i = 0; i < maxThreads; i++){
+                session->buffers[i].events.reset(new FPTraceEvent[eventsPerThread]);
+                session->buffers[i].capacity = eventsPerThread;
+            }
+            mSessions.emplace_back(session);
+        }
+        for (size_t i = 0; i < maxThreads; i++){
+            session->buffers[i].count = 0;
+            session->buffers[i].threadId = 0;
+        }
+        mThreadsUsed = 0;
+        mDropped = 0;
+        mStartNs = nowNs;
+        mSession.store(session, std::memory_order_release);
+        mGeneration = nextGeneration();
+        mRunning.store(true, std::memory_order_release);
+    }
+
+    void stop()
+    {
+        mRunning.store(false, std::memory_order_release);
+    }
+
+    bool isRunning() const
+    {
+        return mRunning.load(std::memory_order_relaxed);
+    }
+
+    void record(FPOpType op, u32 address, u64 bytes, i64 rc, i64 beginNs, i64 endNs)
+    {
+        if (!mRunning.load(std::memory_order_acquire))
+            return;
+
+        FPTraceThreadBuffer* buffer = threadBuffer(mSession.load(std::memory_order_acquire));
+        if (!buffer){
+            mDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        u64 index = buffer->count.load(std::memory_order_relaxed);
+        FPTraceEvent& event = buffer->events[index % buffer->capacity];
+        event.beginNs = beginNs;
+        event.endNs = endNs;
+        event.rc = rc;
+        event.bytes = bytes;
+        event.op = op;
+        event.address = address;
+        buffer->count.store(index + 1, std::memory_order_release);
+    }
+
+    /// Writes the recorded events (the last eventsPerThread of each thread) to a JSON file.
+    /// Returns number of events written or -1 on error.
+    i64 dump(const char* fileName) const
+    {
+        FILE* file = fopen(fileName, "w");
+        if (!file)
+            return -1;
+
+        i64 written = 0;
+        fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"py_fp\"}}");
+        const FPTraceSession* session = mSession.load(std::memory_order_acquire);
+        size_t threads = session ? std::min(mThreadsUsed.load(std::memory_order_acquire), session->maxThreads) : 0;
+        for (size_t t = 0; t < threads; t++){
+            const FPTraceThreadBuffer& buffer = session->buffers[t];
+            u64 count = buffer.count.load(std::memory_order_acquire);
+            u64 first = count > buffer.capacity ? count - buffer.capacity : 0;
+            for (u64 i = first; i < count; i++){
+                const FPTraceEvent& e = buffer.events[i % buffer.capacity];
+                fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"fpdev\",\"ph\":\"X\",\"pid\":1,\"tid\":%llu,"
+                        "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"address\":\"0x%02X\",\"bytes\":%llu,\"rc\":%lld}}",
+                        e.op < FPOP_COUNT ? FPOP_NAMES[e.op] : "unknown", (unsigned long long)buffer.threadId,
+                        (e.beginNs - mStartNs) / 1000.0, (e.endNs - e.beginNs) / 1000.0,
+                        e.address, (unsigned long long)e.bytes, (long long)e.rc);
+                written++;
+            }
+        }
+        fprintf(file, "\n]}\n");
+        int rc = ferror(file);
+        fclose(file);
+        return rc ? -1 : written;
+    }
+
+    u64 droppedEvents() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+    static u32 nextGeneration()
+    {
+        static std::atomic<u32> generation(0);
+        return ++generation;
+    }
+
+    /// Buffer of the calling thread, claimed on the first event of a trace session
+    FPTraceThreadBuffer* threadBuffer(FPTraceSession* session)
+    {
+        struct CacheEntry { u32 generation; FPTraceSession* session; FPTraceThreadBuffer* buffer; };
+        static thread_local CacheEntry cache[4] = {};
+        static thread_local u32 next = 0;
+
+        if (!session)
+            return nullptr;
+        u32 generation = mGeneration;
+        for (auto& entry : cache)
+            if (entry.generation == generation && entry.session == session)
+                return entry.buffer;
+
+        size_t slot = mThreadsUsed.fetch_add(1, std::memory_order_acq_rel);
+        if (slot >= session->maxThreads)
+            return nullptr;
+
+        FPTraceThreadBuffer* buffer = &session->buffers[slot];
+        buffer->threadId = static_cast<u64>(std::hash<std::thread::id>()(std::this_thread::get_id()) & 0xFFFFFFFF);
+        cache[next++ % 4] = {generation, session, buffer};
+        return buffer;
+    }
+
+private:
+    std::atomic<bool> mRunning;
+    std::atomic<u32> mGeneration;
+    std::atomic<FPTraceSession*> mSession;
+    std::atomic<size_t> mThreadsUsed;
+    std::atomic<u64> mDropped;
+    i64 mStartNs;
+    std::vector<std::unique_ptr<FPTraceSession>> mSessions;    // all buffers ever allocated
+};
+
+#endif /* !FPTRACE_H */
@@ -0,0 +1,225 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#define NOMINMAX
+#include "fptransport.h"
+#include "fpsession.h"
+#include "fpsim.h"
+#include "okFrontPanelDLL.h"
+#include "strutils.h"
+
+FPTransport* FPTransport::create(const char* serial)
+{
+    if (str::starts_with(serial, "SIM:") || str::iequals(serial, "SIM"))
+        return new SimTransport();
+    if (str::starts_with(serial, "REPLAY:"))
+        return new ReplayTransport();
+    return new OkTransport();
+}
+
+//################################################################################
+//                      OK TRANSPORT
+//################################################################################
+
+OkTransport::OkTransport()
+    : mFp(new okCFrontPanel())
+{
+}
+
+OkTransport::~OkTransport()
+{
+    delete mFp;
+}
+
+bool OkTransport::loadLibrary(std::string& version)
+{
+    if (!okFrontPanelDLL_LoadLib(NULL))
+        return false;
+    char dllDate[32], dllTime[32];
+    okFrontPanelDLL_GetVersion(dllDate, dllTime);
+    version = str::format("%s %s", dllDate, dllTime);
+    return true;
+}
+
+std::vector<std::string> OkTransport::listSerials()
+{
+    std::vector<std::string> devs;
+    okCFrontPanel* fp = new okCFrontPanel();
+    int deviceCount = fp->GetDeviceCount();
+    for (int i = 0; i < deviceCount; i++)
+        devs.push_back(fp->GetDeviceListSerial(i));
+    delete fp;
+    return devs;
+}
+
+int OkTransport::openBySerial(const std::string& serial)
+{
+    return mFp->OpenBySerial(serial);
+}
+
+void OkTransport::close()
+{
+    mFp->Close();
+}
+
+bool OkTransport::isOpen()
+{
+    return mFp->IsOpen();
+}
+
+int OkTransport::getDeviceInfo(FPTransportInfo& info)
+{
+    okTDeviceInfo devInfo;
+    int rc = mFp->GetDeviceInfo(&devInfo);
+    info.deviceID = devInfo.deviceID;
+    info.serial = devInfo.serialNumber;
+    info.majorVersion = devInfo.deviceMajorVersion;
+    info.minorVersion = devInfo.deviceMinorVersion;
+    info.usb3Speed = devInfo.usbSpeed == OK_USBSPEED_SUPER;
+    info.deviceInterface = devInfo.deviceInterface;
+    info.usbSpeed = devInfo.usbSpeed;
+    info.boardModelId = static_cast<int>(mFp->GetBoardModel());
+    info.boardModel = mFp->GetBoardModelString(mFp->GetBoardModel());
+    info.hostInterfaceWidth = mFp->GetHostInterfaceWidth();
+    info.highSpeed = mFp->IsHighSpeed();
+    info.frontPanel3Supported = mFp->IsFrontPanel3Supported();
+    info.flashSectorCount = devInfo.flashSystem.sectorCount;
+    info.flashSectorSize = devInfo.flashSystem.sectorSize;
+    info.flashPageSize = devInfo.flashSystem.pageSize;
+    info.flashMinUserSector = devInfo.flashSystem.minUserSector;
+    info.flashMaxUserSector = devInfo.flashSystem.maxUserSector;
+    return rc;
+}
+
+int OkTransport::loadDefaultPLLConfiguration()
+{
+    return mFp->LoadDefaultPLLConfiguration();
+}
+
+int OkTransport::configureFPGA(const std::string& fileName)
+{
+    return mFp->ConfigureFPGA(fileName);
+}
+
+int OkTransport::configureFPGAFromFlash(u32 configIndex)
+{
+    return mFp->ConfigureFPGAFromFlash(configIndex);
+}
+
+bool OkTransport::isFrontPanelEnabled()
+{
+    return mFp->IsFrontPanelEnabled();
+}
+
+void OkTransport::setTimeout(int timeout)
+{
+    mFp->SetTimeout(timeout);
+}
+
+int OkTransport::resetFPGA()
+{
+    return mFp->ResetFPGA();
+}
+
+std::string OkTransport::getDeviceID()
+{
+    return mFp->GetDeviceID();
+}
+
+void OkTransport::setDeviceID(const std::string& deviceID)
+{
+    mFp->SetDeviceID(deviceID);
+}
+
+int OkTransport::setWireInValue(u32 address, u32 value, u32 mask)
+{
+    return mFp->SetWireInValue(address, value, mask);
+}
+
+int OkTransport::getWireInValue(u32 address, u32* value)
+{
+    return mFp->GetWireInValue(address, value);
+}
+
+void OkTransport::updateWireIns()
+{
+    mFp->UpdateWireIns();
+}
+
+void OkTransport::updateWireOuts()
+{
+    mFp->UpdateWireOuts();
+}
+
+u32 OkTransport::getWireOutValue(u32 address)
+{
+    return static_cast<u32>(mFp->GetWireOutValue(address));
+}
+
+int OkTransport::activateTriggerIn(u32 address, int bit)
+{
+    return mFp->ActivateTriggerIn(address, bit);
+}
+
+void OkTransport::updateTriggerOuts()
+{
+    mFp->UpdateTriggerOuts();
+}
+
+bool OkTransport::isTriggered(u32 address, u32 mask)
+{
+    return mFp->IsTriggered(address, mask);
+}
+
+int OkTransport::writeRegister(u32 address, u32 value)
+{
+    return mFp->WriteRegister(address, value);
+}
+
+int OkTransport::readRegister(u32 address, u32* value)
+{
+    return mFp->ReadRegister(address, value);
+}
+
+long OkTransport::writeToBlockPipeIn(u32 address, int blockSize, long length, const byte* data)
+{
+    return mFp->WriteToBlockPipeIn(address, blockSize, length, const_cast<byte*>(data));
+}
+
+long OkTransport::readFromBlockPipeOut(u32 address, int blockSize, long length, byte* data)
+{
+    return mFp->ReadFromBlockPipeOut(address, blockSize, length, data);
+}
+
+int OkTransport::flashEraseSector(u32 address)
+{
+    return mFp->FlashEraseSector(address);
+}
+
+int OkTransport::flashWrite(u32 address, u32 length, const byte* data)
+{
+    return mFp->FlashWrite(address, length, data);
+}
+
+int OkTransport::flashRead(u32 address, u32 length, byte* data)
+{
+    return mFp->FlashRead(address, length, data);
+}
@@ -0,0 +1,168 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef FPTRANSPORT_H
+#define FPTRANSPORT_H
+#include <string>
+#include <vector>
+#include "common.h"
+
+// Error codes of the FrontPanel library (okCFrontPanel::ErrorCode)
+#define FP_NO_ERROR                 0
+#define FP_FAILED                   -1
+#define FP_TIMEOUT                  -2
+#define FP_DONE_NOT_HIGH            -3
+#define FP_TRANSFER_ERROR           -4
+#define FP_COMMUNICATION_ERROR      -5
+#define FP_INVALID_BITSTREAM        -6
+#define FP_FILE_ERROR               -7
+#define FP_DEVICE_NOT_OPEN          -8
+#define FP_INVALID_ENDPOINT         -9
+#define FP_INVALID_BLOCK_SIZE       -10
+#define FP_UNSUPPORTED_FEATURE      -15
+#define FP_FIFO_UNDERFLOW           -16
+#define FP_FIFO_OVERFLOW            -17
+#define FP_DATA_ALIGNMENT_ERROR     -18
+#define FP_INVALID_PARAMETER        -20
+
+// Host interfaces and USB speeds (OK_INTERFACE_*, OK_USBSPEED_*)
+#define FP_INTERFACE_UNKNOWN        0
+#define FP_INTERFACE_USB2           1
+#define FP_INTERFACE_PCIE           2
+#define FP_INTERFACE_USB3           3
+#define FP_USBSPEED_UNKNOWN         0
+#define FP_USBSPEED_FULL            1
+#define FP_USBSPEED_HIGH            2
+#define FP_USBSPEED_SUPER           3
+
+/// Device information reported by a transport after it was opened
+struct FPTransportInfo {
+    std::string deviceID;
+    std::string serial;
+    std::string boardModel;
+    int boardModelId;
+    int deviceInterface;
+    int usbSpeed;
+    int hostInterfaceWidth;
+    bool highSpeed;
+    bool frontPanel3Supported;
+    int majorVersion;
+    int minorVersion;
+    bool usb3Speed;
+    u32 flashSectorCount;
+    u32 flashSectorSize;
+    u32 flashPageSize;
+    u32 flashMinUserSector;
+    u32 flashMaxUserSector;
+};
+
+/// Connection to a single FrontPanel device. The methods follow okCFrontPanel,
+/// so that FPDev can run on real hardware as well as on a simulated device.
+class FPTransport
+{
+public:
+    virtual ~FPTransport() {}
+
+    /// Creates transport for the serial: "SIM:<options>" is a simulated device, "REPLAY:<file>"
+    /// a recorded session, anything else a real device opened by the FrontPanel library.
+    static FPTransport* create(const char* serial);
+
+    virtual int openBySerial(const std::string& serial) = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() = 0;
+    virtual int getDeviceInfo(FPTransportInfo& info) = 0;
+    virtual int loadDefaultPLLConfiguration() = 0;
+    virtual int configureFPGA(const std::string& fileName) = 0;
+    virtual int configureFPGAFromFlash(u32 configIndex) = 0;
+    virtual bool isFrontPanelEnabled() = 0;
+    virtual void setTimeout(int timeout) = 0;
+    virtual int resetFPGA() = 0;
+    virtual std::string getDeviceID() = 0;
+    virtual void setDeviceID(const std::string& deviceID) = 0;
+
+    virtual int setWireInValue(u32 address, u32 value, u32 mask = 0xFFFFFFFF) = 0;
+    virtual int getWireInValue(u32 address, u32* value) = 0;
+    virtual void updateWireIns() = 0;
+    virtual void updateWireOuts() = 0;
+    virtual u32 getWireOutValue(u32 address) = 0;
+    virtual int activateTriggerIn(u32 address, int bit) = 0;
+    virtual void updateTriggerOuts() = 0;
+    virtual bool isTriggered(u32 address, u32 mask) = 0;
+
+    virtual int writeRegister(u32 address, u32 value) = 0;
+    virtual int readRegister(u32 address, u32* value) = 0;
+    virtual long writeToBlockPipeIn(u32 address, int blockSize, long length, const byte* data) = 0;
+    virtual long readFromBlockPipeOut(u32 address, int blockSize, long length, byte* data) = 0;
+
+    virtual int flashEraseSector(u32 address) = 0;
+    virtual int flashWrite(u32 address, u32 length, const byte* data) = 0;
+    virtual int flashRead(u32 address, u32 length, byte* data) = 0;
+};
+
+namespace OpalKellyLegacy{
+class okCFrontPanel;
+}
+
+/// Transport to a real device through the FrontPanel library
+class OkTransport : public FPTransport
+{
+public:
+    OkTransport();
+    virtual ~OkTransport();
+    static bool loadLibrary(std::string& version);
+    static std::vector<std::string> listSerials();
+
+    int openBySerial(const std::string& serial) override;
+    void close() override;
+    bool isOpen() override;
+    int getDeviceInfo(FPTransportInfo& info) override;
+    int loadDefaultPLLConfiguration() override;
+    int configureFPGA(const std::string& fileName) override;
+    int configureFPGAFromFlash(u32 configIndex) override;
+    bool isFrontPanelEnabled() override;
+    void setTimeout(int timeout) override;
+    int resetFPGA() override;
+    std::string getDeviceID() override;
+    void setDeviceID(const std::string& deviceID) override;
+
+    int setWireInValue(u32 address, u32 value, u32 mask = 0xFFFFFFFF) override;
+    int getWireInValue(u32 address, u32* value) override;
+    void updateWireIns() override;
+    void updateWireOuts() override;
+    u32 getWireOutValue(u32 address) override;
+    int activateTriggerIn(u32 address, int bit) override;
+    void updateTriggerOuts() override;
+    bool isTriggered(u32 address, u32 mask) override;
+
+    int writeRegister(u32 address, u32 value) override;
+    int readRegister(u32 address, u32* value) override;
+    long writeToBlockPipeIn(u32 address, int blockSize, long length, const byte* data) override;
+    long readFromBlockPipeOut(u32 address, int blockSize, long length, byte* data) override;
+
+    int flashEraseSector(u32 address) override;
+    int flashWrite(u32 address, u32 length, const byte* data) override;
+    int flashRead(u32 address, u32 length, byte* data) override;
+
+private:
+    OpalKellyLegacy::okCFrontPanel* mFp;
+};
+
+#endif /* !FPTRANSPORT_H */
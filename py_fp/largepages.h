@@ -0,0 +1,279 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef LARGEPAGES_H
+#define LARGEPAGES_H
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include "buffer.h"
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && !defined(MADV_POPULATE_WRITE)
+#define MADV_POPULATE_WRITE 23
+#endif
+
+#define LARGEPAGES_HUGE_PAGE_SIZE   (2u << 20)
+
+/// How the memory of large buffers is prepared
+enum LargePageFlags {
+    LARGEPAGE_HUGE = 0x01,          // huge pages: MAP_HUGETLB, transparent huge pages (madvise) or large pages on Windows
+    LARGEPAGE_PREFAULT = 0x02,      // all pages are faulted in before the buffer is handed out
+    LARGEPAGE_LOCK = 0x04,          // pages are locked in memory (mlock / VirtualLock)
+};
+
+/// Memory handed out by a LargePageAllocator
+struct LargePageStats {
+    size_t mappedBytes;         // memory mapped for the buffers that are allocated
+    size_t hugePageBytes;       // part of it backed by huge pages (explicit or transparent)
+    size_t lockedBytes;         // part of it locked in memory
+    unsigned long long hugePageFallbacks;   // buffers that got regular pages instead of huge ones
+    unsigned long long lockFailures;        // buffers that could not be locked (RLIMIT_MEMLOCK)
+};
+
+/// Allocator of multi-MB transfer buffers that takes the page faults out of the transfer. The
+/// memory is mapped directly from the OS, backed by huge pages if requested and available, faulted
+/// in and optionally locked before it is returned. Each step falls back silently: no huge pages
+/// gives regular pages, a failed lock an unlocked buffer. Without flags it is the plain heap.
+class LargePageAllocator : public BufferAllocator
+{
+public:
+    explicit LargePageAllocator(int flags = 0)
+        : mFlags(flags)
+        , mHugePageBytes(0)
+        , mLockedBytes(0)
+        , mHugePageFallbacks(0)
+        , mLockFailures(0)
+    {
+    }
+
+    virtual ~LargePageAllocator()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto& mapping : mMappings)
+            unmap(mapping.first, mapping.second.size);
+    }
+
+    /// Flags (LargePageFlags) of the buffers allocated from now on
+    void setFlags(int flags) { mFlags = flags; }
+    int flags() const { return mFlags; }
+
+    LargePageStats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        LargePageStats stats;
+        stats.mappedBytes = 0;
+        for (auto& mapping : mMappings)
+            stats.mappedBytes += mapping.second.size;
+        stats.hugePageBytes = mHugePageBytes;
+        stats.lockedBytes = mLockedBytes;
+        stats.hugePageFallbacks = mHugePageFallbacks;
+        stats.lockFailures = mLockFailures;
+        return stats;
+    }
+
+public:
+    void* allocate(size_t bytes, size_t alignment, size_t& capacity) override
+    {
+        int flags = mFlags;
+        if (!flags || alignment > pageSize()){
+            capacity = bytes;
+            return alignedAlloc(bytes, alignment);
+        }
+
+        Mapping mapping = {0, false, false};
+        void* data = map(bytes, flags, mapping);
+        if (!data)
+            throw std::bad_alloc();
+        if (flags & LARGEPAGE_PREFAULT)
+            prefault(data, mapping.size);
+        if (flags & LARGEPAGE_LOCK){
+            mapping.locked = lockMemory(data, mapping.size);
+            if (!mapping.locked)
+                mLockFailures++;
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mMappings[data] = mapping;
+        if (mapping.huge)
+            mHugePageBytes += mapping.size;
+        if (mapping.locked)
+            mLockedBytes += mapping.size;
+        capacity = mapping.size;
+        return data;
+    }
+
+    void deallocate(void* data, size_t capacity) override
+    {
+        (void)capacity;
+        if (!data)
+            return;
+        Mapping mapping;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto it = mMappings.find(data);
+            if (it == mMappings.end()){
+                alignedFree(data);
+                return;
+            }
+            mapping = it->second;
+            mMappings.erase(it);
+            if (mapping.huge)
+                mHugePageBytes -= mapping.size;
+            if (mapping.locked)
+                mLockedBytes -= mapping.size;
+        }
+        unmap(data, mapping.size);
+    }
+
+    static size_t pageSize()
+    {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwPageSize;
+#else
+        static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return size;
+#endif
+    }
+
+private:
+    struct Mapping {
+        size_t size;
+        bool huge;
+        bool locked;
+    };
+
+    static size_t roundUp(size_t value, size_t multiple)
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    void* map(size_t bytes, int flags, Mapping& mapping)
+    {
+#ifdef _WIN32
+        if (flags & LARGEPAGE_HUGE){
+            // needs the SeLockMemoryPrivilege, large pages are always locked
+            size_t largePage = GetLargePageMinimum();
+            if (largePage){
+                mapping.size = roundUp(bytes, largePage);
+                void* data = VirtualAlloc(NULL, mapping.size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+                if (data){
+                    mapping.huge = true;
+                    return data;
+                }
+            }
+            mHugePageFallbacks++;
+        }
+        mapping.size = roundUp(bytes, pageSize());
+        return VirtualAlloc(NULL, mapping.size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+        if (flags & LARGEPAGE_HUGE){
+            size_t hugeSize = roundUp(bytes, LARGEPAGES_HUGE_PAGE_SIZE);
+#ifdef MAP_HUGETLB
+            // explicit huge pages, only if the administrator reserved them (vm.nr_hugepages)
+            void* huge = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (huge != MAP_FAILED){
+                mapping.size = hugeSize;
+                mapping.huge = true;
+                return huge;
+            }
+#endif
+#ifdef MADV_HUGEPAGE
+            // transparent huge pages need a 2 MB aligned range: map more and cut off the ends
+            size_t size = hugeSize + LARGEPAGES_HUGE_PAGE_SIZE;
+            void* raw = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (raw == MAP_FAILED)
+                return NULL;
+            char* begin = static_cast<char*>(raw);
+            char* data = reinterpret_cast<char*>(roundUp(reinterpret_cast<size_t>(begin), LARGEPAGES_HUGE_PAGE_SIZE));
+            if (data > begin)
+                munmap(begin, data - begin);
+            if (begin + size > data + hugeSize)
+                munmap(data + hugeSize, begin + size - (data + hugeSize));
+            mapping.size = hugeSize;
+            mapping.huge = madvise(data, hugeSize, MADV_HUGEPAGE) == 0;
+            if (!mapping.huge)
+                mHugePageFallbacks++;
+            return data;
+#else
+            mHugePageFallbacks++;
+#endif
+        }
+        mapping.size = roundUp(bytes, pageSize());
+        void* data = mmap(NULL, mapping.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return data == MAP_FAILED ? NULL : data;
+#endif
+    }
+
+    static void unmap(void* data, size_t size)
+    {
+#ifdef _WIN32
+        (void)size;
+        VirtualFree(data, 0, MEM_RELEASE);
+#else
+        munmap(data, size);
+#endif
+    }
+
+    // Writes to every page, so the transfer does not take the faults
+    static void prefault(void* data, size_t size)
+    {
+#ifdef __linux__
+        if (madvise(data, size, MADV_POPULATE_WRITE) == 0)
+            return;
+#endif
+        volatile char* bytes = static_cast<volatile char*>(data);
+        const size_t step = pageSize();
+        for (size_t offset = 0; offset < size; offset += step)
+            bytes[offset] = 0;
+    }
+
+    static bool lockMemory(void* data, size_t size)
+    {
+#ifdef _WIN32
+        return VirtualLock(data, size) != 0;
+#else
+        return mlock(data, size) == 0;
+#endif
+    }
+
+private:
+    std::atomic<int> mFlags;
+    mutable std::mutex mMutex;
+    std::unordered_map<void*, Mapping> mMappings;
+    size_t mHugePageBytes;
+    size_t mLockedBytes;
+    std::atomic<unsigned long long> mHugePageFallbacks;
+    std::atomic<unsigned long long> mLockFailures;
+};
+
+#endif /* !LARGEPAGES_H */
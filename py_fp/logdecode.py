@@ -0,0 +1,136 @@
+"""Decoder of binary logs (BinLog, binlog.h) into the FileLog text format.
+
+    python -m py_fp.logdecode <file.fpbl> [-o <file.log>]
+
+The file starts with the magic FPBLOG01 followed by records [u8 kind][u32 size][payload]:
+format records define a printf format string with the types of its arguments, message
+records hold the format id, the time in ns since the epoch and the raw argument values.
+Values are in the byte order of the host that wrote the log, which must match this one.
+"""
+import argparse
+import re
+import struct
+import sys
+import time
+
+MAGIC = b"FPBLOG01"
+RECORD_FORMAT = 1
+RECORD_MESSAGE = 2
+LOG_PREFIX = ["FAIL", "!ERR", " MSG", "DBG"]
+
+# flags, width and precision, length modifiers, conversion
+SPEC = re.compile(r"%%|%([-+ #0]*[0-9.]*)[hlLqjzt]*([diouxXfFeEgGaAcsp])")
+FIXED = {"i": "=i", "I": "=q", "u": "=I", "U": "=Q", "d": "=d", "p": "=Q"}
+
+
+def read_args(types, data):
+    args = []
+    pos = 0
+    for code in types:
+        if code == "s":
+            (length,) = struct.unpack_from("=H", data, pos)
+            pos += 2
+            args.append(data[pos:pos + length].decode("utf-8", "replace"))
+            pos += length
+        else:
+            fmt = FIXED[code]
+            args.append(struct.unpack_from(fmt, data, pos)[0])
+            pos += struct.calcsize(fmt)
+    return args
+
+
+def format_arg(spec, conv, code, value):
+    if code == "s":
+        return ("%" + spec + "s") % value if conv == "s" else value
+    if conv in "di":
+        return ("%" + spec + "d") % int(value)
+    if conv in "ouxX":
+        value = int(value)
+        if code == "i":
+            value &= 0xFFFFFFFF
+        elif value < 0:
+            value &= 0xFFFFFFFFFFFFFFFF
+        return ("%" + spec + ("d" if conv == "u" else conv)) % value
+    if conv in "fFeEgG":
+        return ("%" + spec + conv) % float(value)
+    if conv in "aA":
+        text = float(value).hex()
+        return text.upper() if conv == "A" else text
+    if conv == "c":
+        return ("%" + spec + "c") % (int(value) & 0xFF)
+    if conv == "p":
+        return ("%" + spec + "s") % ("0x%x" % value if value else "(nil)")
+    return str(value)
+
+
+def format_message(fmt, types, data):
+    args = iter(zip(types, read_args(types, data)))
+
+    def replace(match):
+        if match.group(0) == "%%":
+            return "%"
+        item = next(args, None)
+        if item is None:
+            return match.group(0)
+        return format_arg(match.group(1), match.group(2), item[0], item[1])
+
+    return SPEC.sub(replace, fmt)
+
+
+def format_time(time_ns):
+    seconds, rest = divmod(time_ns, 1000000000)
+    return time.strftime("%d-%m-%y %H:%M:%S.", time.localtime(seconds)) + str(rest // 1000000)
+
+
+def decode(file_name):
+    """Yields the messages of a binary log as text lines"""
+    formats = {}
+    with open(file_name, "rb") as f:
+        if f.read(len(MAGIC)) != MAGIC:
+            raise ValueError("%s is not a binary log" % file_name)
+        while True:
+            header = f.read(5)
+            if len(header) < 5:
+                return
+            kind, size = struct.unpack("=BI", header)
+            payload = f.read(size)
+            if len(payload) < size:
+                return
+            if kind == RECORD_FORMAT:
+                format_id, level, types_size = struct.unpack_from("=IBH", payload)
+                pos = 7
+                types = payload[pos:pos + types_size].decode("ascii")
+                pos += types_size
+                (format_size,) = struct.unpack_from("=I", payload, pos)
+                pos += 4
+                formats[format_id] = (level, types, payload[pos:pos + format_size].decode("utf-8", "replace"))
+            elif kind == RECORD_MESSAGE:
+                format_id, time_ns = struct.unpack_from("=Iq", payload)
+                if format_id not in formats:
+                    continue
+                level, types, fmt = formats[format_id]
+                prefix = LOG_PREFIX[min(max(level, 0), len(LOG_PREFIX) - 1)]
+                yield "(%s) [%s]: %s\n" % (format_time(time_ns), prefix, format_message(fmt, types, payload[12:]))
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(prog="python -m py_fp.logdecode", description=__doc__.splitlines()[0])
+    parser.add_argument("file", help="binary log file")
+    parser.add_argument("-o", "--output", help="text log file (default stdout)")
+    args = parser.parse_args(argv)
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    try:
+        for line in decode(args.file):
+            out.write(line)
+    except (OSError, ValueError) as e:
+        sys.stderr.write("%s\n" % e)
+        return 1
+    finally:
+        if args.output:
+            out.close()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
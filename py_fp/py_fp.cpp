@@ -25,37 +25,276 @@ SOFTWARE.
 #include "filelog.h"
 #include "fpdev.h"
 #include "buffer.h"
+#include "bufferpool.h"
 #include "commonpython.h"
+#include "strutils.h"
 
 
 struct DeviceData
 {
 };
 
+// Forwards the messages of a FileLog to a Python logging.Logger. The logging threads only queue
+// the messages and never wait for the GIL. The queue is delivered in batches by drain(), which is
+// scheduled on the main thread with Py_AddPendingCall when the first message of a batch arrives,
+// or called directly by drain_log(). The sink is reference counted, the device and every
+// scheduled drain hold a reference, the last one is released with the GIL held.
+class PyLogSink : public LogSink
+{
+public:
+    PyLogSink(PyObject* logger, size_t queueSize)
+        : mLogger(logger)
+        , mQueueSize(queueSize)
+        , mScheduled(false)
+        , mDropped(0)
+        , mRefs(1)
+    {
+        Py_INCREF(mLogger);
+    }
+
+    void write(LogLevel logLevel, const std::string& text) override
+    {
+        bool schedule = false;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mRecords.size() >= mQueueSize){
+                mDropped++;
+                return;
+            }
+            mRecords.push_back(Record{logLevel, std::chrono::system_clock::now(), text});
+            schedule = !mScheduled;
+            mScheduled = true;
+        }
+        if (schedule){
+            mRefs++;
+            if (Py_AddPendingCall(pendingDrain, this) != 0){
+                // the pending call queue is full, the next message tries again
+                std::lock_guard<std::mutex> lock(mMutex);
+                mScheduled = false;
+                mRefs--;
+            }
+        }
+    }
+
+    // Delivers the queued messages, returns their number. Called with the GIL held.
+    Py_ssize_t drain()
+    {
+        std::deque<Record> records;
+        unsigned long long dropped;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            records.swap(mRecords);
+            dropped = mDropped;
+            mDropped = 0;
+            mScheduled = false;
+        }
+        for (const Record& record : records)
+            deliver(record);
+        if (dropped)
+            deliver(Record{LOG_ERR, std::chrono::system_clock::now(),
+                           str::format("%llu log messages dropped, the log handler queue was full.", dropped)});
+        return static_cast<Py_ssize_t>(records.size());
+    }
+
+    // Called with the GIL held
+    void release()
+    {
+        if (--mRefs == 0)
+            delete this;
+    }
+
+private:
+    struct Record {
+        LogLevel level;
+        std::chrono::system_clock::time_point time;
+        std::string text;
+    };
+
+    ~PyLogSink()
+    {
+        Py_DECREF(mLogger);
+    }
+
+    static int pendingDrain(void* arg)
+    {
+        PyLogSink* sink = static_cast<PyLogSink*>(arg);
+        sink->drain();
+        sink->release();
+        return 0;
+    }
+
+    // Passes the message to the logger as a record with the time it was logged at, not the
+    // time of the delivery
+    void deliver(const Record& record)
+    {
+        static const int levels[] = {50, 40, 20, 10};     // CRITICAL, ERROR, INFO, DEBUG
+        int level = levels[std::min(std::max(static_cast<int>(record.level), 0), 3)];
+        PyObject* enabled = PyObject_CallMethod(mLogger, "isEnabledFor", "i", level);
+        if (!enabled || !PyObject_IsTrue(enabled)){
+            if (!enabled)
+                PyErr_WriteUnraisable(mLogger);
+            Py_XDECREF(enabled);
+            return;
+        }
+        Py_DECREF(enabled);
+
+        PyObject* name = PyObject_GetAttrString(mLogger, "name");
+        PyObject* rec = name ? PyObject_CallMethod(mLogger, "makeRecord", "OisisOO", name, level, "py_fp", 0,
+                                                   record.text.c_str(), Py_None, Py_None) : NULL;
+        Py_XDECREF(name);
+        if (rec){
+            double created = std::chrono::duration<double>(record.time.time_since_epoch()).count();
+            PyObject* value = PyFloat_FromDouble(created);
+            PyObject_SetAttrString(rec, "created", value);
+            Py_DECREF(value);
+            value = PyFloat_FromDouble(std::floor((created - std::floor(created)) * 1000.0));
+            PyObject_SetAttrString(rec, "msecs", value);
+            Py_DECREF(value);
+            PyObject* res = PyObject_CallMethod(mLogger, "handle", "O", rec);
+            Py_DECREF(rec);
+            if (res){
+                Py_DECREF(res);
+                return;
+            }
+        }
+        PyErr_WriteUnraisable(mLogger);
+    }
+
+private:
+    PyObject* mLogger;
+    size_t mQueueSize;
+    std::mutex mMutex;
+    std::deque<Record> mRecords;
+    bool mScheduled;
+    unsigned long long mDropped;
+    std::atomic<int> mRefs;
+};
+
+// py_fp.Buffer: memory allocated once and reused by the pipe methods. Slices are views that share
+// the memory of the buffer they were taken from and keep it alive.
+typedef struct {
+    PyObject_HEAD
+    Buffer<byte>* buff;     // memory of the buffer, NULL for a view
+    PyObject* base;         // buffer that owns the memory of a view
+    byte* data;
+    Py_ssize_t size;
+    Py_ssize_t alignment;
+} FPBuffer;
+
+extern PyTypeObject BufferType;
+
 typedef struct {
     PyObject_HEAD
     FPDev* dev;
     FileLog* log;
+    PyLogSink* logSink;
+    PyObject* wireOutCallback;
+    int calls;      // calls using dev without the GIL, changed with the GIL held
 } Device;
 
+// Marks a call that uses the device with the GIL released (or runs Python code that may release
+// it). device_release waits until there are none before it deletes the device. The calls of a
+// thread are chained, so that a call can tell that its own thread is inside a call of the device.
+class DeviceCall
+{
+public:
+    DeviceCall(Device* self) : mSelf(self), mDev(self->dev), mPrev(tCalls)
+    {
+        mSelf->calls++;
+        tCalls = this;
+    }
+
+    ~DeviceCall()
+    {
+        tCalls = mPrev;
+        mSelf->calls--;
+    }
+
+    FPDev* dev() const { return mDev; }
+
+    static bool inCall(const Device* self)
+    {
+        for (const DeviceCall* call = tCalls; call; call = call->mPrev)
+            if (call->mSelf == self)
+                return true;
+        return false;
+    }
+
+private:
+    Device* mSelf;
+    FPDev* mDev;
+    DeviceCall* mPrev;
+    static thread_local DeviceCall* tCalls;
+};
+
+thread_local DeviceCall* DeviceCall::tCalls = nullptr;
+
 static int device_init(Device *self, PyObject *args, PyObject *kwds)
 {
     self->dev = NULL;
     self->log = NULL;
+    self->logSink = NULL;
+    self->wireOutCallback = NULL;
+    self->calls = 0;
     return 0;
 }
 
-static void device_dealloc(Device *self)
+// Detaches the Python log handler, the messages queued so far are still delivered
+static void device_releaseLogSink(Device *self)
 {
-    if (self->dev){
-        delete self->dev;
-        self->dev = NULL;
+    if (self->logSink){
+        PyLogSink* sink = self->logSink;
+        self->logSink = NULL;
+        if (self->log)
+            self->log->setSink(NULL);
+        sink->drain();
+        sink->release();
     }
+}
 
+static void device_deleteLog(Device *self)
+{
+    device_releaseLogSink(self);
     if (self->log){
         delete self->log;
         self->log = NULL;
     }
+}
+
+// Closes and deletes the device. The GIL is released, because the wire-out
+// watcher thread may be waiting for it while it is being stopped. Closing wakes up
+// the threads waiting for wire-out events, the device is deleted after all calls
+// running without the GIL have returned.
+static int device_release(Device *self)
+{
+    int rc = 0;
+    if (self->dev && DeviceCall::inCall(self)){
+        PyErr_SetString(PyExc_RuntimeError, "Device cannot be closed or reopened from its own callback.");
+        return -1;
+    }
+    if (self->dev){
+        FPDev* dev = self->dev;
+        self->dev = NULL;
+        Py_BEGIN_ALLOW_THREADS
+        rc = dev->close();
+        Py_END_ALLOW_THREADS
+        while (self->calls){
+            Py_BEGIN_ALLOW_THREADS
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            Py_END_ALLOW_THREADS
+        }
+        Py_BEGIN_ALLOW_THREADS
+        delete dev;
+        Py_END_ALLOW_THREADS
+    }
+    Py_CLEAR(self->wireOutCallback);
+    return rc;
+}
+
+static void device_dealloc(Device *self)
+{
+    device_release(self);
+    device_deleteLog(self);
 
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
@@ -78,16 +317,19 @@ static PyObject* device_listDevices(Device *self, PyObject *args)
     return list;
 }
 
-static PyObject* device_open(Device *self, PyObject *args)
+static PyObject* device_open(Device *self, PyObject *args, PyObject *kwds)
 {
     const char* firmware;
     const char* logfile;
     const char* serial;
-    if (!PyArg_ParseTuple(args, "sss", &serial, &firmware, &logfile))
+    int flashIndex = -1;
+    static const char* kwlist[] = {"serial", "firmware", "logfile", "flash_index", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "sss|i", (char**)kwlist, &serial, &firmware, &logfile, &flashIndex))
         return NULL;
 
-    if (self->dev) delete self->dev;
-    if (self->log) {delete self->log; self->log = NULL;}
+    if (device_release(self) < 0 && PyErr_Occurred())
+        return NULL;
+    device_deleteLog(self);
 
     if (logfile){
         self->log = new FileLog(logfile, true, false);
@@ -95,23 +337,16 @@ static PyObject* device_open(Device *self, PyObject *args)
     }
 
     self->dev = new FPDev();
-    int rc = self->dev->open(serial, firmware);
+    int rc = self->dev->open(serial, firmware, flashIndex);
     return Py_BuildValue("i", rc);
 }
 
 static PyObject* device_close(Device *self, PyObject *args)
 {
-    int rc = 0;
-    if (self->dev){
-        rc = self->dev->close();
-        delete self->dev;
-        self->dev = NULL;
-    }
-
-    if (self->log){
-        delete self->log;
-        self->log = NULL;
-    }
+    int rc = device_release(self);
+    if (rc < 0 && PyErr_Occurred())
+        return NULL;
+    device_deleteLog(self);
 
     return Py_BuildValue("i", rc);
 }
@@ -134,8 +369,57 @@ static PyObject* device_setWireIn(Device *self, PyObject *args)
     return Py_BuildValue("i", rc);
 }
 
+// int setWireInBits(u32 address, u32 mask, u32 value, bool sendNow=true);
+static PyObject* device_setWireInBits(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    unsigned address, mask, value;
+    int sendNow = 1;
+    if (!PyArg_ParseTuple(args, "III|i", &address, &mask, &value, &sendNow))
+        return NULL;
+
+    int rc = self->dev->setWireInBits(address, mask, value, sendNow);
+    return Py_BuildValue("i", rc);
+}
+
+// int updateWireIns(bool force=false);
+static PyObject* device_updateWireIns(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    int force = 0;
+    if (!PyArg_ParseTuple(args, "|i", &force))
+        return NULL;
+
+    int rc = self->dev->updateWireIns(force);
+    return Py_BuildValue("i", rc);
+}
+
+// i64 getWireIn(u32 address);
+static PyObject* device_getWireIn(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    unsigned address;
+    if (!PyArg_ParseTuple(args, "I", &address))
+        return NULL;
+
+    return PyLong_FromLongLong(self->dev->getWireIn(address));
+}
+
 // i64 getWireOut(u32 address, bool refreshWireOuts=true);
-static PyObject* device_getWireOut(Device *self, PyObject *args)
+// i64 getWireOutCached(u32 address, u64 maxAgeUs);
+static PyObject* device_getWireOut(Device *self, PyObject *args, PyObject *kwds)
 {
     if (!self->dev){
         PyErr_SetString(PyExc_IOError, "Device not opened.");
@@ -143,15 +427,123 @@ static PyObject* device_getWireOut(Device *self, PyObject *args)
     }
 
     unsigned address;
-    int refresh;
-    if (!PyArg_ParseTuple(args, "Ii", &address, &refresh))
+    int refresh = 1;
+    long long maxAgeUs = -1;
+    static const char* kwlist[] = {"address", "refresh_wires", "max_age_us", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "I|iL", (char**)kwlist, &address, &refresh, &maxAgeUs))
         return NULL;
 
-    i64 rc = self->dev->getWireOut(address, refresh);
+    i64 rc = maxAgeUs >= 0 ? self->dev->getWireOutCached(address, (u64)maxAgeUs) : self->dev->getWireOut(address, refresh);
     //return Py_BuildValue("l", rc);
     return PyLong_FromLongLong(rc);
 }
 
+static PyObject* wireOutEventsToList(const std::vector<FPWireOutEvent>& events)
+{
+    PyObject* list = PyList_New(events.size());
+    for (size_t i = 0; i < events.size(); i++)
+        PyList_SET_ITEM(list, i, Py_BuildValue("(IIIK)", events[i].address, events[i].oldValue,
+                                               events[i].newValue, (unsigned long long)events[i].timestampUs));
+    return list;
+}
+
+// int startWireOutWatcher(u32 periodUs, u32 addressMask=0xFFFFFFFF, FPWireOutCallback callback=nullptr, size_t queueSize=4096);
+static PyObject* device_startWireOutWatcher(Device *self, PyObject *args, PyObject *kwds)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    unsigned periodUs = 1000;
+    unsigned mask = 0xFFFFFFFF;
+    PyObject* callback = Py_None;
+    Py_ssize_t queueSize = 4096;
+    static const char* kwlist[] = {"period_us", "mask", "callback", "queue_size", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|IIOn", (char**)kwlist, &periodUs, &mask, &callback, &queueSize))
+        return NULL;
+
+    if (callback != Py_None && !PyCallable_Check(callback)){
+        PyErr_SetString(PyExc_TypeError, "callback must be callable.");
+        return NULL;
+    }
+
+    {
+        DeviceCall call(self);
+        Py_BEGIN_ALLOW_THREADS
+        call.dev()->stopWireOutWatcher();
+        Py_END_ALLOW_THREADS
+    }
+    Py_CLEAR(self->wireOutCallback);
+
+    FPWireOutCallback callbackFunc = nullptr;
+    if (callback != Py_None){
+        Py_INCREF(callback);
+        self->wireOutCallback = callback;
+        callbackFunc = [self, callback](const std::vector<FPWireOutEvent>& events) {
+            PyGILState_STATE state = PyGILState_Ensure();
+            {
+                // as a call of the device: closing it from the callback raises instead of deleting
+                // the device under the watcher, stopping the watcher releases the callback
+                DeviceCall call(self);
+                Py_INCREF(callback);
+                PyObject* list = wireOutEventsToList(events);
+                PyObject* res = PyObject_CallFunctionObjArgs(callback, list, NULL);
+                if (!res)
+                    PyErr_WriteUnraisable(callback);
+                Py_XDECREF(res);
+                Py_DECREF(list);
+                Py_DECREF(callback);
+            }
+            PyGILState_Release(state);
+        };
+    }
+
+    int rc = self->dev->startWireOutWatcher(periodUs, mask, callbackFunc, queueSize > 0 ? (size_t)queueSize : 1);
+    return Py_BuildValue("i", rc);
+}
+
+static PyObject* device_stopWireOutWatcher(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    {
+        DeviceCall call(self);
+        Py_BEGIN_ALLOW_THREADS
+        call.dev()->stopWireOutWatcher();
+        Py_END_ALLOW_THREADS
+    }
+    Py_CLEAR(self->wireOutCallback);
+    return Py_BuildValue("i", 0);
+}
+
+// size_t waitWireOutEvents(std::vector<FPWireOutEvent>& events, int timeoutMs, size_t maxEvents=0);
+static PyObject* device_waitWireOutEvents(Device *self, PyObject *args, PyObject *kwds)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    int timeoutMs = -1;
+    Py_ssize_t maxEvents = 0;
+    static const char* kwlist[] = {"timeout_ms", "max_events", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|in", (char**)kwlist, &timeoutMs, &maxEvents))
+        return NULL;
+
+    std::vector<FPWireOutEvent> events;
+    {
+        DeviceCall call(self);
+        Py_BEGIN_ALLOW_THREADS
+        call.dev()->waitWireOutEvents(events, timeoutMs, maxEvents > 0 ? (size_t)maxEvents : 0);
+        Py_END_ALLOW_THREADS
+    }
+    return wireOutEventsToList(events);
+}
+
 // int writeRegister(u32 address, u32 value);
 static PyObject* device_writeRegister(Device *self, PyObject *args)
 {
@@ -168,6 +560,52 @@ static PyObject* device_writeRegister(Device *self, PyObject *args)
     return Py_BuildValue("i", rc);
 }
 
+// int activateTriggerIn(u32 address, int bit);
+static PyObject* device_activateTriggerIn(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    unsigned address;
+    int bit;
+    if (!PyArg_ParseTuple(args, "Ii", &address, &bit))
+        return NULL;
+
+    int rc = self->dev->activateTriggerIn(address, bit);
+    return Py_BuildValue("i", rc);
+}
+
+// int updateTriggerOuts();
+static PyObject* device_updateTriggerOuts(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    int rc = self->dev->updateTriggerOuts();
+    return Py_BuildValue("i", rc);
+}
+
+// i64 isTriggered(u32 address, u32 mask);
+static PyObject* device_isTriggered(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    unsigned address;
+    unsigned mask = 0xFFFFFFFF;
+    if (!PyArg_ParseTuple(args, "I|I", &address, &mask))
+        return NULL;
+
+    i64 rc = self->dev->isTriggered(address, mask);
+    return PyLong_FromLongLong(rc);
+}
+
 // i64 readRegister(u32 address);
 static PyObject* device_readRegister(Device *self, PyObject *args)
 {
@@ -186,7 +624,7 @@ static PyObject* device_readRegister(Device *self, PyObject *args)
 }
 
 
-// int writePipe(u32 address, byte* data, size_t size, size_t blockSize=1024);
+// i64 writePipe(u32 address, byte* data, size_t size, size_t blockSize=0);
 static PyObject* device_writePipe(Device *self, PyObject *args)
 {
     if (!self->dev){
@@ -195,26 +633,51 @@ static PyObject* device_writePipe(Device *self, PyObject *args)
     }
 
     unsigned address;
-    int blockSize;
+    int blockSize = 0;
     PyObject* data;
-    if (!PyArg_ParseTuple(args, "IO!i", &address, &PyList_Type, &data, &blockSize))
+    if (!PyArg_ParseTuple(args, "IO|i", &address, &data, &blockSize))
         return NULL;
 
+    // py_fp.Buffer needs no checks and no buffer export
+    if (Py_TYPE(data) == &BufferType){
+        FPBuffer* buffer = (FPBuffer*)data;
+        DeviceCall call(self);
+        i64 rc;
+        Py_BEGIN_ALLOW_THREADS
+        rc = call.dev()->writePipe(address, buffer->data, (size_t)buffer->size, blockSize);
+        Py_END_ALLOW_THREADS
+        return PyLong_FromLongLong(rc);
+    }
+
+    // bytes-like objects are sent directly, without any copy or conversion
+    if (!PyList_Check(data)){
+        Py_buffer view;
+        if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) < 0)
+            return NULL;
+        DeviceCall call(self);
+        i64 rc;
+        Py_BEGIN_ALLOW_THREADS
+        rc = call.dev()->writePipe(address, static_cast<byte*>(view.buf), (size_t)view.len, blockSize);
+        Py_END_ALLOW_THREADS
+        PyBuffer_Release(&view);
+        return PyLong_FromLongLong(rc);
+    }
+
     Py_ssize_t count = PyList_Size(data);
     if (count < 0){
         PyErr_SetString(PyExc_IOError, "Invalid data.");
         return NULL;
     }
 
-    Buffer<byte> buff(count);
+    Buffer<byte> buff = BufferPool::global().lease<byte>(count);
     for (int i = 0; i < count; i++)
         buff[i] = static_cast<byte>(PyInt_AsLong(PyList_GetItem(data, i)));
 
-    int rc = self->dev->writePipe(address, buff.data(), (size_t)count, blockSize);
-    return Py_BuildValue("i", rc);
+    i64 rc = self->dev->writePipe(address, buff.data(), (size_t)count, blockSize);
+    return PyLong_FromLongLong(rc);
 }
 
-// i64 readPipe(u32 address, byte* data, size_t size, size_t blockSize=1024);
+// i64 readPipe(u32 address, byte* data, size_t size, size_t blockSize=0);
 static PyObject* device_readPipe(Device *self, PyObject *args)
 {
     if (!self->dev){
@@ -223,22 +686,49 @@ static PyObject* device_readPipe(Device *self, PyObject *args)
     }
 
     unsigned address;
-    int blockSize;
+    int blockSize = 0;
     PyObject* data;
-    if (!PyArg_ParseTuple(args, "IO!i", &address, &PyList_Type, &data, &blockSize))
+    if (!PyArg_ParseTuple(args, "IO|i", &address, &data, &blockSize))
         return NULL;
 
+    if (Py_TYPE(data) == &BufferType){
+        FPBuffer* buffer = (FPBuffer*)data;
+        DeviceCall call(self);
+        i64 rc;
+        Py_BEGIN_ALLOW_THREADS
+        rc = call.dev()->readPipe(address, buffer->data, (size_t)buffer->size, blockSize);
+        Py_END_ALLOW_THREADS
+        return PyLong_FromLongLong(rc);
+    }
+
+    // writable buffers (bytearray, memoryview, numpy arrays) are filled directly
+    if (!PyList_Check(data)){
+        Py_buffer view;
+        if (PyObject_GetBuffer(data, &view, PyBUF_WRITABLE) < 0)
+            return NULL;
+        DeviceCall call(self);
+        i64 rc;
+        Py_BEGIN_ALLOW_THREADS
+        rc = call.dev()->readPipe(address, static_cast<byte*>(view.buf), (size_t)view.len, blockSize);
+        Py_END_ALLOW_THREADS
+        PyBuffer_Release(&view);
+        return PyLong_FromLongLong(rc);
+    }
+
     Py_ssize_t count = PyList_Size(data);
     if (count < 0){
         PyErr_SetString(PyExc_IOError, "Invalid data.");
         return NULL;
     }
 
-    Buffer<byte> buff(count);
-    buff.zero();
+    Buffer<byte> buff = BufferPool::global().lease<byte>(count);
     size_t size = count;
 
-    int rc = self->dev->readPipe(address, buff.data(), size, blockSize);
+    i64 rc = self->dev->readPipe(address, buff.data(), size, blockSize);
+    // only the bytes that were read are overwritten, the rest of the list is zeroed
+    size_t read = rc > 0 ? static_cast<size_t>(rc) : 0;
+    if (read < size)
+        memset(buff.data() + read, 0, size - read);
 
     for (int i = 0; i < count; i++)
         PyList_SetItem(data, i, PyInt_FromLong(buff[i]));
@@ -288,72 +778,715 @@ static PyObject* device_getDeviceID(Device *self, PyObject *args)
     return Py_BuildValue("s", devid.c_str());
 }
 
+// void setAutoReconnect(bool enabled, u32 maxAttempts=5, u32 initialDelayMs=10, bool reconfigure=false);
+static PyObject* device_setAutoReconnect(Device *self, PyObject *args, PyObject *kwds)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    int enabled;
+    unsigned attempts = 5, delayMs = 10;
+    int reconfigure = 0;
+    static const char* kwlist[] = {"enabled", "attempts", "delay_ms", "reconfigure", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "p|IIp", (char**)kwlist, &enabled, &attempts, &delayMs, &reconfigure))
+        return NULL;
 
+    self->dev->setAutoReconnect(enabled, attempts, delayMs, reconfigure);
+    return Py_BuildValue("i", 0);
+}
 
-static PyObject* device_log(Device *self, PyObject *args)
+static PyObject* device_recordRegisterWrites(Device *self, PyObject *args)
 {
     if (!self->dev){
         PyErr_SetString(PyExc_IOError, "Device not opened.");
         return NULL;
     }
 
-    int loglevel;
-    int notime;
-    const char* text;
-    if (!PyArg_ParseTuple(args, "isi", &loglevel, &text, &notime))
+    int record;
+    if (!PyArg_ParseTuple(args, "p", &record))
         return NULL;
 
-    if (notime)
-        self->log->logNoTime((LogLevel)loglevel, text);
-    else
-        self->log->log((LogLevel)loglevel, text);
-
+    self->dev->setRecordRegisterWrites(record);
+    if (!record)
+        self->dev->clearRecordedRegisterWrites();
     return Py_BuildValue("i", 0);
 }
 
+static PyObject* device_reconnect(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    int rc = self->dev->reconnect();
+    return Py_BuildValue("i", rc);
+}
 
-static PyMemberDef device_members[] =
+static PyObject* device_getReconnectInfo(Device *self, PyObject *args)
 {
-   { NULL }
-};
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
 
-static PyMethodDef device_methods[] =
+    FPReconnectInfo info = self->dev->reconnectInfo();
+    return Py_BuildValue("{s:I,s:I,s:K,s:K}",
+                         "reconnect_count", info.reconnectCount,
+                         "failed_reconnects", info.failedReconnects,
+                         "total_downtime_us", (unsigned long long)info.totalDowntimeUs,
+                         "last_downtime_us", (unsigned long long)info.lastDowntimeUs);
+}
+
+static PyObject* device_flashEraseSector(Device *self, PyObject *args)
 {
-   { "list_devices",   (PyCFunction) device_listDevices, METH_VARARGS, "List connected FrontPanel devices" },
-   { "open",          (PyCFunction) device_open, METH_VARARGS, "Open device(serial,firmware,logfile)" },
-   { "close",         (PyCFunction) device_close, METH_VARARGS, "close()" },
-   { "set_wire_in",     (PyCFunction) device_setWireIn, METH_VARARGS, "set_wire_in(address, value, sendNow)" },
-   { "get_wire_out",   (PyCFunction) device_getWireOut, METH_VARARGS, "get_wire_out(address, refreshWires)" },
-   { "write_register", (PyCFunction) device_writeRegister, METH_VARARGS, "write_register(address, value)" },
-   { "read_register",  (PyCFunction) device_readRegister, METH_VARARGS, "read_register(address)" },
-   { "write_pipe",      (PyCFunction) device_writePipe, METH_VARARGS, "write_pipe(address,[data], blockSize=1024)" },
-   { "read_pipe",       (PyCFunction) device_readPipe, METH_VARARGS, "read_pipe(address,[data], blockSize=1024)" },
-   { "set_timeout",       (PyCFunction) device_setTimeout, METH_VARARGS, "set_timeout(timeout)" },
-   { "set_device_id", (PyCFunction) device_setDeviceID, METH_VARARGS, "set_deviceID(deviceID)" },
-   { "get_device_id", (PyCFunction) device_getDeviceID, METH_VARARGS, "get_deviceID()" },
-   { "log",           (PyCFunction) device_log, METH_VARARGS, "log(loglevel, text, notime)" },
-   { NULL }
-};
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
 
-PyTypeObject DeviceType =
+    unsigned address;
+    if (!PyArg_ParseTuple(args, "I", &address))
+        return NULL;
+
+    int rc = self->dev->flashEraseSector(address);
+    return Py_BuildValue("i", rc);
+}
+
+static PyObject* device_flashWrite(Device *self, PyObject *args)
 {
-   PyVarObject_HEAD_INIT(NULL, 0)
-   //PyObject_HEAD_INIT(NULL)
-   //0,                         /* ob_size */
-   "Device",               /* tp_name */
-   sizeof(Device),         /* tp_basicsize */
-   0,                         /* tp_itemsize */
-   (destructor)device_dealloc, /* tp_dealloc */
-   0,                         /* tp_print */
-   0,                         /* tp_getattr */
-   0,                         /* tp_setattr */
-   0,                         /* tp_compare */
-   0,                         /* tp_repr */
-   0,                         /* tp_as_number */
-   0,                         /* tp_as_sequence */
-   0,                         /* tp_as_mapping */
-   0,                         /* tp_hash */
-   0,                         /* tp_call */
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    unsigned address;
+    Py_buffer data;
+    if (!PyArg_ParseTuple(args, "Iy*", &address, &data))
+        return NULL;
+
+    int rc = self->dev->flashWrite(address, static_cast<const byte*>(data.buf), (size_t)data.len);
+    PyBuffer_Release(&data);
+    return Py_BuildValue("i", rc);
+}
+
+static PyObject* device_flashRead(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    unsigned address;
+    Py_ssize_t size;
+    if (!PyArg_ParseTuple(args, "In", &address, &size))
+        return NULL;
+
+    if (size < 0){
+        PyErr_SetString(PyExc_ValueError, "Invalid size.");
+        return NULL;
+    }
+
+    PyObject* data = PyBytes_FromStringAndSize(NULL, size);
+    if (!data)
+        return NULL;
+
+    int rc = self->dev->flashRead(address, reinterpret_cast<byte*>(PyBytes_AS_STRING(data)), (size_t)size);
+    if (rc){
+        Py_DECREF(data);
+        PyErr_SetString(PyExc_IOError, self->dev->lastError().empty() ? "Flash read failed." : self->dev->lastError().c_str());
+        return NULL;
+    }
+    return data;
+}
+
+// int flashProgram(u32 address, const byte* data, size_t size, bool verify=true, FPFlashProgress progress=nullptr);
+static PyObject* device_flashProgram(Device *self, PyObject *args, PyObject *kwds)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    unsigned address;
+    Py_buffer data;
+    int verify = 1;
+    PyObject* progress = Py_None;
+    static const char* kwlist[] = {"address", "data", "verify", "progress", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "Iy*|pO", (char**)kwlist, &address, &data, &verify, &progress))
+        return NULL;
+
+    if (progress != Py_None && !PyCallable_Check(progress)){
+        PyBuffer_Release(&data);
+        PyErr_SetString(PyExc_TypeError, "progress must be callable.");
+        return NULL;
+    }
+
+    FPFlashProgress progressFunc = nullptr;
+    if (progress != Py_None){
+        progressFunc = [progress](size_t done, size_t total) {
+            PyObject* res = PyObject_CallFunction(progress, "nn", (Py_ssize_t)done, (Py_ssize_t)total);
+            if (!res)
+                return false;
+            bool cont = res == Py_None || PyObject_IsTrue(res);
+            Py_DECREF(res);
+            return cont;
+        };
+    }
+
+    // the progress callback may release the GIL
+    int rc;
+    {
+        DeviceCall call(self);
+        rc = call.dev()->flashProgram(address, static_cast<const byte*>(data.buf), (size_t)data.len, verify, progressFunc);
+    }
+    PyBuffer_Release(&data);
+    if (PyErr_Occurred())
+        return NULL;
+    return Py_BuildValue("i", rc);
+}
+
+static PyObject* device_configureFromFlash(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    unsigned index;
+    if (!PyArg_ParseTuple(args, "I", &index))
+        return NULL;
+
+    int rc = self->dev->configureFromFlash(index);
+    return Py_BuildValue("i", rc);
+}
+
+static PyObject* device_getFlashLayout(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    FPFlashLayout layout = self->dev->flashLayout();
+    return Py_BuildValue("{s:I,s:I,s:I,s:I,s:I}",
+                         "sector_count", layout.sectorCount,
+                         "sector_size", layout.sectorSize,
+                         "page_size", layout.pageSize,
+                         "min_user_sector", layout.minUserSector,
+                         "max_user_sector", layout.maxUserSector);
+}
+
+// FPLinkProfile linkProfile() const;
+static PyObject* device_deviceInfo(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    FPLinkProfile link = self->dev->linkProfile();
+    static const char* interfaces[] = {"unknown", "usb2", "pcie", "usb3"};
+    static const char* speeds[] = {"unknown", "full", "high", "super"};
+    return Py_BuildValue("{s:s,s:s,s:s,s:s,s:i,s:s,s:s,s:i,s:O,s:O,s:O,s:n,s:n,s:n}",
+                         "serial", self->dev->serial().c_str(),
+                         "device_id", self->dev->deviceID().c_str(),
+                         "firmware_version", self->dev->fpFirmwareVersion().c_str(),
+                         "board_model", link.boardModel.c_str(),
+                         "board_model_id", link.boardModelId,
+                         "interface", interfaces[link.deviceInterface >= 0 && link.deviceInterface < 4 ? link.deviceInterface : 0],
+                         "usb_speed", speeds[link.usbSpeed >= 0 && link.usbSpeed < 4 ? link.usbSpeed : 0],
+                         "host_interface_width", link.hostInterfaceWidth,
+                         "high_speed", link.highSpeed ? Py_True : Py_False,
+                         "usb3_speed", link.usb3Speed ? Py_True : Py_False,
+                         "frontpanel3", link.frontPanel3Supported ? Py_True : Py_False,
+                         "block_size", (Py_ssize_t)link.blockSize,
+                         "link_block_size", (Py_ssize_t)link.linkBlockSize,
+                         "max_chunk_size", (Py_ssize_t)link.maxChunkSize);
+}
+
+// void setTransferDefaults(size_t blockSize, size_t maxChunkSize);
+static PyObject* device_setTransferDefaults(Device *self, PyObject *args, PyObject *kwds)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    static const char* kwlist[] = {"block_size", "max_chunk_size", NULL};
+    Py_ssize_t blockSize = 0;
+    Py_ssize_t maxChunkSize = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nn", (char**)kwlist, &blockSize, &maxChunkSize))
+        return NULL;
+    if (blockSize < 0 || maxChunkSize < 0){
+        PyErr_SetString(PyExc_ValueError, "Sizes must not be negative.");
+        return NULL;
+    }
+
+    self->dev->setTransferDefaults((size_t)blockSize, (size_t)maxChunkSize);
+    return Py_BuildValue("i", 0);
+}
+
+static PyObject* opStatsToDict(const FPOpStats& stats)
+{
+    PyObject* errors = PyDict_New();
+    for (int i = 1; i < FPSTATS_ERROR_CODES; i++){
+        if (!stats.errors[i])
+            continue;
+        PyObject* key = i == FPSTATS_ERROR_CODES - 1 ? PyUnicode_FromString("other") : PyLong_FromLong(-i);
+        PyObject* val = PyLong_FromUnsignedLongLong(stats.errors[i]);
+        PyDict_SetItem(errors, key, val);
+        Py_DECREF(key);
+        Py_DECREF(val);
+    }
+
+    PyObject* latency = PyList_New(FPSTATS_HIST_BUCKETS);
+    for (int i = 0; i < FPSTATS_HIST_BUCKETS; i++)
+        PyList_SET_ITEM(latency, i, PyLong_FromUnsignedLongLong(stats.latency[i]));
+
+    return Py_BuildValue("{s:K,s:K,s:d,s:N,s:N}",
+                         "calls", (unsigned long long)stats.calls,
+                         "bytes", (unsigned long long)stats.bytes,
+                         "total_us", stats.totalNs / 1000.0,
+                         "errors", errors,
+                         "latency_hist", latency);
+}
+
+static PyObject* device_getStats(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    const FPStats& stats = self->dev->stats();
+    PyObject* result = PyDict_New();
+    for (int op = 0; op < FPOP_COUNT; op++){
+        PyObject* opStats = opStatsToDict(stats.total((FPOpType)op));
+        if (FPStats::hasEndpoints((FPOpType)op)){
+            PyObject* endpoints = PyDict_New();
+            for (u32 slot = 0; slot < FPSTATS_ENDPOINTS; slot++){
+                FPOpStats epStats = stats.endpoint((FPOpType)op, slot);
+                if (!epStats.calls)
+                    continue;
+                PyObject* key = PyLong_FromUnsignedLong(FPStats::endpointAddress((FPOpType)op, slot));
+                PyObject* val = opStatsToDict(epStats);
+                PyDict_SetItem(endpoints, key, val);
+                Py_DECREF(key);
+                Py_DECREF(val);
+            }
+            PyDict_SetItemString(opStats, "endpoints", endpoints);
+            Py_DECREF(endpoints);
+        }
+        PyDict_SetItemString(result, FPOP_NAMES[op], opStats);
+        Py_DECREF(opStats);
+    }
+    return result;
+}
+
+static PyObject* device_resetStats(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    self->dev->resetStats();
+    return Py_BuildValue("i", 0);
+}
+
+static PyObject* pipeMonitorToTuple(const FPPipeMonitorStats& stats)
+{
+    return Py_BuildValue("(dKKKKKK)", stats.bandwidth / 1e6, (unsigned long long)stats.transfers,
+                         (unsigned long long)stats.bytes, (unsigned long long)stats.shortReads,
+                         (unsigned long long)stats.timeouts, (unsigned long long)stats.fifoOverflows,
+                         (unsigned long long)stats.fifoUnderflows);
+}
+
+// bool pipeMonitor(u32 address, FPPipeMonitorStats& stats) const;
+static PyObject* device_getPipeMonitor(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    unsigned address;
+    if (!PyArg_ParseTuple(args, "I", &address))
+        return NULL;
+
+    FPPipeMonitorStats stats;
+    self->dev->pipeMonitor(address, stats);
+    return pipeMonitorToTuple(stats);
+}
+
+static PyObject* device_getPipeMonitors(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    PyObject* endpoints = PyDict_New();
+    for (u32 slot = 0; slot < FPMONITOR_ENDPOINTS; slot++){
+        FPPipeMonitorStats stats;
+        u32 address = FPPipeMonitor::endpointAddress(slot);
+        if (!self->dev->pipeMonitor(address, stats))
+            continue;
+        PyObject* key = PyLong_FromUnsignedLong(address);
+        PyObject* value = pipeMonitorToTuple(stats);
+        PyDict_SetItem(endpoints, key, value);
+        Py_DECREF(key);
+        Py_DECREF(value);
+    }
+    return endpoints;
+}
+
+// void setMonitorTimeConstant(double seconds);
+static PyObject* device_setMonitorTimeConstant(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    double seconds;
+    if (!PyArg_ParseTuple(args, "d", &seconds))
+        return NULL;
+
+    self->dev->setMonitorTimeConstant(seconds);
+    return Py_BuildValue("i", 0);
+}
+
+static PyObject* device_setStatsEnabled(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    int enabled;
+    if (!PyArg_ParseTuple(args, "p", &enabled))
+        return NULL;
+
+    self->dev->setStatsEnabled(enabled);
+    return Py_BuildValue("i", 0);
+}
+
+// void startTrace(size_t eventsPerThread=65536, size_t maxThreads=16);
+static PyObject* device_traceStart(Device *self, PyObject *args, PyObject *kwds)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    Py_ssize_t eventsPerThread = 65536;
+    Py_ssize_t maxThreads = 16;
+    static const char* kwlist[] = {"events_per_thread", "max_threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nn", (char**)kwlist, &eventsPerThread, &maxThreads))
+        return NULL;
+
+    if (eventsPerThread <= 0 || maxThreads <= 0){
+        PyErr_SetString(PyExc_ValueError, "Invalid trace buffer size.");
+        return NULL;
+    }
+
+    self->dev->startTrace((size_t)eventsPerThread, (size_t)maxThreads);
+    return Py_BuildValue("i", 0);
+}
+
+static PyObject* device_traceStop(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    self->dev->stopTrace();
+    return Py_BuildValue("i", 0);
+}
+
+// i64 dumpTrace(const char* fileName) const;
+static PyObject* device_traceDump(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    const char* fileName;
+    if (!PyArg_ParseTuple(args, "s", &fileName))
+        return NULL;
+
+    i64 rc = self->dev->dumpTrace(fileName);
+    if (rc < 0){
+        PyErr_SetString(PyExc_IOError, self->dev->lastError().c_str());
+        return NULL;
+    }
+    return PyLong_FromLongLong(rc);
+}
+
+// int startRecording(const char* fileName, bool pipeInData=false);
+static PyObject* device_recordStart(Device *self, PyObject *args, PyObject *kwds)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    static const char* kwlist[] = {"file_name", "pipe_in_data", NULL};
+    const char* fileName;
+    int pipeInData = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|p", (char**)kwlist, &fileName, &pipeInData))
+        return NULL;
+
+    int rc = self->dev->startRecording(fileName, pipeInData != 0);
+    return Py_BuildValue("i", rc);
+}
+
+// i64 stopRecording();
+static PyObject* device_recordStop(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    i64 rc = self->dev->stopRecording();
+    return PyLong_FromLongLong(rc);
+}
+
+
+static PyObject* device_log(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    int loglevel;
+    int notime;
+    const char* text;
+    if (!PyArg_ParseTuple(args, "isi", &loglevel, &text, &notime))
+        return NULL;
+
+    if (notime)
+        self->log->logNoTime((LogLevel)loglevel, text);
+    else
+        self->log->log((LogLevel)loglevel, "%s", text);
+
+    return Py_BuildValue("i", 0);
+}
+
+
+static PyMemberDef device_members[] =
+{
+   { NULL }
+};
+
+// void setAsync(bool async, size_t queueSize, LogOverflow overflow);
+static PyObject* device_setLogAsync(Device *self, PyObject *args, PyObject *kwds)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    static const char* kwlist[] = {"enabled", "queue_size", "drop", NULL};
+    int enabled;
+    Py_ssize_t queueSize = FILELOG_QUEUE_SIZE;
+    int drop = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "p|np", (char**)kwlist, &enabled, &queueSize, &drop))
+        return NULL;
+    if (queueSize <= 0){
+        PyErr_SetString(PyExc_ValueError, "Queue size must be positive.");
+        return NULL;
+    }
+
+    DeviceCall call(self);
+    FileLog* log = self->log;
+    Py_BEGIN_ALLOW_THREADS
+    log->setAsync(enabled, (size_t)queueSize, drop ? LOG_OVERFLOW_DROP : LOG_OVERFLOW_BLOCK);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("i", 0);
+}
+
+// void setRotation(unsigned long long maxSize, unsigned intervalSec, int keepFiles, bool compress);
+static PyObject* device_setLogRotation(Device *self, PyObject *args, PyObject *kwds)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    static const char* kwlist[] = {"max_size", "interval", "keep", "compress", NULL};
+    unsigned long long maxSize = 0;
+    unsigned int interval = 0;
+    int keep = 5;
+    int compress = 1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|KIip", (char**)kwlist, &maxSize, &interval, &keep, &compress))
+        return NULL;
+
+    self->log->setRotation(maxSize, interval, keep, compress);
+    return Py_BuildValue("i", 0);
+}
+
+// unsigned long long droppedMessages();
+static PyObject* device_getLogDropped(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    return PyLong_FromUnsignedLongLong(self->log->droppedMessages());
+}
+
+// void setSink(LogSink* sink);
+static PyObject* device_setLogHandler(Device *self, PyObject *args, PyObject *kwds)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    static const char* kwlist[] = {"logger", "queue_size", NULL};
+    PyObject* logger = Py_None;
+    Py_ssize_t queueSize = FILELOG_QUEUE_SIZE;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|n", (char**)kwlist, &logger, &queueSize))
+        return NULL;
+    if (logger != Py_None && (!PyObject_HasAttrString(logger, "makeRecord") || !PyObject_HasAttrString(logger, "handle"))){
+        PyErr_SetString(PyExc_TypeError, "logger must be a logging.Logger.");
+        return NULL;
+    }
+    if (queueSize <= 0){
+        PyErr_SetString(PyExc_ValueError, "Queue size must be positive.");
+        return NULL;
+    }
+
+    device_releaseLogSink(self);
+    if (logger != Py_None){
+        self->logSink = new PyLogSink(logger, (size_t)queueSize);
+        self->log->setSink(self->logSink);
+    }
+    return Py_BuildValue("i", 0);
+}
+
+// Py_ssize_t PyLogSink::drain();
+static PyObject* device_drainLog(Device *self, PyObject *args)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    return PyLong_FromSsize_t(self->logSink ? self->logSink->drain() : 0);
+}
+
+// void setPipeLog(FileLog* log, u32 dumpEvery, bool dumpErrors, size_t dumpSize);
+static PyObject* device_setPipeLog(Device *self, PyObject *args, PyObject *kwds)
+{
+    if (!self->dev){
+        PyErr_SetString(PyExc_IOError, "Device not opened.");
+        return NULL;
+    }
+
+    static const char* kwlist[] = {"enabled", "dump_every", "dump_errors", "dump_size", NULL};
+    int enabled;
+    unsigned int dumpEvery = 0;
+    int dumpErrors = 1;
+    Py_ssize_t dumpSize = 256;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "p|Ipn", (char**)kwlist, &enabled, &dumpEvery, &dumpErrors, &dumpSize))
+        return NULL;
+    if (dumpSize < 0){
+        PyErr_SetString(PyExc_ValueError, "Dump size must not be negative.");
+        return NULL;
+    }
+
+    if (enabled && dumpSize)
+        self->log->setMaxLogBufferSize((size_t)dumpSize);
+    self->dev->setPipeLog(enabled ? self->log : NULL, dumpEvery, dumpErrors, (size_t)dumpSize);
+    return Py_BuildValue("i", 0);
+}
+
+static PyMethodDef device_methods[] =
+{
+   { "list_devices",   (PyCFunction) device_listDevices, METH_VARARGS, "List connected FrontPanel devices" },
+   { "open",          (PyCFunction) device_open, METH_VARARGS | METH_KEYWORDS, "Open device(serial,firmware,logfile,flash_index=-1)" },
+   { "close",         (PyCFunction) device_close, METH_VARARGS, "close()" },
+   { "set_wire_in",     (PyCFunction) device_setWireIn, METH_VARARGS, "set_wire_in(address, value, sendNow)" },
+   { "set_wire_in_bits", (PyCFunction) device_setWireInBits, METH_VARARGS, "set_wire_in_bits(address, mask, value, sendNow=True)" },
+   { "update_wire_ins", (PyCFunction) device_updateWireIns, METH_VARARGS, "update_wire_ins(force=False)" },
+   { "get_wire_in",     (PyCFunction) device_getWireIn, METH_VARARGS, "get_wire_in(address)" },
+   { "get_wire_out",   (PyCFunction) device_getWireOut, METH_VARARGS | METH_KEYWORDS, "get_wire_out(address, refreshWires=True, max_age_us=-1)" },
+   { "start_wire_out_watcher", (PyCFunction) device_startWireOutWatcher, METH_VARARGS | METH_KEYWORDS, "start_wire_out_watcher(period_us=1000, mask=0xFFFFFFFF, callback=None, queue_size=4096)" },
+   { "stop_wire_out_watcher", (PyCFunction) device_stopWireOutWatcher, METH_VARARGS, "stop_wire_out_watcher()" },
+   { "wait_wire_out_events", (PyCFunction) device_waitWireOutEvents, METH_VARARGS | METH_KEYWORDS, "wait_wire_out_events(timeout_ms=-1, max_events=0)" },
+   { "activate_trigger_in", (PyCFunction) device_activateTriggerIn, METH_VARARGS, "activate_trigger_in(address, bit)" },
+   { "update_trigger_outs", (PyCFunction) device_updateTriggerOuts, METH_VARARGS, "update_trigger_outs()" },
+   { "is_triggered",  (PyCFunction) device_isTriggered, METH_VARARGS, "is_triggered(address, mask=0xFFFFFFFF)" },
+   { "write_register", (PyCFunction) device_writeRegister, METH_VARARGS, "write_register(address, value)" },
+   { "read_register",  (PyCFunction) device_readRegister, METH_VARARGS, "read_register(address)" },
+   { "write_pipe",      (PyCFunction) device_writePipe, METH_VARARGS, "write_pipe(address, data, block_size=0) - data is a list or a bytes-like object, block size 0 is the transfer default" },
+   { "read_pipe",       (PyCFunction) device_readPipe, METH_VARARGS, "read_pipe(address, data, block_size=0) - data is a list or a writable buffer, block size 0 is the transfer default" },
+   { "set_timeout",       (PyCFunction) device_setTimeout, METH_VARARGS, "set_timeout(timeout)" },
+   { "set_device_id", (PyCFunction) device_setDeviceID, METH_VARARGS, "set_deviceID(deviceID)" },
+   { "get_device_id", (PyCFunction) device_getDeviceID, METH_VARARGS, "get_deviceID()" },
+   { "set_auto_reconnect", (PyCFunction) device_setAutoReconnect, METH_VARARGS | METH_KEYWORDS, "set_auto_reconnect(enabled, attempts=5, delay_ms=10, reconfigure=False)" },
+   { "record_register_writes", (PyCFunction) device_recordRegisterWrites, METH_VARARGS, "record_register_writes(enable)" },
+   { "reconnect",     (PyCFunction) device_reconnect, METH_VARARGS, "reconnect()" },
+   { "get_reconnect_info", (PyCFunction) device_getReconnectInfo, METH_VARARGS, "get_reconnect_info()" },
+   { "flash_erase_sector", (PyCFunction) device_flashEraseSector, METH_VARARGS, "flash_erase_sector(address)" },
+   { "flash_write",   (PyCFunction) device_flashWrite, METH_VARARGS, "flash_write(address, data)" },
+   { "flash_read",    (PyCFunction) device_flashRead, METH_VARARGS, "flash_read(address, size)" },
+   { "flash_program", (PyCFunction) device_flashProgram, METH_VARARGS | METH_KEYWORDS, "flash_program(address, data, verify=True, progress=None)" },
+   { "configure_from_flash", (PyCFunction) device_configureFromFlash, METH_VARARGS, "configure_from_flash(index)" },
+   { "device_info",   (PyCFunction) device_deviceInfo, METH_VARARGS, "device_info()" },
+   { "set_transfer_defaults", (PyCFunction) device_setTransferDefaults, METH_VARARGS | METH_KEYWORDS, "set_transfer_defaults(block_size=0, max_chunk_size=0)" },
+   { "get_flash_layout", (PyCFunction) device_getFlashLayout, METH_VARARGS, "get_flash_layout()" },
+   { "get_stats",     (PyCFunction) device_getStats, METH_VARARGS, "get_stats()" },
+   { "reset_stats",   (PyCFunction) device_resetStats, METH_VARARGS, "reset_stats()" },
+   { "get_pipe_monitor", (PyCFunction) device_getPipeMonitor, METH_VARARGS, "get_pipe_monitor(address) -> (mb_per_s, transfers, bytes, short_reads, timeouts, fifo_overflows, fifo_underflows)" },
+   { "get_pipe_monitors", (PyCFunction) device_getPipeMonitors, METH_VARARGS, "get_pipe_monitors() -> {address: get_pipe_monitor(address)}" },
+   { "set_monitor_time_constant", (PyCFunction) device_setMonitorTimeConstant, METH_VARARGS, "set_monitor_time_constant(seconds)" },
+   { "set_stats_enabled", (PyCFunction) device_setStatsEnabled, METH_VARARGS, "set_stats_enabled(enabled)" },
+   { "trace_start",   (PyCFunction) device_traceStart, METH_VARARGS | METH_KEYWORDS, "trace_start(events_per_thread=65536, max_threads=16)" },
+   { "trace_stop",    (PyCFunction) device_traceStop, METH_VARARGS, "trace_stop()" },
+   { "trace_dump",    (PyCFunction) device_traceDump, METH_VARARGS, "trace_dump(file_name)" },
+   { "record_start",  (PyCFunction) device_recordStart, METH_VARARGS | METH_KEYWORDS, "record_start(file_name, pipe_in_data=False)" },
+   { "record_stop",   (PyCFunction) device_recordStop, METH_VARARGS, "record_stop()" },
+   { "log",           (PyCFunction) device_log, METH_VARARGS, "log(loglevel, text, notime)" },
+   { "set_log_async", (PyCFunction) device_setLogAsync, METH_VARARGS | METH_KEYWORDS, "set_log_async(enabled, queue_size=8192, drop=False)" },
+   { "get_log_dropped", (PyCFunction) device_getLogDropped, METH_VARARGS, "get_log_dropped()" },
+   { "set_log_rotation", (PyCFunction) device_setLogRotation, METH_VARARGS | METH_KEYWORDS, "set_log_rotation(max_size=0, interval=0, keep=5, compress=True)" },
+   { "set_log_handler", (PyCFunction) device_setLogHandler, METH_VARARGS | METH_KEYWORDS, "set_log_handler(logger, queue_size=8192)" },
+   { "drain_log",      (PyCFunction) device_drainLog, METH_VARARGS, "drain_log()" },
+   { "set_pipe_log",   (PyCFunction) device_setPipeLog, METH_VARARGS | METH_KEYWORDS, "set_pipe_log(enabled, dump_every=0, dump_errors=True, dump_size=256)" },
+   { NULL }
+};
+
+PyTypeObject DeviceType =
+{
+   PyVarObject_HEAD_INIT(NULL, 0)
+   //PyObject_HEAD_INIT(NULL)
+   //0,                         /* ob_size */
+   "Device",               /* tp_name */
+   sizeof(Device),         /* tp_basicsize */
+   0,                         /* tp_itemsize */
+   (destructor)device_dealloc, /* tp_dealloc */
+   0,                         /* tp_print */
+   0,                         /* tp_getattr */
+   0,                         /* tp_setattr */
+   0,                         /* tp_compare */
+   0,                         /* tp_repr */
+   0,                         /* tp_as_number */
+   0,                         /* tp_as_sequence */
+   0,                         /* tp_as_mapping */
+   0,                         /* tp_hash */
+   0,                         /* tp_call */
    0,                         /* tp_str */
    0,                         /* tp_getattro */
    0,                         /* tp_setattro */
@@ -380,12 +1513,297 @@ PyTypeObject DeviceType =
 };
 
 
+//################################################################################
+//                      BUFFER
+//################################################################################
+
+static void buffer_dealloc(FPBuffer *self)
+{
+    delete self->buff;
+    self->buff = NULL;
+    Py_CLEAR(self->base);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+// Buffer(size, alignment=4096), buffers of 2 MB and more get the pages set by set_large_pages()
+static int buffer_init(FPBuffer *self, PyObject *args, PyObject *kwds)
+{
+    static const char* kwlist[] = {"size", "alignment", NULL};
+    Py_ssize_t size;
+    Py_ssize_t alignment = BUFFER_PAGE;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "n|n", (char**)kwlist, &size, &alignment))
+        return -1;
+    if (size < 0){
+        PyErr_SetString(PyExc_ValueError, "Size must not be negative.");
+        return -1;
+    }
+    if (alignment <= 0 || (alignment & (alignment - 1))){
+        PyErr_SetString(PyExc_ValueError, "Alignment must be a power of two.");
+        return -1;
+    }
+
+    // views and exports point into the memory, it cannot be replaced
+    if (self->buff || self->base){
+        PyErr_SetString(PyExc_RuntimeError, "Buffer is already initialized.");
+        return -1;
+    }
+
+    Buffer<byte>* buff = NULL;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        BufferAllocator* allocator = (size_t)size >= (size_t(1) << BUFFERPOOL_LARGE_SHIFT) ? &BufferPool::global().largePageAllocator() : NULL;
+        buff = new Buffer<byte>((size_t)size, BUFFER_INIT_ZERO, (size_t)alignment, allocator);
+    } catch (const std::bad_alloc&) {
+        buff = NULL;
+    }
+    Py_END_ALLOW_THREADS
+    if (!buff){
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    static byte empty[1];
+    self->buff = buff;
+    self->data = size ? buff->data() : empty;
+    self->size = size;
+    self->alignment = alignment;
+    return 0;
+}
+
+static Py_ssize_t buffer_length(FPBuffer *self)
+{
+    return self->size;
+}
+
+// zero-copy view of a part of the buffer
+static PyObject* buffer_view(FPBuffer *self, Py_ssize_t offset, Py_ssize_t size)
+{
+    FPBuffer* view = (FPBuffer*)BufferType.tp_alloc(&BufferType, 0);
+    if (!view)
+        return NULL;
+    view->buff = NULL;
+    view->base = self->base ? self->base : (PyObject*)self;
+    Py_INCREF(view->base);
+    view->data = self->data + offset;
+    view->size = size;
+    // alignment of the view start: the lowest set bit of the offset, at most that of the buffer
+    view->alignment = offset ? std::min(self->alignment, offset & -offset) : self->alignment;
+    return (PyObject*)view;
+}
+
+static int buffer_index(FPBuffer *self, PyObject *key, Py_ssize_t& index)
+{
+    index = PyNumber_AsSsize_t(key, PyExc_IndexError);
+    if (index == -1 && PyErr_Occurred())
+        return -1;
+    if (index < 0)
+        index += self->size;
+    if (index < 0 || index >= self->size){
+        PyErr_SetString(PyExc_IndexError, "Buffer index out of range.");
+        return -1;
+    }
+    return 0;
+}
+
+static int buffer_slice(FPBuffer *self, PyObject *key, Py_ssize_t& start, Py_ssize_t& length)
+{
+    Py_ssize_t stop, step;
+    if (PySlice_Unpack(key, &start, &stop, &step) < 0)
+        return -1;
+    length = PySlice_AdjustIndices(self->size, &start, &stop, step);
+    if (step != 1){
+        PyErr_SetString(PyExc_ValueError, "Buffer slices must be contiguous.");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject* buffer_subscript(FPBuffer *self, PyObject *key)
+{
+    if (PySlice_Check(key)){
+        Py_ssize_t start, length;
+        if (buffer_slice(self, key, start, length) < 0)
+            return NULL;
+        return buffer_view(self, start, length);
+    }
+
+    Py_ssize_t index;
+    if (buffer_index(self, key, index) < 0)
+        return NULL;
+    return PyLong_FromLong(self->data[index]);
+}
+
+static int buffer_assSubscript(FPBuffer *self, PyObject *key, PyObject *value)
+{
+    if (!value){
+        PyErr_SetString(PyExc_TypeError, "Buffer items cannot be deleted.");
+        return -1;
+    }
+
+    if (PySlice_Check(key)){
+        Py_ssize_t start, length;
+        if (buffer_slice(self, key, start, length) < 0)
+            return -1;
+        Py_buffer view;
+        if (PyObject_GetBuffer(value, &view, PyBUF_SIMPLE) < 0)
+            return -1;
+        if (view.len != length){
+            PyBuffer_Release(&view);
+            PyErr_SetString(PyExc_ValueError, "Assigned data must have the length of the slice.");
+            return -1;
+        }
+        memmove(self->data + start, view.buf, (size_t)length);
+        PyBuffer_Release(&view);
+        return 0;
+    }
+
+    Py_ssize_t index;
+    if (buffer_index(self, key, index) < 0)
+        return -1;
+    long byteValue = PyLong_AsLong(value);
+    if (byteValue == -1 && PyErr_Occurred())
+        return -1;
+    if (byteValue < 0 || byteValue > 255){
+        PyErr_SetString(PyExc_ValueError, "Byte must be in range(0, 256).");
+        return -1;
+    }
+    self->data[index] = static_cast<byte>(byteValue);
+    return 0;
+}
+
+static int buffer_getBuffer(FPBuffer *self, Py_buffer *view, int flags)
+{
+    return PyBuffer_FillInfo(view, (PyObject*)self, self->data, self->size, 0, flags);
+}
+
+static PyObject* buffer_repr(FPBuffer *self)
+{
+    return PyUnicode_FromFormat("py_fp.Buffer(size=%zd, alignment=%zd)", self->size, self->alignment);
+}
+
+static PyMemberDef buffer_members[] =
+{
+   { (char*)"alignment", T_PYSSIZET, offsetof(FPBuffer, alignment), READONLY, (char*)"alignment of the start of the buffer" },
+   { NULL }
+};
+
+static PyMappingMethods buffer_mapping =
+{
+   (lenfunc)buffer_length,                  /* mp_length */
+   (binaryfunc)buffer_subscript,            /* mp_subscript */
+   (objobjargproc)buffer_assSubscript,      /* mp_ass_subscript */
+};
+
+static PyBufferProcs buffer_bufferProcs =
+{
+   (getbufferproc)buffer_getBuffer,         /* bf_getbuffer */
+   NULL,                                    /* bf_releasebuffer */
+};
+
+PyTypeObject BufferType =
+{
+   PyVarObject_HEAD_INIT(NULL, 0)
+   "py_fp.Buffer",            /* tp_name */
+   sizeof(FPBuffer),          /* tp_basicsize */
+   0,                         /* tp_itemsize */
+   (destructor)buffer_dealloc, /* tp_dealloc */
+   0,                         /* tp_print */
+   0,                         /* tp_getattr */
+   0,                         /* tp_setattr */
+   0,                         /* tp_compare */
+   (reprfunc)buffer_repr,     /* tp_repr */
+   0,                         /* tp_as_number */
+   0,                         /* tp_as_sequence */
+   &buffer_mapping,           /* tp_as_mapping */
+   0,                         /* tp_hash */
+   0,                         /* tp_call */
+   0,                         /* tp_str */
+   0,                         /* tp_getattro */
+   0,                         /* tp_setattro */
+   &buffer_bufferProcs,       /* tp_as_buffer */
+   Py_TPFLAGS_DEFAULT,        /* tp_flags*/
+   "Buffer(size, alignment=4096): aligned memory reused by the pipe methods, slices are views without a copy", /* tp_doc */
+   0,                         /* tp_traverse */
+   0,                         /* tp_clear */
+   0,                         /* tp_richcompare */
+   0,                         /* tp_weaklistoffset */
+   0,                         /* tp_iter */
+   0,                         /* tp_iternext */
+   0,                         /* tp_methods */
+   buffer_members,            /* tp_members */
+   0,                         /* tp_getset */
+   0,                         /* tp_base */
+   0,                         /* tp_dict */
+   0,                         /* tp_descr_get */
+   0,                         /* tp_descr_set */
+   0,                         /* tp_dictoffset */
+   (initproc)buffer_init,     /* tp_init */
+   0,                         /* tp_alloc */
+   0,                         /* tp_new */
+};
+
+
 //################################################################################
 //                      INIT MODULE
 //################################################################################
 
+// BufferPoolStats BufferPool::global().stats();
+static PyObject* module_bufferPoolStats(PyObject *self, PyObject *args)
+{
+    (void)self;
+    (void)args;
+    BufferPoolStats stats = BufferPool::global().stats();
+    LargePageStats large = BufferPool::global().largePageStats();
+    return Py_BuildValue("{s:n,s:n,s:n,s:n,s:n,s:K,s:K,s:n,s:n,s:n,s:K,s:K}",
+                         "leased_bytes", (Py_ssize_t)stats.leasedBytes,
+                         "cached_bytes", (Py_ssize_t)stats.cachedBytes,
+                         "peak_leased_bytes", (Py_ssize_t)stats.peakLeasedBytes,
+                         "peak_total_bytes", (Py_ssize_t)stats.peakTotalBytes,
+                         "max_bytes", (Py_ssize_t)stats.maxBytes,
+                         "leases", stats.leases,
+                         "hits", stats.hits,
+                         "mapped_bytes", (Py_ssize_t)large.mappedBytes,
+                         "huge_page_bytes", (Py_ssize_t)large.hugePageBytes,
+                         "locked_bytes", (Py_ssize_t)large.lockedBytes,
+                         "huge_page_fallbacks", large.hugePageFallbacks,
+                         "lock_failures", large.lockFailures);
+}
+
+// void BufferPool::global().setMaxBytes(size_t maxBytes);
+static PyObject* module_setBufferPoolLimit(PyObject *self, PyObject *args)
+{
+    (void)self;
+    unsigned long long maxBytes;
+    if (!PyArg_ParseTuple(args, "K", &maxBytes))
+        return NULL;
+
+    BufferPool::global().setMaxBytes((size_t)maxBytes);
+    return Py_BuildValue("i", 0);
+}
+
+// void BufferPool::global().setLargePages(int flags);
+static PyObject* module_setLargePages(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    (void)self;
+    static const char* kwlist[] = {"huge_pages", "prefault", "lock", NULL};
+    int hugePages = 0;
+    int prefault = 0;
+    int lock = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ppp", (char**)kwlist, &hugePages, &prefault, &lock))
+        return NULL;
+
+    int flags = (hugePages ? LARGEPAGE_HUGE : 0) | (prefault ? LARGEPAGE_PREFAULT : 0) | (lock ? LARGEPAGE_LOCK : 0);
+    Py_BEGIN_ALLOW_THREADS
+    BufferPool::global().setLargePages(flags);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("i", 0);
+}
+
 static PyMethodDef module_methods[] = {
     {"list_devices", (PyCFunction)device_listDevices, METH_VARARGS, "list_devices()"},
+    {"buffer_pool_stats", (PyCFunction)module_bufferPoolStats, METH_VARARGS, "buffer_pool_stats()"},
+    {"set_large_pages", (PyCFunction)module_setLargePages, METH_VARARGS | METH_KEYWORDS, "set_large_pages(huge_pages=False, prefault=False, lock=False)"},
+    {"set_buffer_pool_limit", (PyCFunction)module_setBufferPoolLimit, METH_VARARGS, "set_buffer_pool_limit(max_bytes)"},
     {NULL, NULL, 0, NULL}
 };
 
@@ -415,9 +1833,22 @@ PyMODINIT_FUNC PyInit_py_fp(void)
     Py_INCREF(&DeviceType);
     PyModule_AddObject(m, "FPDevice", (PyObject*)&DeviceType);
 
+    BufferType.tp_new = PyType_GenericNew;
+    if (PyType_Ready(&BufferType) < 0)
+        return m;
+
+    Py_INCREF(&BufferType);
+    PyModule_AddObject(m, "Buffer", (PyObject*)&BufferType);
+
     return m;
 }
 
+PyMODINIT_FUNC PyInit__py_fp(void)
+{
+    moduledef.m_name = "py_fp._py_fp";
+    return PyInit_py_fp();
+}
+
 PyMODINIT_FUNC PyInit_py_fp_linux(void)
 {
     moduledef.m_name = "py_device_linux";
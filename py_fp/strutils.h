@@ -23,12 +23,17 @@ SOFTWARE.
 #define STRUTILS_H
 #include <algorithm>
 #include <cctype>
+#include <cerrno>
+#include <charconv>
 #include <cstdarg>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 namespace str
@@ -128,12 +133,120 @@ namespace str
         return result;
     }
 
+    /// Vector that keeps up to N items inline and moves them to the heap only when it grows over N.
+    /// clear() keeps the heap capacity, so a reused vector does not allocate again.
+    template <typename T, size_t N> class small_vector
+    {
+    public:
+        small_vector() : mSize(0) {}
+
+        void push_back(const T& value)
+        {
+            if (mSize < N && mHeap.empty()) {
+                mInline[mSize++] = value;
+                return;
+            }
+            if (mHeap.empty())
+                mHeap.assign(mInline, mInline + mSize);
+            mHeap.push_back(value);
+            mSize++;
+        }
+
+        void clear() { mHeap.clear(); mSize = 0; }
+        size_t size() const { return mSize; }
+        bool empty() const { return mSize == 0; }
+        T* data() { return mHeap.empty() ? mInline : mHeap.data(); }
+        const T* data() const { return mHeap.empty() ? mInline : mHeap.data(); }
+        T* begin() { return data(); }
+        T* end() { return data() + mSize; }
+        const T* begin() const { return data(); }
+        const T* end() const { return data() + mSize; }
+        T& operator[](size_t index) { return data()[index]; }
+        const T& operator[](size_t index) const { return data()[index]; }
+
+    private:
+        T mInline[N];
+        std::vector<T> mHeap;
+        size_t mSize;
+    };
+
+    /// True for the number types converted by to_chars/from_chars. bool and character types
+    /// are read and written as characters by streams, so they keep going through them.
+    template <typename T, typename U = std::remove_cv_t<T>> constexpr bool is_number_v = std::is_arithmetic_v<U>
+        && !std::is_same_v<U, bool> && !std::is_same_v<U, char> && !std::is_same_v<U, signed char>
+        && !std::is_same_v<U, unsigned char> && !std::is_same_v<U, wchar_t>
+        && !std::is_same_v<U, char16_t> && !std::is_same_v<U, char32_t>;
+
+    /// Write a number to the buffer [first, last) without allocation. Floating point numbers are
+    /// written as printf %g, the same as streams do. Returns the end of the written characters,
+    /// nullptr if the buffer is too small.
+    template <typename T> inline char* to_chars(char* first, char* last, T value)
+    {
+        static_assert(is_number_v<T>, "to_chars supports integer and floating point numbers only");
+        if constexpr (std::is_integral_v<T>) {
+            std::to_chars_result res = std::to_chars(first, last, value);
+            return res.ec == std::errc() ? res.ptr : nullptr;
+        } else {
+            size_t size = static_cast<size_t>(last - first);
+            int n = std::is_same_v<T, long double> ? snprintf(first, size, "%Lg", static_cast<long double>(value))
+                                                   : snprintf(first, size, "%g", static_cast<double>(value));
+            return (n < 0 || static_cast<size_t>(n) >= size) ? nullptr : first + n;
+        }
+    }
+
+    /// Parse a number at the beginning of the string without allocation. Leading white space and
+    /// a plus sign are skipped, as streams do. Returns the number of characters consumed,
+    /// 0 if the string does not start with a number or the number is out of range.
+    template <typename T> inline size_t from_chars(const std::string_view str, T& value, int base=10)
+    {
+        static_assert(is_number_v<T>, "from_chars supports integer and floating point numbers only");
+        const char* first = str.data();
+        const char* last = str.data() + str.size();
+        while (first != last && isspace(static_cast<unsigned char>(*first)))
+            first++;
+        if (first != last && *first == '+' && (first + 1 == last || first[1] != '-'))
+            first++;
+        std::from_chars_result res;
+        if constexpr (std::is_integral_v<T>) {
+            res = std::from_chars(first, last, value, base);
+        } else {
+        #if defined(__cpp_lib_to_chars)
+            res = std::from_chars(first, last, value);
+        #else
+            // floating point from_chars is missing in older standard libraries, strtod needs a terminated copy
+            char buff[128];
+            size_t size = std::min(static_cast<size_t>(last - first), sizeof(buff) - 1);
+            memcpy(buff, first, size);
+            buff[size] = 0;
+            char* end = buff;
+            errno = 0;
+            if constexpr (std::is_same_v<T, float>)
+                value = strtof(buff, &end);
+            else if constexpr (std::is_same_v<T, double>)
+                value = strtod(buff, &end);
+            else
+                value = strtold(buff, &end);
+            res.ptr = first + (end - buff);
+            res.ec = (end == buff || errno == ERANGE) ? std::errc::result_out_of_range : std::errc();
+        #endif
+        }
+        if (res.ec != std::errc() || res.ptr == first)
+            return 0;
+        return static_cast<size_t>(res.ptr - str.data());
+    }
+
     /// Convert a integer/float number to string
     template <typename T> inline std::string to_string(const T& value)
     {
-        std::stringstream ss;
-        ss << value;
-        return ss.str();
+        if constexpr (is_number_v<T>) {
+            char buff[64];
+            char* end = to_chars(buff, buff + sizeof(buff), value);
+            return end ? std::string(buff, end) : std::string();
+        } else {
+            std::stringstream ss;
+            ss << value;
+            return ss.str();
+        }
     }
 
     /// Convert double number to string with specified precision
@@ -181,44 +294,52 @@ namespace str
     }
 
     /// Convert string to a number. optionally err_code argument will contain error, if it occurs.
-    template <typename T> inline T to_num(const std::string& str, int* err_code=nullptr)
+    template <typename T> inline T to_num(const std::string_view str, int* err_code=nullptr)
     {
-        T value;
-        std::stringstream ss(str);
-        int errorCode = (!(ss >> value)) ? 1 : 0;
+        T value{};
+        int errorCode = 0;
+        if constexpr (is_number_v<T>) {
+            if (!from_chars(str, value)) {
+                value = T();
+                errorCode = 1;
+            }
+        } else {
+            std::stringstream ss{std::string(str)};
+            errorCode = (!(ss >> value)) ? 1 : 0;
+        }
         if (err_code)
             *err_code = errorCode;
         return value;
     }
 
     /// Convert string to a number with default value def_val if not possible to convert.
-    template <typename T> inline T to_num_def(const std::string& str, T def_val)
+    template <typename T> inline T to_num_def(const std::string_view str, T def_val)
     {
-        T value;
-        std::stringstream ss(str);
-        return (!(ss >> value)) ? def_val : value;
+        int errorCode = 0;
+        T value = to_num<T>(str, &errorCode);
+        return errorCode ? def_val : value;
     }
 
     /// Convert string to integer. Optinally err_code can contain the error if if occurs.
-    inline int to_int(std::string str, int* err_code=nullptr)
+    inline int to_int(const std::string_view str, int* err_code=nullptr)
     {
         return to_num<int>(str, err_code);
     }
 
     /// Convert string to double. Optinally err_code can contain the error if if occurs.
-    inline double to_double(std::string str, int* err_code=nullptr)
+    inline double to_double(const std::string_view str, int* err_code=nullptr)
     {
         return to_num<double>(str, err_code);
     }
 
     /// Convert string to integer with default value def_val if not possible to convert.
-    inline int to_int_def(std::string str, int def_val)
+    inline int to_int_def(const std::string_view str, int def_val)
     {
         return to_num_def<int>(str, def_val);
     }
 
     /// Convert string to double with default value def_val if not possible to convert.
-    inline double to_double_def(std::string str, double def_val)
+    inline double to_double_def(const std::string_view str, double def_val)
     {
         return to_num_def<double>(str, def_val);
     }
@@ -245,85 +366,103 @@ namespace str
         return result;
     }
 
-    /// Convert hex string to a value. Optinally err_code will contain error, if it occurs.
+    /// Convert hex string (with optional 0x prefix) to a value. Optinally err_code will contain error, if it occurs.
     template <typename T> inline T hex_string_to_value(const std::string_view str, int* err_code=nullptr)
     {
-        std::stringstream ss;
-        ss << std::hex << str;
-        unsigned long x = 0;
-        int errorCode = (!(ss >> x)) ? 1 : 0;
+        size_t start = 0;
+        while (start < str.size() && isspace(static_cast<unsigned char>(str[start])))
+            start++;
+        if (start < str.size() && str[start] == '+')
+            start++;
+        if (start + 2 < str.size() && str[start] == '0' && (str[start + 1] == 'x' || str[start + 1] == 'X'))
+            start += 2;
+        unsigned long long x = 0;
+        int errorCode = from_chars(str.substr(start), x, 16) ? 0 : 1;
+        if (errorCode)
+            x = 0;
         if (err_code)
             *err_code = errorCode;
         return static_cast<T>(x);
     }
 
-    /// Format string with variadic number of arguments, simirally to printf
+    /// Format string with variadic number of arguments, simirally to printf.
+    /// Formats into a stack buffer first, the heap is used only for long results.
     template<typename... Args> std::string format(const char* fmt, Args... args)
     {
-        size_t size = snprintf(nullptr, 0, fmt, args...);
-        std::string buff;
-        buff.reserve(size + 1);
-        buff.resize(size);
-        snprintf(&buff[0], size + 1, fmt, args...);
+        char stack[256];
+        int size = snprintf(stack, sizeof(stack), fmt, args...);
+        if (size < 0)
+            return std::string();
+        if (static_cast<size_t>(size) < sizeof(stack))
+            return std::string(stack, static_cast<size_t>(size));
+        std::string buff(static_cast<size_t>(size), '\0');
+        snprintf(&buff[0], buff.size() + 1, fmt, args...);
         return buff;
     }
 
     // Format string with va_list args, simirally to printf
-    inline std::string formatv(const std::string fmt, va_list args)
+    inline std::string formatv(const std::string& fmt, va_list args)
     {
-        std::string str;
-        int size = 500;
-
-        while (true) {
-            str.resize(size);
-
-            #ifdef _MSC_VER
-                int n = _vsnprintf_s((char*)str.c_str(), size, size - 1, fmt.c_str(), args);
-            #else
-                int n = vsnprintf((char*)str.c_str(), size, fmt.c_str(), args);
-            #endif
-
-            if (n > -1 && n < size)
-                return str;
-
-            size = (n > -1) ? n + 1 : 2 * size;
-        }
+        char stack[256];
+        va_list argsCopy;
+        va_copy(argsCopy, args);
+        int size = vsnprintf(stack, sizeof(stack), fmt.c_str(), argsCopy);
+        va_end(argsCopy);
+        if (size < 0)
+            return std::string();
+        if (static_cast<size_t>(size) < sizeof(stack))
+            return std::string(stack, static_cast<size_t>(size));
+        std::string str(static_cast<size_t>(size), '\0');
+        vsnprintf(&str[0], str.size() + 1, fmt.c_str(), args);
+        return str;
     }
 
-    /// Splits a string by delimiter. It is possible to specify, if empty items are skiped and what is the maximum number of items.
-    inline std::vector<std::string> split(const std::string str, const std::string_view delim, bool skip_empty=false, size_t max_items=0)
+    /// Splits a string by delimiter into views of the string, without copying the items.
+    /// items is cleared first, it is any container with push_back of std::string_view, typically
+    /// small_vector<std::string_view, N>. The views are valid as long as the string is.
+    /// It is possible to specify, if empty items are skiped and what is the maximum number of items.
+    /// Returns the number of items.
+    template <typename Container> inline size_t split_view(const std::string_view str, const std::string_view delim,
+                                                           Container& items, bool skip_empty=false, size_t max_items=0)
     {
         size_t start = 0;
         size_t end = 0;
-        std::vector<std::string> items;
+        items.clear();
 
         if (max_items == 1) {
             items.push_back(str);
-            return items;
+            return items.size();
         }
 
-        while (end != std::string::npos && end != str.size())
+        while (end != std::string_view::npos && end != str.size())
         {
             end = str.find(delim, start);
 
-            if (end == std::string::npos)
+            if (end == std::string_view::npos)
                 end = str.size();
 
-            std::string item = str.substr(start, end - start);
+            std::string_view item = str.substr(start, end - start);
 
             if (!skip_empty || !item.empty())
                 items.push_back(item);
 
-            start = (end > str.size() - delim.size()) ? std::string::npos : end + delim.size();
+            start = end + delim.size() > str.size() ? std::string_view::npos : end + delim.size();
 
-            if (max_items != 0 && items.size() + 1 == max_items && end != std::string::npos) {
-                item = str.substr(start, std::string::npos);
-                items.push_back(item);
-                return items;
+            if (max_items != 0 && items.size() + 1 == max_items && start != std::string_view::npos) {
+                items.push_back(str.substr(start));
+                return items.size();
             }
         }
 
-        return items;
+        return items.size();
+    }
+
+    /// Splits a string by delimiter. It is possible to specify, if empty items are skiped and what is the maximum number of items.
+    inline std::vector<std::string> split(const std::string_view str, const std::string_view delim, bool skip_empty=false, size_t max_items=0)
+    {
+        small_vector<std::string_view, 16> views;
+        split_view(str, delim, views, skip_empty, max_items);
+        return std::vector<std::string>(views.begin(), views.end());
     }
 
     /// Splits a string by one of the delimiter characters.
@@ -1,6 +1,66 @@
+import os
 import platform
 import sys
+from distutils.ccompiler import new_compiler
+from distutils.cmd import Command
 from distutils.core import Extension, setup
+from distutils.sysconfig import customize_compiler
+
+DEVICE_SOURCES = ["py_fp/fpdev.cpp",
+                  "py_fp/fptransport.cpp",
+                  "py_fp/fpsim.cpp",
+                  "py_fp/fpsession.cpp"]
+
+
+class BenchCommand(Command):
+    """Builds the C++ microbenchmarks (build/fpbench), run against the simulated device"""
+    description = "build the C++ microbenchmarks"
+    user_options = []
+    target = "fpbench"
+    build_dir = "build/bench"
+    sources = ["bench/fpbench.cpp"] + DEVICE_SOURCES
+    needs_device = True
+    include_dirs = []
+    define_macros = []
+    extra_compile_args = []
+    extra_link_args = []
+
+    def initialize_options(self):
+        pass
+
+    def finalize_options(self):
+        pass
+
+    def run(self):
+        compiler = new_compiler()
+        customize_compiler(compiler)
+        compile_args = self.extra_compile_args + (["/O2", "/EHsc"] if sys.platform == "win32" else ["-O2"])
+        objects = compiler.compile(self.sources, output_dir=self.build_dir,
+                                   include_dirs=self.include_dirs + ["bench"], macros=self.define_macros,
+                                   extra_postargs=compile_args)
+        link_args = self.extra_link_args if self.needs_device else []
+        link_args = link_args + ([] if sys.platform == "win32" else ["-lpthread"])
+        libraries = ["okFrontPanel"] if sys.platform == "win32" and self.needs_device else []
+        compiler.link_executable(objects, self.target, output_dir="build", libraries=libraries,
+                                 extra_postargs=link_args, target_lang="c++")
+        print("built " + os.path.join("build", self.target))
+
+
+class TestsCommand(BenchCommand):
+    """Builds the C++ regression tests (build/fptest), run against the simulated device"""
+    description = "build the C++ regression tests"
+    target = "fptest"
+    build_dir = "build/tests"
+    sources = ["tests/fptest.cpp"] + DEVICE_SOURCES
+
+
+class LogDecodeCommand(BenchCommand):
+    """Builds the decoder of binary logs (build/fplogdecode)"""
+    description = "build the binary log decoder"
+    target = "fplogdecode"
+    build_dir = "build/logdecode"
+    sources = ["tools/fplogdecode.cpp"]
+    needs_device = False
 
 
 def main():
@@ -28,6 +88,11 @@ def main():
         extra_link_args=["/LIBPATH:frontpanel/win/x64"]
 
 
+    BenchCommand.include_dirs = include_dirs
+    BenchCommand.define_macros = define_macros
+    BenchCommand.extra_compile_args = extra_compile_args
+    BenchCommand.extra_link_args = extra_link_args
+
     setup(name="py_fp",
             version="1.0.5",
             description="Front Panel Library",
@@ -41,11 +106,11 @@ def main():
                 "py.typed",
                 "../libokFrontPanel.dylib",
             ]},
+            cmdclass={"bench": BenchCommand, "tests": TestsCommand, "logdecode": LogDecodeCommand},
             ext_modules=[
                  Extension(
-                    "py_fp",
-                    sources=["py_fp/py_fp.cpp",
-                             "py_fp/fpdev.cpp" ],
+                    "py_fp._py_fp",
+                    sources=["py_fp/py_fp.cpp"] + DEVICE_SOURCES,
                     include_dirs=include_dirs,
                     define_macros=define_macros,
                     extra_compile_args=extra_compile_args,
@@ -0,0 +1,289 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Regression tests of FPDev and the header-only helpers, run against the simulated device.
+//
+//   fptest [--filter <text>]
+//
+// Prints the failed checks and returns 1 if there were any.
+#define NOMINMAX
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bufferpool.h"
+#include "filelog.h"
+#include "fpdev.h"
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                   \
+    do {                                                                                   \
+        if (!(condition)){                                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                                    \
+        }                                                                                  \
+    } while (0)
+
+// Runs the test on another thread and ends the process if it does not finish in time, so that a
+// deadlock is reported instead of hanging the run
+static void runWithTimeout(const char* name, std::function<void()> test, int timeoutSec = 10)
+{
+    std::packaged_task<void()> task(test);
+    std::future<void> done = task.get_future();
+    std::thread thread(std::move(task));
+    if (done.wait_for(std::chrono::seconds(timeoutSec)) != std::future_status::ready){
+        fprintf(stderr, "%s: did not finish in %d s\n", name, timeoutSec);
+        std::_Exit(1);
+    }
+    thread.join();
+}
+
+static bool waitFor(std::function<bool()> condition, int timeoutMs = 2000)
+{
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (!condition()){
+        if (std::chrono::steady_clock::now() > end)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+//################################################################################
+//                      WIRE-OUT WATCHER
+//################################################################################
+
+static void testWatcherCallbackCloses()
+{
+    FPDev dev;
+    CHECK(dev.open("SIM:", "") == 0);
+    std::atomic<int> calls(0);
+    CHECK(dev.startWireOutWatcher(100, 0xFFFFFFFF, [&](const std::vector<FPWireOutEvent>&){
+        calls++;
+        dev.close();
+    }) == 0);
+    dev.setWireIn(0, 5);
+    CHECK(waitFor([&]{ return !dev.isOpen(); }));
+    dev.stopWireOutWatcher();
+    CHECK(calls == 1);
+}
+
+static void testWatcherCallbackStops()
+{
+    FPDev dev;
+    CHECK(dev.open("SIM:", "") == 0);
+    std::atomic<int> restart(1);
+    CHECK(dev.startWireOutWatcher(100, 0xFFFFFFFF, [&](const std::vector<FPWireOutEvent>&){
+        restart = dev.startWireOutWatcher(100);
+        dev.stopWireOutWatcher();
+    }) == 0);
+    dev.setWireIn(0, 5);
+    CHECK(waitFor([&]{ return restart != 1; }));
+    CHECK(restart == FPERR_INVALID_ARGUMENT);
+    CHECK(dev.close() == 0);
+}
+
+// a failed call closes the device while it holds the device lock the watcher is waiting for
+static void testCloseOnFailureWithWatcher()
+{
+    FPDev dev;
+    CHECK(dev.open("SIM:error=-1,error_rate=1", "") == 0);
+    dev.setCloseOnFailure(true);
+    CHECK(dev.startWireOutWatcher(1) == 0);
+    int rc = 0;
+    for (int i = 0; i < 1000 && rc != FPERR_NOT_CONNECTED; i++)
+        rc = dev.writeRegister(0x10, i);
+    CHECK(rc == FPERR_NOT_CONNECTED);
+    CHECK(!dev.isOpen());
+    CHECK(dev.close() == 0);
+}
+
+//################################################################################
+//                      FILE LOG
+//################################################################################
+
+// The hex dump of FileLog before the table-driven formatting, the layout must not change
+static void referenceHexDump(std::string& out, unsigned char* data, size_t size, size_t showSize, bool asciiTrans)
+{
+    const size_t asciiOffset = 100;
+    const size_t lineSize = 256;
+    char line[lineSize] = {0};
+    bool skipped = false;
+
+    if (size > showSize)
+        showSize /= 2;
+
+    for (size_t i = 0; i < size; i += 32) {
+
+        if (i >= showSize && !skipped) {
+            skipped = true;
+            out += "                                          ----- DATA SKIPPED -----\n";
+            if (size - showSize > i)
+                i = size - showSize;
+        }
+
+        memset(line, ' ', asciiOffset);
+
+        for (size_t j = 0; (j < 16) && (j + i < size); j++)
+            snprintf(&line[j * 3], 4, "%02x ", data[i + j]);
+        line[strlen(line)] = ' ';
+
+        for (size_t j = 16; (j < 32) && (j + i < size); j++)
+            snprintf(&line[j * 3 + 3], 4, "%02X ", data[i + j]);
+        line[strlen(line)] = ' ';
+
+        if (asciiTrans) {
+            memset(line + asciiOffset, 0, lineSize - asciiOffset);
+            line[strlen(line)] = '|';
+            line[strlen(line)] = ' ';
+
+            for (size_t j = 0; (j < 16) && (j + i < size); j++) {
+                unsigned char b = data[i + j];
+                line[asciiOffset + 2 + j] = (b > 0x20 && b < 0x80) ? b : '.';
+            }
+
+            line[strlen(line)] = ' ';
+            line[strlen(line)] = ' ';
+
+            for (size_t j = 16; (j < 32) && (j + i < size); j++) {
+                unsigned char b = data[i + j];
+                line[asciiOffset + 2 + j + 1] = (b > 0x20 && b < 0x80) ? b : '.';
+            }
+        }
+        else {
+            line[asciiOffset] = '\0';
+        }
+
+        out += "   ";
+        out += line;
+        out += " \n";
+    }
+
+    if (size > 64)
+        out += "   Bytes: " + std::to_string((unsigned)size) + "\n";
+
+    out += "\n";
+}
+
+struct TestFileLog : public FileLog
+{
+    using FileLog::FileLog;
+    using FileLog::formatBuffer;
+};
+
+static void testHexDumpLayout()
+{
+    TestFileLog log("", false, false);
+    std::vector<unsigned char> buffer(1200 + 4);
+    for (size_t i = 0; i < buffer.size(); i++)
+        buffer[i] = static_cast<unsigned char>(i * 37 + i / 256);
+
+    const size_t showSizes[] = {0, 1, 32, 64, 100, 250, 1000, 5000};
+    int mismatches = 0;
+    for (size_t size = 0; size <= 1200; size += size < 300 ? 1 : 7){
+        for (size_t offset = 0; offset < 4; offset++){
+            for (size_t showSize : showSizes){
+                for (bool ascii : {true, false}){
+                    std::string expected, actual;
+                    referenceHexDump(expected, buffer.data() + offset, size, showSize, ascii);
+                    log.formatBuffer(actual, buffer.data() + offset, size, showSize, ascii);
+                    if (expected != actual && mismatches++ < 5)
+                        fprintf(stderr, "hex dump differs: size %zu, offset %zu, show %zu, ascii %d\n",
+                                size, offset, showSize, ascii);
+                }
+            }
+        }
+    }
+    CHECK(mismatches == 0);
+}
+
+//################################################################################
+//                      BUFFER POOL
+//################################################################################
+
+template <size_t N> struct Bytes { unsigned char value[N]; };
+
+// Elements whose size is not a power of two do not fill the pooled blocks exactly, the blocks must
+// still return to the pool and the accounting must come back to zero
+template <class T> static void checkPoolElements()
+{
+    BufferPool pool(64 << 20);
+    const size_t sizes[] = {1, 5, 100, 1000, 100000, 1000000};
+    unsigned long long firstRoundHits = 0;
+    for (int round = 0; round < 3; round++){
+        for (size_t size : sizes){
+            Buffer<T> buffer = pool.lease<T>(size);
+            CHECK(buffer.capacity() >= size);
+        }
+        if (round == 0)
+            firstRoundHits = pool.stats().hits;
+    }
+    // every lease after the first round is served from the pool
+    BufferPoolStats stats = pool.stats();
+    CHECK(stats.leasedBytes == 0);
+    CHECK(stats.leases == 18);
+    CHECK(stats.hits - firstRoundHits == 12);
+    pool.trim();
+    CHECK(pool.stats().cachedBytes == 0);
+}
+
+static void testPoolOddElements()
+{
+    checkPoolElements<Bytes<3>>();
+    checkPoolElements<Bytes<12>>();
+}
+
+int main(int argc, char* argv[])
+{
+    const char* filter = "";
+    for (int i = 1; i < argc; i++){
+        if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+            filter = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [--filter <text>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    struct { const char* name; void (*test)(); } tests[] = {
+        {"watcher_callback_closes", testWatcherCallbackCloses},
+        {"watcher_callback_stops", testWatcherCallbackStops},
+        {"close_on_failure_with_watcher", testCloseOnFailureWithWatcher},
+        {"hex_dump_layout", testHexDumpLayout},
+        {"pool_odd_elements", testPoolOddElements},
+    };
+    for (const auto& test : tests){
+        if (!strstr(test.name, filter))
+            continue;
+        int before = failures;
+        runWithTimeout(test.name, test.test);
+        fprintf(stderr, "%-40s %s\n", test.name, failures == before ? "ok" : "FAILED");
+    }
+    fprintf(stderr, "%d failed checks\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,51 @@
+/*
+Copyright (c) 2023 Daniel Turecek <daniel@turecek.de>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Decodes a binary log (BinLog, binlog.h) into the FileLog text format.
+//
+//   fplogdecode <file.fpbl> [<file.log>]
+//
+// The text is written to stdout when no output file is given.
+#define NOMINMAX
+#include <cstdio>
+#include "binlog.h"
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argc > 3){
+        fprintf(stderr, "Usage: %s <file.fpbl> [<file.log>]\n", argv[0]);
+        return 2;
+    }
+
+    FILE* out = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if (!out){
+        fprintf(stderr, "Cannot create %s\n", argv[2]);
+        return 1;
+    }
+    long long count = BinLogReader::decode(argv[1], out);
+    if (argc == 3)
+        fclose(out);
+    if (count < 0){
+        fprintf(stderr, "%s is not a binary log\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}